@@ -43,6 +43,65 @@ glm::vec3 plane::project(const glm::vec3& v) const
 }
 
 
+static plane frustum_plane(const glm::mat4x4& m, int row, float sign)
+{
+	glm::vec4 v;
+	for (int i = 0; i < 4; ++i)
+		v[i] = m[i][3] + sign * m[i][row];
+
+	float k = glm::length(glm::vec3(v.x, v.y, v.z));
+	plane result;
+	result.a = v.x / k;
+	result.b = v.y / k;
+	result.c = v.z / k;
+	result.d = v.w / k;
+	return result;
+}
+
+
+frustum::frustum(const glm::mat4x4& transform)
+{
+	planes[0] = frustum_plane(transform, 0, 1);
+	planes[1] = frustum_plane(transform, 0, -1);
+	planes[2] = frustum_plane(transform, 1, 1);
+	planes[3] = frustum_plane(transform, 1, -1);
+	planes[4] = frustum_plane(transform, 2, 1);
+	planes[5] = frustum_plane(transform, 2, -1);
+}
+
+
+bool frustum::contains(glm::vec3 p) const
+{
+	for (int i = 0; i < 6; ++i)
+		if (distance(p, planes[i]) < 0)
+			return false;
+	return true;
+}
+
+
+bool frustum::intersects(bounds3f b) const
+{
+	for (int i = 0; i < 6; ++i)
+	{
+		// the corner furthest along the plane normal
+		const plane& q = planes[i];
+		glm::vec3 p(q.a >= 0 ? b.max.x : b.min.x, q.b >= 0 ? b.max.y : b.min.y, q.c >= 0 ? b.max.z : b.min.z);
+		if (distance(p, q) < 0)
+			return false;
+	}
+	return true;
+}
+
+
+bool frustum::intersects(glm::vec3 center, float radius) const
+{
+	for (int i = 0; i < 6; ++i)
+		if (distance(center, planes[i]) < -radius)
+			return false;
+	return true;
+}
+
+
 static bool almost_zero(float value)
 {
 	static const float epsilon = 10 * std::numeric_limits<float>::epsilon();
@@ -56,132 +115,69 @@ float distance(glm::vec3 v, plane p)
 }
 
 
-const float* intersect(ray r, plane p)
+intersection intersect(ray r, plane p)
 {
-	static float result;
-
 	float denom = glm::dot(p.normal(), r.direction);
 	if (almost_zero(denom))
-		return nullptr;
+		return intersection();
 
 	float nom = glm::dot(p.normal(), r.origin) + p.d;
-	result = -(nom / denom);
-	return &result;
+	return intersection(r, -(nom / denom), p.normal());
 }
 
 
-const float* intersect(ray r, bounds3f b)
+static void intersect_face(const ray& r, float t, glm::vec3 normal, const bounds2f& face, int u, int v, intersection& result)
 {
-	static float result;
+	if (t < 0 || (result.hit && t >= result.distance))
+		return;
 
+	glm::vec3 p = r.point(t);
+	if (face.contains(p[u], p[v]))
+		result = intersection(r, t, normal);
+}
+
+
+intersection intersect(ray r, bounds3f b)
+{
 	if (b.is_empty())
-		return nullptr;
+		return intersection();
 
 	if (b.contains(r.origin))
-	{
-		result = 0;
-		return &result;
-	}
+		return intersection(r, 0, glm::vec3(0, 0, 0));
 
 	glm::vec3 e = glm::vec3(0.001, 0.001, 0.001);
 	bounds3f b2(b.min - e, b.max + e);
-	bool hit = false;
+	bounds2f yz(b2.min.y, b2.min.z, b2.max.y, b2.max.z);
+	bounds2f xz(b2.min.x, b2.min.z, b2.max.x, b2.max.z);
+	bounds2f xy(b2.min.x, b2.min.y, b2.max.x, b2.max.y);
+
+	intersection result;
 
 	if (r.origin.x <= b.min.x && r.direction.x > 0) // min x
-	{
-		float t = (b.min.x - r.origin.x) / r.direction.x;
-		if (t >= 0)
-		{
-			glm::vec3 p = r.point(t);
-			if (p.y >= b2.min.y && p.y <= b2.max.y &&
-					p.z >= b2.min.z && p.z <= b2.max.z &&
-					(!hit || t < result))
-			{
-				hit = true;
-				result = t;
-			}
-		}
-	}
+		intersect_face(r, (b.min.x - r.origin.x) / r.direction.x, glm::vec3(-1, 0, 0), yz, 1, 2, result);
 
 	if (r.origin.x >= b.max.x && r.direction.x < 0) // max x
-	{
-		float t = (b.max.x - r.origin.x) / r.direction.x;
-		if (t >= 0)
-		{
-			glm::vec3 p = r.point(t);
-			if (p.y >= b2.min.y && p.y <= b2.max.y &&
-					p.z >= b2.min.z && p.z <= b2.max.z &&
-					(!hit || t < result))
-			{
-				hit = true;
-				result = t;
-			}
-		}
-	}
+		intersect_face(r, (b.max.x - r.origin.x) / r.direction.x, glm::vec3(1, 0, 0), yz, 1, 2, result);
 
 	if (r.origin.y <= b.min.y && r.direction.y > 0) // min y
-	{
-		float t = (b.min.y - r.origin.y) / r.direction.y;
-		if (t >= 0)
-		{
-			glm::vec3 p = r.point(t);
-			if (p.x >= b2.min.x && p.x <= b2.max.x &&
-					p.z >= b2.min.z && p.z <= b2.max.z &&
-					(!hit || t < result))
-			{
-				hit = true;
-				result = t;
-			}
-		}
-	}
+		intersect_face(r, (b.min.y - r.origin.y) / r.direction.y, glm::vec3(0, -1, 0), xz, 0, 2, result);
 
 	if (r.origin.y >= b.max.y && r.direction.y < 0) // max y
-	{
-		float t = (b.max.y - r.origin.y) / r.direction.y;
-		if (t >= 0)
-		{
-			glm::vec3 p = r.point(t);
-			if (p.x >= b2.min.x && p.x <= b2.max.x &&
-					p.z >= b2.min.z && p.z <= b2.max.z &&
-					(!hit || t < result))
-			{
-				hit = true;
-				result = t;
-			}
-		}
-	}
+		intersect_face(r, (b.max.y - r.origin.y) / r.direction.y, glm::vec3(0, 1, 0), xz, 0, 2, result);
 
 	if (r.origin.z <= b.min.z && r.direction.z > 0) // min z
-	{
-		float t = (b.min.z - r.origin.z) / r.direction.z;
-		if (t >= 0)
-		{
-			glm::vec3 p = r.point(t);
-			if (p.x >= b2.min.x && p.x <= b2.max.x &&
-					p.y >= b2.min.y && p.y <= b2.max.y &&
-					(!hit || t < result))
-			{
-				hit = true;
-				result = t;
-			}
-		}
-	}
+		intersect_face(r, (b.min.z - r.origin.z) / r.direction.z, glm::vec3(0, 0, -1), xy, 0, 1, result);
 
 	if (r.origin.z >= b.max.z && r.direction.z < 0) // max z
-	{
-		float t = (b.max.z - r.origin.z) / r.direction.z;
-		if (t >= 0)
-		{
-			glm::vec3 p = r.point(t);
-			if (p.x >= b2.min.x && p.x <= b2.max.x &&
-					p.y >= b2.min.y && p.y <= b2.max.y &&
-					(!hit || t < result))
-			{
-				hit = true;
-				result = t;
-			}
-		}
-	}
+		intersect_face(r, (b.max.z - r.origin.z) / r.direction.z, glm::vec3(0, 0, 1), xy, 0, 1, result);
+
+	return result;
+}
 
-	return hit ? &result : nullptr;
+
+glm::vec3 eye_position(const glm::mat4x4& transform)
+{
+	// the eye is the point that projects to x = y = w = 0
+	glm::vec4 p = glm::inverse(transform) * glm::vec4(0, 0, 1, 0);
+	return glm::vec3(p.x, p.y, p.z) / p.w;
 }
@@ -78,9 +78,42 @@ struct ray
 };
 
 
+struct intersection
+{
+	bool hit;
+	float distance;
+	glm::vec3 point;
+	glm::vec3 normal;
+
+	intersection() : hit(false), distance(0), point(0, 0, 0), normal(0, 0, 0) {}
+	intersection(const ray& r, float d, glm::vec3 n) : hit(true), distance(d), point(r.point(d)), normal(n) {}
+};
+
+
+// View frustum of a projection * view transform. The planes face inwards.
+
+struct frustum
+{
+	plane planes[6];
+
+	frustum() {}
+	explicit frustum(const glm::mat4x4& transform);
+
+	bool contains(glm::vec3 p) const;
+	bool intersects(bounds3f b) const;
+	bool intersects(glm::vec3 center, float radius) const;
+};
+
+
 float distance(glm::vec3 v, plane p);
-const float* intersect(ray r, plane p);
-const float* intersect(ray r, bounds3f b);
+intersection intersect(ray r, plane p);
+intersection intersect(ray r, bounds3f b);
+
+glm::vec3 eye_position(const glm::mat4x4& transform);
+
+// Maps a normal through a componentwise scale, whose inverse transpose
+// divides by the scale.
+inline glm::vec3 scale_normal(glm::vec3 normal, glm::vec3 scale) { return glm::normalize(normal / scale); }
 
 
 #endif
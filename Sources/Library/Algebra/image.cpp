@@ -245,6 +245,23 @@ image::~image()
 }
 
 
+pixel_view<rgba8> image::view()
+{
+	rgba8* data = reinterpret_cast<rgba8*>(const_cast<GLvoid*>(pixels()));
+#ifdef OPENWAR_USE_SDL
+	return pixel_view<rgba8>(data, width(), height(), _surface->pitch / 4);
+#else
+	return pixel_view<rgba8>(data, width(), height(), width());
+#endif
+}
+
+
+pixel_view<const rgba8> image::view() const
+{
+	return const_cast<image*>(this)->view();
+}
+
+
 glm::vec4 image::get_pixel(int x, int y) const
 {
 	if (0 <= x && x < (int) width() && 0 <= y && y < (int) height())
@@ -274,16 +291,7 @@ void image::set_pixel(int x, int y, glm::vec4 c)
 
 void image::premultiply_alpha()
 {
-	glm::ivec2 s = size();
-	for (int x = 0; x < s.x; ++x)
-		for (int y = 0; y < s.y; ++y)
-		{
-			glm::vec4 c = get_pixel(x, y);
-			c.r *= c.a;
-			c.g *= c.a;
-			c.b *= c.a;
-			set_pixel(x, y, c);
-		}
+	::premultiply_alpha(view());
 }
 
 
@@ -32,6 +32,7 @@
 #endif
 
 #include "../resource.h"
+#include "pixel_view.h"
 
 
 class image
@@ -71,6 +72,9 @@ public:
 	glm::ivec2 size() const { return glm::ivec2(_width, _height); }
 #endif
 
+	pixel_view<rgba8> view();
+	pixel_view<const rgba8> view() const;
+
 	glm::vec4 get_pixel(int x, int y) const;
 	void set_pixel(int x, int y, glm::vec4 c);
 
@@ -0,0 +1,202 @@
+// Copyright (C) 2013 Felix Ungman
+//
+// This file is part of the openwar platform (GPL v3 or later), see LICENSE.txt
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "paged_image.h"
+
+
+// The tiles start at a page boundary, so that each tile of 64 x 64 pixels
+// or more covers whole pages of the mapping.
+
+static const char paged_image_magic[4] = { 'O', 'W', 'P', 'I' };
+static const uint32_t paged_image_version = 1;
+static const uint32_t paged_image_data_offset = 4096;
+
+
+struct paged_image_header
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t tile_size;
+	uint32_t data_offset;
+};
+
+
+static int tile_shift(int tile_size)
+{
+	int shift = 0;
+	while (shift < 16 && (1 << shift) < tile_size)
+		++shift;
+	return (1 << shift) == tile_size ? shift : -1;
+}
+
+
+
+paged_image::paged_image() :
+_fd(-1),
+_mapping(nullptr),
+_length(0),
+_pixels(nullptr),
+_width(0),
+_height(0),
+_tile_shift(0),
+_tiles_x(0),
+_tiles_y(0)
+{
+}
+
+
+paged_image::~paged_image()
+{
+	close();
+}
+
+
+bool paged_image::open(const char* path)
+{
+	close();
+
+	_fd = ::open(path, O_RDONLY);
+	if (_fd == -1)
+		return false;
+
+	struct stat st;
+	if (fstat(_fd, &st) != 0 || (size_t)st.st_size < sizeof(paged_image_header))
+	{
+		close();
+		return false;
+	}
+
+	_length = (size_t)st.st_size;
+	_mapping = mmap(nullptr, _length, PROT_READ, MAP_PRIVATE, _fd, 0);
+	if (_mapping == MAP_FAILED)
+	{
+		_mapping = nullptr;
+		close();
+		return false;
+	}
+
+	if (!attach(_mapping, _length))
+	{
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+
+bool paged_image::attach(const void* data, size_t length)
+{
+	if (length < sizeof(paged_image_header))
+		return false;
+
+	const paged_image_header* header = static_cast<const paged_image_header*>(data);
+	if (std::memcmp(header->magic, paged_image_magic, 4) != 0 || header->version != paged_image_version)
+		return false;
+
+	int shift = tile_shift((int)header->tile_size);
+	if (shift < 0)
+		return false;
+
+	int tile_size = 1 << shift;
+	int tiles_x = ((int)header->width + tile_size - 1) / tile_size;
+	int tiles_y = ((int)header->height + tile_size - 1) / tile_size;
+	size_t data_length = (size_t)tiles_x * tiles_y * tile_size * tile_size * sizeof(rgba8);
+	if (header->data_offset + data_length > length)
+		return false;
+
+	_width = (int)header->width;
+	_height = (int)header->height;
+	_tile_shift = shift;
+	_tiles_x = tiles_x;
+	_tiles_y = tiles_y;
+	_pixels = reinterpret_cast<const rgba8*>(static_cast<const char*>(data) + header->data_offset);
+
+	return true;
+}
+
+
+void paged_image::close()
+{
+	if (_mapping != nullptr)
+		munmap(_mapping, _length);
+	if (_fd != -1)
+		::close(_fd);
+
+	_fd = -1;
+	_mapping = nullptr;
+	_length = 0;
+	_pixels = nullptr;
+	_width = 0;
+	_height = 0;
+	_tiles_x = 0;
+	_tiles_y = 0;
+}
+
+
+bool paged_image::write(const char* path, pixel_view<const rgba8> pixels, int tile_size)
+{
+	if (tile_shift(tile_size) < 0)
+		return false;
+
+	FILE* file = std::fopen(path, "wb");
+	if (file == nullptr)
+		return false;
+
+	bool ok = write(file, pixels, tile_size);
+
+	return std::fclose(file) == 0 && ok;
+}
+
+
+bool paged_image::write(FILE* file, pixel_view<const rgba8> pixels, int tile_size)
+{
+	if (tile_shift(tile_size) < 0)
+		return false;
+
+	std::vector<char> header_page(paged_image_data_offset, 0);
+	paged_image_header* header = reinterpret_cast<paged_image_header*>(header_page.data());
+	std::memcpy(header->magic, paged_image_magic, 4);
+	header->version = paged_image_version;
+	header->width = (uint32_t)pixels.width();
+	header->height = (uint32_t)pixels.height();
+	header->tile_size = (uint32_t)tile_size;
+	header->data_offset = paged_image_data_offset;
+
+	bool ok = std::fwrite(header_page.data(), header_page.size(), 1, file) == 1;
+
+	std::vector<rgba8> tile(tile_size * tile_size);
+	for (int ty = 0; ok && ty * tile_size < pixels.height(); ++ty)
+		for (int tx = 0; ok && tx * tile_size < pixels.width(); ++tx)
+		{
+			for (int y = 0; y < tile_size; ++y)
+				for (int x = 0; x < tile_size; ++x)
+					tile[x + y * tile_size] = pixels.get(tx * tile_size + x, ty * tile_size + y);
+
+			ok = std::fwrite(tile.data(), sizeof(rgba8), tile.size(), file) == tile.size();
+		}
+
+	return ok;
+}
+
+
+pixel_view<const rgba8> paged_image::tile(int tx, int ty) const
+{
+	int tile_size = 1 << _tile_shift;
+	const rgba8* data = _pixels + ((tx + ty * _tiles_x) << (2 * _tile_shift));
+	int width = glm::min(tile_size, _width - tx * tile_size);
+	int height = glm::min(tile_size, _height - ty * tile_size);
+	return pixel_view<const rgba8>(data, width, height, tile_size);
+}
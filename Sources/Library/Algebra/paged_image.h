@@ -0,0 +1,67 @@
+// Copyright (C) 2013 Felix Ungman
+//
+// This file is part of the openwar platform (GPL v3 or later), see LICENSE.txt
+
+#ifndef PAGED_IMAGE_H
+#define PAGED_IMAGE_H
+
+#include <cstddef>
+#include <cstdio>
+#include "pixel_view.h"
+
+
+// Read-only rgba8 image stored as square tiles in a memory-mapped file.
+// Only the pages of the tiles that are actually read become resident, so
+// the image may be much larger than the memory available. The tile size
+// is a power of two, and tiles along the right and bottom edges are
+// padded to full size. The image may also be a section of a larger file,
+// in which case the section should start at a page boundary.
+
+class paged_image
+{
+	int _fd;
+	void* _mapping;
+	size_t _length;
+	const rgba8* _pixels;
+	int _width;
+	int _height;
+	int _tile_shift;
+	int _tiles_x;
+	int _tiles_y;
+
+public:
+	paged_image();
+	~paged_image();
+
+	bool open(const char* path);
+	bool attach(const void* data, size_t length);
+	void close();
+	bool is_open() const { return _pixels != nullptr; }
+
+	static bool write(const char* path, pixel_view<const rgba8> pixels, int tile_size);
+	static bool write(FILE* file, pixel_view<const rgba8> pixels, int tile_size);
+
+	glm::ivec2 size() const { return glm::ivec2(_width, _height); }
+	int tile_size() const { return 1 << _tile_shift; }
+	glm::ivec2 tile_count() const { return glm::ivec2(_tiles_x, _tiles_y); }
+
+	pixel_view<const rgba8> tile(int tx, int ty) const;
+
+	bool contains(int x, int y) const { return 0 <= x && x < _width && 0 <= y && y < _height; }
+
+	const rgba8& at(int x, int y) const
+	{
+		int mask = (1 << _tile_shift) - 1;
+		int t = (x >> _tile_shift) + (y >> _tile_shift) * _tiles_x;
+		return _pixels[(t << (2 * _tile_shift)) + ((y & mask) << _tile_shift) + (x & mask)];
+	}
+
+	rgba8 get(int x, int y, rgba8 fallback = rgba8()) const { return contains(x, y) ? at(x, y) : fallback; }
+
+private:
+	paged_image(const paged_image&);
+	paged_image& operator=(const paged_image&);
+};
+
+
+#endif
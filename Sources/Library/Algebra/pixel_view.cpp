@@ -0,0 +1,211 @@
+// Copyright (C) 2013 Felix Ungman
+//
+// This file is part of the openwar platform (GPL v3 or later), see LICENSE.txt
+
+#include <cstring>
+#include "pixel_view.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define PIXEL_VIEW_USE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+
+static inline unsigned char mul_div_255(int a, int b)
+{
+	int t = a * b + 128;
+	return (unsigned char)((t + (t >> 8)) >> 8);
+}
+
+
+#if PIXEL_VIEW_USE_SSE2
+
+static inline void unpack_ps(__m128i v, __m128& f0, __m128& f1, __m128& f2, __m128& f3)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i lo = _mm_unpacklo_epi8(v, zero);
+	__m128i hi = _mm_unpackhi_epi8(v, zero);
+	f0 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero));
+	f1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero));
+	f2 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero));
+	f3 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero));
+}
+
+
+// Same rounding as round_clamp_255: clamp, add 0.5 and truncate. The
+// default _mm_cvtps_epi32 rounds half to even and would differ at .5.
+static inline __m128i round_clamp_255_ps(__m128 f)
+{
+	f = _mm_min_ps(_mm_max_ps(f, _mm_setzero_ps()), _mm_set1_ps(255));
+	return _mm_cvttps_epi32(_mm_add_ps(f, _mm_set1_ps(0.5f)));
+}
+
+
+static inline __m128i pack_ps(__m128 f0, __m128 f1, __m128 f2, __m128 f3)
+{
+	__m128i i01 = _mm_packs_epi32(round_clamp_255_ps(f0), round_clamp_255_ps(f1));
+	__m128i i23 = _mm_packs_epi32(round_clamp_255_ps(f2), round_clamp_255_ps(f3));
+	return _mm_packus_epi16(i01, i23);
+}
+
+
+static inline __m128 mix_ps(__m128 a, __m128 b, __m128 t)
+{
+	return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t));
+}
+
+#endif
+
+
+void premultiply_alpha(pixel_view<rgba8> pixels)
+{
+	for (int y = 0; y < pixels.height(); ++y)
+	{
+		rgba8* p = pixels.row(y);
+		int n = pixels.width();
+		int x = 0;
+
+#if PIXEL_VIEW_USE_SSE2
+		__m128i zero = _mm_setzero_si128();
+		__m128i round = _mm_set1_epi16(128);
+		__m128i alpha_mask = _mm_set1_epi32((int)0xFF000000);
+		for (; x + 4 <= n; x += 4)
+		{
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + x));
+
+			__m128i lo = _mm_unpacklo_epi8(v, zero);
+			__m128i hi = _mm_unpackhi_epi8(v, zero);
+			__m128i alo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, 0xFF), 0xFF);
+			__m128i ahi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, 0xFF), 0xFF);
+
+			lo = _mm_add_epi16(_mm_mullo_epi16(lo, alo), round);
+			hi = _mm_add_epi16(_mm_mullo_epi16(hi, ahi), round);
+			lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+			hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+
+			__m128i r = _mm_packus_epi16(lo, hi);
+			r = _mm_or_si128(_mm_andnot_si128(alpha_mask, r), _mm_and_si128(v, alpha_mask));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(p + x), r);
+		}
+#endif
+
+		for (; x < n; ++x)
+		{
+			rgba8& c = p[x];
+			c.r = mul_div_255(c.r, c.a);
+			c.g = mul_div_255(c.g, c.a);
+			c.b = mul_div_255(c.b, c.a);
+		}
+	}
+}
+
+
+void copy_pixels(pixel_view<rgba8> dst, pixel_view<const rgba8> src)
+{
+	size_t bytes = sizeof(rgba8) * (size_t)dst.width();
+	for (int y = 0; y < dst.height(); ++y)
+		std::memcpy(dst.row(y), src.row(y), bytes);
+}
+
+
+void fill_pixels(pixel_view<rgba8> dst, rgba8 value)
+{
+	for (int y = 0; y < dst.height(); ++y)
+	{
+		rgba8* p = dst.row(y);
+		for (int x = 0; x < dst.width(); ++x)
+			p[x] = value;
+	}
+}
+
+
+void blend_pixels(pixel_view<rgba8> dst, pixel_view<const rgba8> src, float t)
+{
+	for (int y = 0; y < dst.height(); ++y)
+	{
+		rgba8* d = dst.row(y);
+		const rgba8* s = src.row(y);
+		int n = dst.width();
+		int x = 0;
+
+#if PIXEL_VIEW_USE_SSE2
+		__m128 tt = _mm_set1_ps(t);
+		for (; x + 4 <= n; x += 4)
+		{
+			__m128 d0, d1, d2, d3, s0, s1, s2, s3;
+			unpack_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(d + x)), d0, d1, d2, d3);
+			unpack_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + x)), s0, s1, s2, s3);
+			__m128i r = pack_ps(mix_ps(d0, s0, tt), mix_ps(d1, s1, tt), mix_ps(d2, s2, tt), mix_ps(d3, s3, tt));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(d + x), r);
+		}
+#endif
+
+		for (; x < n; ++x)
+			for (int c = 0; c < 4; ++c)
+				d[x][c] = round_clamp_255(d[x][c] + (s[x][c] - d[x][c]) * t);
+	}
+}
+
+
+void blend_channel(pixel_view<rgba8> dst, pixel_view<const rgba8> src, int channel, pixel_view<const float> weights)
+{
+	for (int y = 0; y < dst.height(); ++y)
+	{
+		rgba8* d = dst.row(y);
+		const rgba8* s = src.row(y);
+		const float* w = weights.row(y);
+		int n = dst.width();
+		int x = 0;
+
+#if PIXEL_VIEW_USE_SSE2
+		__m128i shift = _mm_cvtsi32_si128(8 * channel);
+		__m128i mask = _mm_set1_epi32(0xFF);
+		__m128i channel_mask = _mm_sll_epi32(mask, shift);
+		for (; x + 4 <= n; x += 4)
+		{
+			__m128i dv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(d + x));
+			__m128i sv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + x));
+			__m128 dc = _mm_cvtepi32_ps(_mm_and_si128(_mm_srl_epi32(dv, shift), mask));
+			__m128 sc = _mm_cvtepi32_ps(_mm_and_si128(_mm_srl_epi32(sv, shift), mask));
+
+			__m128 r = mix_ps(dc, sc, _mm_loadu_ps(w + x));
+			__m128i ri = _mm_sll_epi32(round_clamp_255_ps(r), shift);
+			dv = _mm_or_si128(_mm_andnot_si128(channel_mask, dv), ri);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(d + x), dv);
+		}
+#endif
+
+		for (; x < n; ++x)
+			d[x][channel] = round_clamp_255(d[x][channel] + (s[x][channel] - d[x][channel]) * w[x]);
+	}
+}
+
+
+void extract_channel(pixel_view<unsigned char> dst, pixel_view<const rgba8> src, int channel)
+{
+	for (int y = 0; y < dst.height(); ++y)
+	{
+		unsigned char* d = dst.row(y);
+		const rgba8* s = src.row(y);
+		int n = dst.width();
+		int x = 0;
+
+#if PIXEL_VIEW_USE_SSE2
+		__m128i shift = _mm_cvtsi32_si128(8 * channel);
+		__m128i mask = _mm_set1_epi32(0xFF);
+		for (; x + 16 <= n; x += 16)
+		{
+			const __m128i* p = reinterpret_cast<const __m128i*>(s + x);
+			__m128i c0 = _mm_and_si128(_mm_srl_epi32(_mm_loadu_si128(p + 0), shift), mask);
+			__m128i c1 = _mm_and_si128(_mm_srl_epi32(_mm_loadu_si128(p + 1), shift), mask);
+			__m128i c2 = _mm_and_si128(_mm_srl_epi32(_mm_loadu_si128(p + 2), shift), mask);
+			__m128i c3 = _mm_and_si128(_mm_srl_epi32(_mm_loadu_si128(p + 3), shift), mask);
+			__m128i r = _mm_packus_epi16(_mm_packs_epi32(c0, c1), _mm_packs_epi32(c2, c3));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(d + x), r);
+		}
+#endif
+
+		for (; x < n; ++x)
+			d[x] = s[x][channel];
+	}
+}
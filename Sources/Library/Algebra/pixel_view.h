@@ -0,0 +1,117 @@
+// Copyright (C) 2013 Felix Ungman
+//
+// This file is part of the openwar platform (GPL v3 or later), see LICENSE.txt
+
+#ifndef PIXEL_VIEW_H
+#define PIXEL_VIEW_H
+
+#include <glm/glm.hpp>
+
+
+struct rgba8
+{
+	unsigned char r, g, b, a;
+
+	rgba8() : r(0), g(0), b(0), a(0) {}
+	rgba8(unsigned char r_, unsigned char g_, unsigned char b_, unsigned char a_) : r(r_), g(g_), b(b_), a(a_) {}
+
+	unsigned char operator[](int channel) const { return (&r)[channel]; }
+	unsigned char& operator[](int channel) { return (&r)[channel]; }
+};
+
+
+enum pixel_channel
+{
+	pixel_channel_r = 0,
+	pixel_channel_g = 1,
+	pixel_channel_b = 2,
+	pixel_channel_a = 3
+};
+
+
+// Non-owning view of a 2D pixel grid. The stride is measured in pixels.
+// at() and row() do no bounds checking; get() returns a fallback value
+// for coordinates outside the view.
+
+template <class T>
+class pixel_view
+{
+	T* _data;
+	int _width;
+	int _height;
+	int _stride;
+
+public:
+	typedef T pixel_type;
+
+	pixel_view() : _data(nullptr), _width(0), _height(0), _stride(0) {}
+	pixel_view(T* data, int width, int height, int stride) : _data(data), _width(width), _height(height), _stride(stride) {}
+
+	template <class U>
+	pixel_view(const pixel_view<U>& other) : _data(other.data()), _width(other.width()), _height(other.height()), _stride(other.stride()) {}
+
+	T* data() const { return _data; }
+	int width() const { return _width; }
+	int height() const { return _height; }
+	int stride() const { return _stride; }
+	glm::ivec2 size() const { return glm::ivec2(_width, _height); }
+	bool empty() const { return _width <= 0 || _height <= 0; }
+
+	bool contains(int x, int y) const { return 0 <= x && x < _width && 0 <= y && y < _height; }
+
+	T* row(int y) const { return _data + y * _stride; }
+	T& at(int x, int y) const { return _data[x + y * _stride]; }
+
+	T get(int x, int y, T fallback = T()) const { return contains(x, y) ? at(x, y) : fallback; }
+
+	pixel_view<T> subview(int x, int y, int width, int height) const
+	{
+		return pixel_view<T>(_data + x + y * _stride, width, height, _stride);
+	}
+
+	// Returns the part of the rectangle (x, y, width, height) that lies
+	// within the view, and its offset relative to (x, y) in 'offset'.
+	pixel_view<T> clip(int x, int y, int width, int height, glm::ivec2& offset) const
+	{
+		int x0 = glm::max(x, 0);
+		int y0 = glm::max(y, 0);
+		int x1 = glm::min(x + width, _width);
+		int y1 = glm::min(y + height, _height);
+		offset = glm::ivec2(x0 - x, y0 - y);
+		if (x1 <= x0 || y1 <= y0)
+			return pixel_view<T>();
+		return subview(x0, y0, x1 - x0, y1 - y0);
+	}
+};
+
+
+// Rounds a channel value to the nearest byte, saturating.
+inline unsigned char round_clamp_255(float value)
+{
+	if (value <= 0)
+		return 0;
+	if (value >= 255)
+		return 255;
+	return (unsigned char)(value + 0.5f);
+}
+
+
+// Bulk kernels. They use SSE2 when available and fall back to scalar
+// code otherwise. Views passed to the same call must have equal size.
+
+void premultiply_alpha(pixel_view<rgba8> pixels);
+
+void copy_pixels(pixel_view<rgba8> dst, pixel_view<const rgba8> src);
+void fill_pixels(pixel_view<rgba8> dst, rgba8 value);
+
+// dst = mix(dst, src, t) for all channels
+void blend_pixels(pixel_view<rgba8> dst, pixel_view<const rgba8> src, float t);
+
+// dst[channel] = mix(dst[channel], src[channel], weights)
+void blend_channel(pixel_view<rgba8> dst, pixel_view<const rgba8> src, int channel, pixel_view<const float> weights);
+
+// dst = src[channel]
+void extract_channel(pixel_view<unsigned char> dst, pixel_view<const rgba8> src, int channel);
+
+
+#endif
@@ -63,19 +63,17 @@ static bool almost_zero(float value)
 }
 
 
-const float* heightmap::intersect(ray r) const
+intersection heightmap::intersect(ray r) const
 {
-	static float result;
-
 	bounds1f height = bounds1f(-100, 1000); //min(m), max(m));
 	bounds2f bounds(0, 0, _size.x - 1, _size.y - 1);
 	bounds2f quad(-0.01f, -0.01f, 1.01f, 1.01f);
 
-	const float* d = ::intersect(r, bounds3f(bounds, height));
-	if (d == nullptr)
-		return nullptr;
+	intersection i = ::intersect(r, bounds3f(bounds, height));
+	if (!i.hit)
+		return intersection();
 
-	glm::vec3 p = r.point(*d);
+	glm::vec3 p = i.point;
 
 	bounds2f bounds_2(0, 0, _size.x - 2, _size.y - 2);
 
@@ -93,26 +91,20 @@ const float* heightmap::intersect(ray r) const
 		glm::vec3 v3 = glm::vec3(x, y + 1, get_height(x, y + 1));
 		glm::vec3 v4 = glm::vec3(x + 1, y + 1, get_height(x + 1, y + 1));
 
-		d = ::intersect(r, plane(v2, v4, v3));
-		if (d != nullptr)
+		i = ::intersect(r, plane(v2, v4, v3));
+		if (i.hit)
 		{
-			glm::vec2 rel = (r.point(*d) - v1).xy();
+			glm::vec2 rel = (i.point - v1).xy();
 			if (quad.contains(rel) && rel.x >= 1 - rel.y)
-			{
-				result = *d;
-				return &result;
-			}
+				return i;
 		}
 
-		d = ::intersect(r, plane(v1, v2, v3));
-		if (d != nullptr)
+		i = ::intersect(r, plane(v1, v2, v3));
+		if (i.hit)
 		{
-			glm::vec2 rel = (r.point(*d) - v1).xy();
+			glm::vec2 rel = (i.point - v1).xy();
 			if (quad.contains(rel) && rel.x <= 1 - rel.y)
-			{
-				result = *d;
-				return &result;
-			}
+				return i;
 		}
 
 		float xDist = almost_zero(r.direction.x) ? std::numeric_limits<float>::max() : (x - p.x + flipX) / r.direction.x;
@@ -130,5 +122,5 @@ const float* heightmap::intersect(ray r) const
 		}
 	}
 
-	return nullptr;
+	return intersection();
 }
@@ -23,7 +23,7 @@ public:
 	void set_height(int x, int y, float value);
 
 	float interpolate(glm::vec2 position) const;
-	const float* intersect(ray r) const;
+	intersection intersect(ray r) const;
 };
 
 
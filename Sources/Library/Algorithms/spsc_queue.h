@@ -0,0 +1,63 @@
+// Copyright (C) 2013 Felix Ungman
+//
+// This file is part of the openwar platform (GPL v3 or later), see LICENSE.txt
+
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+
+// Bounded queue between one producer thread and one consumer thread. Neither
+// side locks: push fails when the queue is full and pop when it is empty.
+// The capacity is rounded up to a power of two.
+
+template <class T> class spsc_queue
+{
+	std::vector<T> _items;
+	size_t _mask;
+	std::atomic<size_t> _head; // written by the consumer
+	std::atomic<size_t> _tail; // written by the producer
+
+public:
+	explicit spsc_queue(size_t capacity) : _items(), _mask(0), _head(0), _tail(0)
+	{
+		size_t size = 1;
+		while (size < capacity)
+			size *= 2;
+		_items.resize(size);
+		_mask = size - 1;
+	}
+
+	bool push(const T& item)
+	{
+		size_t tail = _tail.load(std::memory_order_relaxed);
+		if (tail - _head.load(std::memory_order_acquire) == _items.size())
+			return false;
+
+		_items[tail & _mask] = item;
+		_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(T& item)
+	{
+		size_t head = _head.load(std::memory_order_relaxed);
+		if (head == _tail.load(std::memory_order_acquire))
+			return false;
+
+		item = std::move(_items[head & _mask]);
+		_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	spsc_queue(const spsc_queue&);
+	spsc_queue& operator=(const spsc_queue&);
+};
+
+
+#endif
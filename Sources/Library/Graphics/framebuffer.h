@@ -63,6 +63,14 @@ public:
 		CHECK_ERROR_GL();
 	}
 
+	// For when the framebuffer bound before is known, so that it need not
+	// be queried.
+	bind_framebuffer(const framebuffer& fb, GLint previous) : _old(previous)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, fb.id);
+		CHECK_ERROR_GL();
+	}
+
 	~bind_framebuffer()
 	{
 		glBindFramebuffer(GL_FRAMEBUFFER, _old);
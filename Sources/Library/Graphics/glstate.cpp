@@ -0,0 +1,180 @@
+// Copyright (C) 2013 Felix Ungman
+//
+// This file is part of the openwar platform (GPL v3 or later), see LICENSE.txt
+
+#include "glstate.h"
+#include "vertexbuffer.h"
+#include "../profiler.h"
+
+
+
+glstate::glstate() :
+_issued(0),
+_skipped(0)
+{
+	invalidate();
+}
+
+
+glstate& glstate::shared()
+{
+	static glstate singleton;
+	return singleton;
+}
+
+
+void glstate::frame()
+{
+	profiler::shared().reset("gl.");
+	profiler::shared().add_count("gl.issued", _issued);
+	profiler::shared().add_count("gl.skipped", _skipped);
+
+	_issued = 0;
+	_skipped = 0;
+
+	invalidate();
+}
+
+
+void glstate::invalidate()
+{
+	_program = (GLuint)-1;
+	_blend = -1;
+	_blend_sfactor = (GLenum)-1;
+	_blend_dfactor = (GLenum)-1;
+	_active_texture = (GLenum)-1;
+	for (int i = 0; i < texture_units; ++i)
+		_textures[i] = (GLuint)-1;
+	_vertex_array = 0;
+	_vertex_array_known = false;
+}
+
+
+void glstate::use_program(GLuint program)
+{
+	bool issue = program != _program;
+	if (issue)
+	{
+		glUseProgram(program);
+		CHECK_ERROR_GL();
+		_program = program;
+	}
+	count(issue);
+}
+
+
+void glstate::enable_blend(bool value)
+{
+	bool issue = _blend != (value ? 1 : 0);
+	if (issue)
+	{
+		if (value)
+			glEnable(GL_BLEND);
+		else
+			glDisable(GL_BLEND);
+		CHECK_ERROR_GL();
+		_blend = value ? 1 : 0;
+	}
+	count(issue);
+}
+
+
+void glstate::blend_func(GLenum sfactor, GLenum dfactor)
+{
+	bool issue = sfactor != _blend_sfactor || dfactor != _blend_dfactor;
+	if (issue)
+	{
+		glBlendFunc(sfactor, dfactor);
+		CHECK_ERROR_GL();
+		_blend_sfactor = sfactor;
+		_blend_dfactor = dfactor;
+	}
+	count(issue);
+}
+
+
+// Binds to the active texture unit.
+
+void glstate::bind_texture(GLuint texture)
+{
+	int unit = _active_texture != (GLenum)-1 ? (int)(_active_texture - GL_TEXTURE0) : -1;
+	if (0 <= unit && unit < texture_units)
+	{
+		bool issue = _textures[unit] != texture;
+		if (issue)
+		{
+			glBindTexture(GL_TEXTURE_2D, texture);
+			CHECK_ERROR_GL();
+			_textures[unit] = texture;
+		}
+		count(issue);
+	}
+	else
+	{
+		glBindTexture(GL_TEXTURE_2D, texture);
+		CHECK_ERROR_GL();
+		count(true);
+	}
+}
+
+
+void glstate::bind_texture(int unit, GLuint texture)
+{
+	if (unit < 0 || unit >= texture_units)
+		return;
+
+	bool issue = _textures[unit] != texture;
+	if (issue)
+	{
+		active_texture(unit);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		CHECK_ERROR_GL();
+		_textures[unit] = texture;
+	}
+	count(issue);
+}
+
+
+// Deleting a texture unbinds it from every unit.
+
+void glstate::forget_texture(GLuint texture)
+{
+	for (int i = 0; i < texture_units; ++i)
+		if (_textures[i] == texture)
+			_textures[i] = 0;
+}
+
+
+void glstate::bind_vertex_array(GLuint vertex_array)
+{
+	bool issue = !_vertex_array_known || vertex_array != _vertex_array;
+	if (issue)
+	{
+		glBindVertexArrayOES(vertex_array);
+		CHECK_ERROR_GL();
+		_vertex_array = vertex_array;
+		_vertex_array_known = true;
+	}
+	count(issue);
+}
+
+
+void glstate::forget_vertex_array(GLuint vertex_array)
+{
+	if (_vertex_array == vertex_array)
+		_vertex_array = 0;
+}
+
+
+void glstate::active_texture(int unit)
+{
+	GLenum value = GL_TEXTURE0 + (GLenum)unit;
+	bool issue = value != _active_texture;
+	if (issue)
+	{
+		glActiveTexture(value);
+		CHECK_ERROR_GL();
+		_active_texture = value;
+	}
+	count(issue);
+}
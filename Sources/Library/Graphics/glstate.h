@@ -0,0 +1,78 @@
+// Copyright (C) 2013 Felix Ungman
+//
+// This file is part of the openwar platform (GPL v3 or later), see LICENSE.txt
+
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#ifdef OPENWAR_USE_XCODE_FRAMEWORKS
+#if TARGET_OS_IPHONE
+#include <OpenGLES/ES2/gl.h>
+#include <OpenGLES/ES2/glext.h>
+#else
+#include <OpenGL/gl.h>
+#endif
+#else
+#if OPENWAR_USE_GLEW
+#include <GL/glew.h>
+#endif
+#ifdef OPENWAR_USE_GLES2
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#else
+#include <GL/gl.h>
+#endif
+#endif
+
+
+// Shadow copy of the GL state that renderers change between draws, so
+// that calls which would not change anything can be skipped. Textures
+// must be bound through bind_texture, and deleted textures forgotten, for
+// the copy to stay valid. Everything is assumed unknown at the start of
+// each frame.
+
+class glstate
+{
+	static const int texture_units = 8;
+
+	GLuint _program;
+	int _blend; // -1 = unknown
+	GLenum _blend_sfactor;
+	GLenum _blend_dfactor;
+	GLenum _active_texture;
+	GLuint _textures[texture_units];
+	GLuint _vertex_array;
+	bool _vertex_array_known;
+
+	int _issued;
+	int _skipped;
+
+public:
+	glstate();
+
+	static glstate& shared();
+
+	// Reports the calls issued and skipped during the previous frame to
+	// the profiler, as "gl.issued" and "gl.skipped", and invalidates.
+	void frame();
+	void invalidate();
+
+	void use_program(GLuint program);
+	void enable_blend(bool value);
+	void blend_func(GLenum sfactor, GLenum dfactor);
+
+	void bind_texture(GLuint texture);
+	void bind_texture(int unit, GLuint texture);
+	void forget_texture(GLuint texture);
+
+	void bind_vertex_array(GLuint vertex_array);
+	void forget_vertex_array(GLuint vertex_array);
+
+	void count(bool issued) { if (issued) ++_issued; else ++_skipped; }
+
+private:
+	void active_texture(int unit);
+};
+
+
+#endif
@@ -0,0 +1,187 @@
+// Copyright (C) 2013 Felix Ungman
+//
+// This file is part of the openwar platform (GPL v3 or later), see LICENSE.txt
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "program_cache.h"
+
+
+#ifndef CHECK_ERROR_GL
+extern void CHECK_ERROR_GL();
+#endif
+
+
+static const char program_cache_magic[4] = { 'O', 'W', 'P', 'B' };
+static const uint32_t program_cache_version = 1;
+
+
+struct program_cache_header
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t format;
+	uint32_t length;
+};
+
+
+std::string program_cache::_directory;
+
+
+void program_cache::init(const char* directory)
+{
+	_directory.assign(directory != nullptr ? directory : "");
+	if (!_directory.empty() && _directory[_directory.size() - 1] != '/')
+		_directory += '/';
+}
+
+
+// Program binaries are core in OpenGL 4.1 and OpenGL ES 3.0. Of the
+// configurations built here, only GLEW exposes them.
+
+bool program_cache::is_enabled()
+{
+	if (_directory.empty())
+		return false;
+
+#if OPENWAR_USE_GLEW
+	static int supported = -1;
+	if (supported == -1)
+	{
+		GLint formats = 0;
+		if (GLEW_ARB_get_program_binary)
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		supported = formats > 0 ? 1 : 0;
+	}
+	return supported == 1;
+#else
+	return false;
+#endif
+}
+
+
+// 64-bit FNV-1a
+
+uint64_t program_cache::hash(uint64_t h, const char* s)
+{
+	if (s != nullptr)
+		for (const unsigned char* p = (const unsigned char*)s; *p != 0; ++p)
+			h = (h ^ *p) * 1099511628211ull;
+
+	// the terminator separates consecutive strings
+	return h * 1099511628211ull;
+}
+
+
+uint64_t program_cache::driver_key()
+{
+	static uint64_t result = 0;
+	if (result == 0)
+	{
+		result = 14695981039346656037ull;
+		result = hash(result, (const char*)glGetString(GL_VENDOR));
+		result = hash(result, (const char*)glGetString(GL_RENDERER));
+		result = hash(result, (const char*)glGetString(GL_VERSION));
+	}
+	return result;
+}
+
+
+void program_cache::prepare(GLuint program)
+{
+#if OPENWAR_USE_GLEW
+	glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	CHECK_ERROR_GL();
+#endif
+}
+
+
+bool program_cache::load(GLuint program, uint64_t key)
+{
+#if OPENWAR_USE_GLEW
+	FILE* file = std::fopen(path(key).c_str(), "rb");
+	if (file == nullptr)
+		return false;
+
+	program_cache_header header;
+	std::vector<char> binary;
+	bool ok = std::fread(&header, sizeof(header), 1, file) == 1
+		&& std::memcmp(header.magic, program_cache_magic, 4) == 0
+		&& header.version == program_cache_version
+		&& header.length != 0;
+	if (ok)
+	{
+		binary.resize(header.length);
+		ok = std::fread(binary.data(), binary.size(), 1, file) == 1;
+	}
+	std::fclose(file);
+
+	if (!ok)
+		return false;
+
+	glProgramBinary(program, (GLenum)header.format, binary.data(), (GLsizei)binary.size());
+
+	GLint status = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (status != 0)
+		return true;
+
+	// a rejected binary may leave GL_INVALID_ENUM, which would otherwise be
+	// reported by the first check after the program is compiled from source
+	while (glGetError() != GL_NO_ERROR)
+		;
+	return false;
+#else
+	return false;
+#endif
+}
+
+
+// Written to a temporary file first, so that a program is never loaded
+// from a partly written one.
+
+void program_cache::store(GLuint program, uint64_t key)
+{
+#if OPENWAR_USE_GLEW
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	CHECK_ERROR_GL();
+	if (length <= 0)
+		return;
+
+	std::vector<char> binary((size_t)length);
+	GLenum format = 0;
+	glGetProgramBinary(program, length, &length, &format, binary.data());
+	CHECK_ERROR_GL();
+
+	program_cache_header header;
+	std::memcpy(header.magic, program_cache_magic, 4);
+	header.version = program_cache_version;
+	header.format = (uint32_t)format;
+	header.length = (uint32_t)length;
+
+	std::string target = path(key);
+	std::string temporary = target + ".tmp";
+
+	FILE* file = std::fopen(temporary.c_str(), "wb");
+	if (file == nullptr)
+		return;
+
+	bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1
+		&& std::fwrite(binary.data(), (size_t)length, 1, file) == 1;
+	ok = std::fclose(file) == 0 && ok;
+
+	if (!ok || std::rename(temporary.c_str(), target.c_str()) != 0)
+		std::remove(temporary.c_str());
+#endif
+}
+
+
+std::string program_cache::path(uint64_t key)
+{
+	char name[32];
+	std::snprintf(name, sizeof(name), "%016llx.program", (unsigned long long)key);
+	return _directory + name;
+}
@@ -0,0 +1,61 @@
+// Copyright (C) 2013 Felix Ungman
+//
+// This file is part of the openwar platform (GPL v3 or later), see LICENSE.txt
+
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#ifdef OPENWAR_USE_XCODE_FRAMEWORKS
+#if TARGET_OS_IPHONE
+#include <OpenGLES/ES2/gl.h>
+#else
+#include <OpenGL/gl.h>
+#endif
+#else
+#if OPENWAR_USE_GLEW
+#include <GL/glew.h>
+#endif
+#ifdef OPENWAR_USE_GLES2
+#include <GLES2/gl2.h>
+#else
+#include <GL/gl.h>
+#endif
+#endif
+
+#include <cstdint>
+#include <string>
+
+
+// Linked programs kept on disk between runs, so that shaders are compiled
+// once per driver rather than at every start. Programs are stored as given
+// by glGetProgramBinary, one file per key, where the key is a hash of the
+// sources, the attribute bindings and the driver strings. A driver may
+// still reject a binary, e.g. after an update that kept its strings, and
+// the program is then compiled from source and stored again. The cache is
+// off until init is given a directory, and where the driver has no program
+// binary formats.
+
+class program_cache
+{
+	static std::string _directory;
+
+public:
+	static void init(const char* directory);
+
+	static bool is_enabled();
+
+	static uint64_t hash(uint64_t h, const char* s);
+	static uint64_t driver_key();
+
+	// Marks a program as one to be stored. Call before linking.
+	static void prepare(GLuint program);
+
+	static bool load(GLuint program, uint64_t key);
+	static void store(GLuint program, uint64_t key);
+
+private:
+	static std::string path(uint64_t key);
+};
+
+
+#endif
@@ -8,7 +8,9 @@
 #endif
 #endif
 
+#include <cstring>
 #include "renderer.h"
+#include "program_cache.h"
 
 
 #ifndef CHECK_ERROR_GL
@@ -104,10 +106,58 @@ renderer_specification operator,(renderer_specification x, renderer_fragment_sha
 
 
 
+static size_t get_shader_uniform_size(shader_uniform_type type)
+{
+	switch (type)
+	{
+		case shader_uniform_type_int: return sizeof(GLint);
+		case shader_uniform_type_float: return sizeof(GLfloat);
+		case shader_uniform_type_vector2: return sizeof(glm::vec2);
+		case shader_uniform_type_vector3: return sizeof(glm::vec3);
+		case shader_uniform_type_vector4: return sizeof(glm::vec4);
+		case shader_uniform_type_matrix2: return sizeof(glm::mat2x2);
+		case shader_uniform_type_matrix3: return sizeof(glm::mat3x3);
+		case shader_uniform_type_matrix4: return sizeof(glm::mat4x4);
+		default: return 0;
+	}
+}
+
+
 void renderer_shader_uniform::set_value(const void* uniforms)
 {
 	const void* v = (const char*)uniforms + _offset;
 
+	// the sampler is fixed, only the texture binding changes
+	if (_type == shader_uniform_type_texture)
+	{
+		const texture* t = *(const texture* const*)v;
+		if (t != nullptr)
+			glstate::shared().bind_texture((int)_texture, t->id);
+
+		glstate::shared().count(!_cached);
+		if (!_cached)
+		{
+			glUniform1i(_location, _texture);
+			CHECK_ERROR_GL();
+			_cached = true;
+		}
+		return;
+	}
+
+	size_t size = get_shader_uniform_size(_type) * _count;
+	if (size <= sizeof(_cache))
+	{
+		if (_cached && std::memcmp(_cache, v, size) == 0)
+		{
+			glstate::shared().count(false);
+			return;
+		}
+
+		std::memcpy(_cache, v, size);
+		_cached = true;
+	}
+	glstate::shared().count(true);
+
 	switch (_type)
 	{
 		case shader_uniform_type_int:
@@ -131,7 +181,7 @@ void renderer_shader_uniform::set_value(const void* uniforms)
 	        break;
 
 		case shader_uniform_type_vector4:
-	        glUniform4fv(_location, 1, (const GLfloat*)v);
+	        glUniform4fv(_location, _count, (const GLfloat*)v);
 	        CHECK_ERROR_GL();
 	        break;
 
@@ -150,19 +200,6 @@ void renderer_shader_uniform::set_value(const void* uniforms)
 	        CHECK_ERROR_GL();
 	        break;
 
-		case shader_uniform_type_texture: {
-			texture**t = (texture**)v;
-	        glActiveTexture(GL_TEXTURE0 + _texture);
-			CHECK_ERROR_GL();
-			if (*t != nullptr)
-			{
-                glBindTexture(GL_TEXTURE_2D, (*t)->id);
-				CHECK_ERROR_GL();
-			}
-            glUniform1i(_location, _texture);
-			CHECK_ERROR_GL();
-			break;
-		}
 		default:
 			break;
 	}
@@ -182,46 +219,83 @@ static const GLchar* decode_name(const GLchar* name)
 renderer_base::renderer_base(const renderer_specification& specification) :
 	_vertex_attributes(specification._vertex_attributes),
 	_shader_uniforms(specification._shader_uniforms),
+	_vertex_shader(specification._vertex_shader),
+	_fragment_shader(specification._fragment_shader),
+	_compiled(false),
+	_program(0),
 	_blend_sfactor(GL_ONE),
 	_blend_dfactor(GL_ZERO)
 {
-	_program = glCreateProgram();
-	CHECK_ERROR_GL();
+}
 
-	GLuint vertex_shader = compile_shader(GL_VERTEX_SHADER, specification._vertex_shader);
-	GLuint fragment_shader = compile_shader(GL_FRAGMENT_SHADER, specification._fragment_shader);
 
-    glAttachShader(_program, vertex_shader);
-	CHECK_ERROR_GL();
-    glAttachShader(_program, fragment_shader);
+// The attribute bindings are part of a cached program, so their names, in
+// order of location, are part of its key.
+
+void renderer_base::compile()
+{
+	if (_compiled)
+		return;
+
+	_compiled = true;
+
+	_program = glCreateProgram();
 	CHECK_ERROR_GL();
 
-	for (GLuint index = 0; index < _vertex_attributes.size(); ++index)
+	bool cached = program_cache::is_enabled();
+	uint64_t key = 0;
+	if (cached)
 	{
-		const GLchar* name = decode_name(_vertex_attributes[index]._name);
-		glBindAttribLocation(_program, index, name);
-		CHECK_ERROR_GL();
+		key = program_cache::driver_key();
+		key = program_cache::hash(key, _vertex_shader);
+		key = program_cache::hash(key, _fragment_shader);
+		for (const renderer_vertex_attribute& attribute : _vertex_attributes)
+			key = program_cache::hash(key, decode_name(attribute._name));
 	}
 
-    if (!link_program(_program)) {
-        if (_program) {
-            glDeleteProgram(_program);
-	        CHECK_ERROR_GL();
-	        _program = 0;
-        }
-        return;
-    }
-	validate_program(_program);
+	if (!cached || !program_cache::load(_program, key))
+	{
+		GLuint vertex_shader = compile_shader(GL_VERTEX_SHADER, _vertex_shader);
+		GLuint fragment_shader = compile_shader(GL_FRAGMENT_SHADER, _fragment_shader);
 
-	glDetachShader(_program, vertex_shader);
-	CHECK_ERROR_GL();
-	glDetachShader(_program, fragment_shader);
-	CHECK_ERROR_GL();
+		glAttachShader(_program, vertex_shader);
+		CHECK_ERROR_GL();
+		glAttachShader(_program, fragment_shader);
+		CHECK_ERROR_GL();
 
-	glDeleteShader(vertex_shader);
-	CHECK_ERROR_GL();
-	glDeleteShader(fragment_shader);
-	CHECK_ERROR_GL();
+		for (GLuint index = 0; index < _vertex_attributes.size(); ++index)
+		{
+			const GLchar* name = decode_name(_vertex_attributes[index]._name);
+			glBindAttribLocation(_program, index, name);
+			CHECK_ERROR_GL();
+		}
+
+		if (cached)
+			program_cache::prepare(_program);
+
+		if (!link_program(_program)) {
+			if (_program) {
+				glDeleteProgram(_program);
+				CHECK_ERROR_GL();
+				_program = 0;
+			}
+			return;
+		}
+		validate_program(_program);
+
+		glDetachShader(_program, vertex_shader);
+		CHECK_ERROR_GL();
+		glDetachShader(_program, fragment_shader);
+		CHECK_ERROR_GL();
+
+		glDeleteShader(vertex_shader);
+		CHECK_ERROR_GL();
+		glDeleteShader(fragment_shader);
+		CHECK_ERROR_GL();
+
+		if (cached)
+			program_cache::store(_program, key);
+	}
 
 	GLenum texture = 0;
 	for (int i = 0; i < (int)_shader_uniforms.size(); ++i)
@@ -5,6 +5,8 @@
 #ifndef RENDERER_H
 #define RENDERER_H
 
+#include <glm/gtc/type_precision.hpp>
+#include "glstate.h"
 #include "vertexbuffer.h"
 #include "uniforms.h"
 
@@ -25,6 +27,15 @@ inline GLenum get_vertex_attribute_type(glm::vec3*) { return GL_FLOAT; }
 inline GLint get_vertex_attribute_size(glm::vec4*) { return 4; }
 inline GLenum get_vertex_attribute_type(glm::vec4*) { return GL_FLOAT; }
 
+inline GLint get_vertex_attribute_size(GLushort*) { return 1; }
+inline GLenum get_vertex_attribute_type(GLushort*) { return GL_UNSIGNED_SHORT; }
+
+inline GLint get_vertex_attribute_size(glm::u16vec2*) { return 2; }
+inline GLenum get_vertex_attribute_type(glm::u16vec2*) { return GL_UNSIGNED_SHORT; }
+
+inline GLint get_vertex_attribute_size(glm::i8vec2*) { return 2; }
+inline GLenum get_vertex_attribute_type(glm::i8vec2*) { return GL_BYTE; }
+
 
 struct renderer_vertex_attribute
 {
@@ -33,24 +44,32 @@ struct renderer_vertex_attribute
 	GLenum _type;
 	GLsizei _stride;
 	GLintptr _offset;
+	GLboolean _normalized;
 
-	renderer_vertex_attribute(const GLchar* name, GLint size, GLenum type, GLsizei stride, GLintptr offset)
-		: _name(name), _size(size), _type(type), _stride(stride), _offset(offset)
+	renderer_vertex_attribute(const GLchar* name, GLint size, GLenum type, GLsizei stride, GLintptr offset, GLboolean normalized = GL_FALSE)
+		: _name(name), _size(size), _type(type), _stride(stride), _offset(offset), _normalized(normalized)
 	{
 	}
 };
 
 
+// Uniform values belong to the program, so the last value set is cached
+// here and setting the same value again is skipped. Arrays larger than
+// the cache are always set.
+
 struct renderer_shader_uniform
 {
 	GLint _location;
 	const GLchar* _name;
 	shader_uniform_type _type;
 	int _offset;
+	GLsizei _count;
 	GLenum _texture;
+	bool _cached;
+	char _cache[sizeof(glm::mat4x4)];
 
-	renderer_shader_uniform(const GLchar* name, shader_uniform_type type, int offset)
-		: _location(0), _name(name), _type(type), _offset(offset)
+	renderer_shader_uniform(const GLchar* name, shader_uniform_type type, int offset, GLsizei count = 1)
+		: _location(0), _name(name), _type(type), _offset(offset), _count(count), _cached(false)
 	{
 		_texture = 0;
 	}
@@ -107,14 +126,25 @@ renderer_specification operator,(renderer_specification x, renderer_fragment_sha
 		VERTEX_ATTRIBUTE_STRIDE(_Vertex, _Name), \
 		VERTEX_ATTRIBUTE_OFFSET(_Vertex, _Name))
 
+// integer attributes mapped to [0, 1] or [-1, 1] in the shader
+#define NORMALIZED_VERTEX_ATTRIBUTE(_Vertex, _Name) \
+	renderer_vertex_attribute(#_Name, \
+		VERTEX_ATTRIBUTE_SIZE(_Vertex, _Name), \
+		VERTEX_ATTRIBUTE_TYPE(_Vertex, _Name), \
+		VERTEX_ATTRIBUTE_STRIDE(_Vertex, _Name), \
+		VERTEX_ATTRIBUTE_OFFSET(_Vertex, _Name), \
+		GL_TRUE)
+
 #define SHADER_UNIFORM_TYPE(_Uniforms, _Name) get_shader_uniform_type(MEMBER_POINTER(_Uniforms, _Name))
 #define SHADER_UNIFORM_OFFSET(_Uniforms, _Name) (const char*)&((_Uniforms*)nullptr)->_Name - (const char*)nullptr
+#define SHADER_UNIFORM_COUNT(_Uniforms, _Name) get_shader_uniform_count(MEMBER_POINTER(_Uniforms, _Name))
 
 
 #define SHADER_UNIFORM(_Uniforms, _Name) \
 	renderer_shader_uniform(#_Name, \
 		SHADER_UNIFORM_TYPE(_Uniforms, _Name), \
-		SHADER_UNIFORM_OFFSET(_Uniforms, _Name))
+		SHADER_UNIFORM_OFFSET(_Uniforms, _Name), \
+		SHADER_UNIFORM_COUNT(_Uniforms, _Name))
 
 
 #define VERTEX_SHADER(source) renderer_vertex_shader(#source)
@@ -122,11 +152,19 @@ renderer_specification operator,(renderer_specification x, renderer_fragment_sha
 
 
 
+// The program is compiled on first use, or loaded from the program cache,
+// so that renderers that are created but not yet drawn with cost nothing.
+// Renderers that are drawn with every frame call compile when loaded
+// instead, so that the first frame does not wait for the compiler.
+
 class renderer_base
 {
 public:
 	std::vector<renderer_vertex_attribute> _vertex_attributes;
 	std::vector<renderer_shader_uniform> _shader_uniforms;
+	const char* _vertex_shader;
+	const char* _fragment_shader;
+	bool _compiled;
 	GLuint _program;
 	GLenum _blend_sfactor;
 	GLenum _blend_dfactor;
@@ -134,6 +172,8 @@ public:
 	renderer_base(const renderer_specification& specification);
 	virtual ~renderer_base();
 
+	void compile(); // does nothing if already compiled
+
 	static float pixels_per_point();
 
 	static GLuint compile_shader(GLenum type, const char* source);
@@ -160,8 +200,20 @@ public:
 		if (shape._vertices.empty())
 			return;
 
-		glUseProgram(_program);
-		CHECK_ERROR_GL();
+		render(shape, uniforms, 0, shape.count());
+	}
+
+	// Draws count vertices, or indices if the shape is indexed, starting at first.
+	void render(vertexbuffer<vertex_type>& shape, const uniforms_type& uniforms, GLint first, GLsizei count)
+	{
+		if (count <= 0)
+			return;
+
+		if (!_compiled)
+			compile();
+
+		glstate& state = glstate::shared();
+		state.use_program(_program);
 
 		shape.bind(_vertex_attributes);
 
@@ -170,25 +222,25 @@ public:
 			_shader_uniforms[i].set_value(&uniforms);
 		}
 
+		// Blending is left as is after the draw, and non-blending
+		// renderers disable it, which renders as with GL_ONE, GL_ZERO.
 		if (_blend_sfactor != GL_ONE || _blend_dfactor != GL_ZERO)
 		{
-			glEnable(GL_BLEND);
-			CHECK_ERROR_GL();
-			glBlendFunc(_blend_sfactor, _blend_dfactor);
-			CHECK_ERROR_GL();
+			state.enable_blend(true);
+			state.blend_func(_blend_sfactor, _blend_dfactor);
 		}
-
-		glDrawArrays(shape._mode, 0, shape.count());
-		CHECK_ERROR_GL();
-
-		if (_blend_sfactor != GL_ONE || _blend_dfactor != GL_ZERO)
+		else
 		{
-			glDisable(GL_BLEND);
-			CHECK_ERROR_GL();
-			glBlendFunc(GL_ONE, GL_ZERO);
-			CHECK_ERROR_GL();
+			state.enable_blend(false);
 		}
 
+		if (shape.indexed())
+			glDrawElements(shape._mode, count, GL_UNSIGNED_SHORT, static_cast<const GLushort*>(shape.index_data()) + first);
+		else
+			glDrawArrays(shape._mode, shape._first + first, count);
+		CHECK_ERROR_GL();
+		state.count(true);
+
 		shape.unbind(_vertex_attributes);
 	}
 
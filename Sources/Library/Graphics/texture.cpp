@@ -45,6 +45,7 @@ texture::texture(const image& image)
 
 texture::~texture()
 {
+	glstate::shared().forget_texture(id);
 	glDeleteTextures(1, &id);
 	CHECK_ERROR_GL();
 }
@@ -52,8 +53,7 @@ texture::~texture()
 
 void texture::init()
 {
-	glBindTexture(GL_TEXTURE_2D, id);
-	CHECK_ERROR_GL();
+	glstate::shared().bind_texture(id);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	CHECK_ERROR_GL();
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -101,8 +101,7 @@ void texture::load(const resource& r)
 			NSData* pvrtc = [NSData dataWithContentsOfFile:path];
 			if (pvrtc != nil)
 			{
-				glBindTexture(GL_TEXTURE_2D, id);
-				CHECK_ERROR_GL();
+				glstate::shared().bind_texture(id);
 				glCompressedTexImage2D(GL_TEXTURE_2D, 0, GL_COMPRESSED_RGB_PVRTC_4BPPV1_IMG, 1024, 1024, 0, pvrtc.length, pvrtc.bytes);
 				CHECK_ERROR_GL();
 				return;
@@ -149,8 +148,7 @@ void texture::load(const resource& r)
 
 void texture::load(const image& image)
 {
-	glBindTexture(GL_TEXTURE_2D, id);
-	CHECK_ERROR_GL();
+	glstate::shared().bind_texture(id);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image.width(), image.height(), 0, image.format(), GL_UNSIGNED_BYTE, image.pixels());
 	CHECK_ERROR_GL();
 	glGenerateMipmap(GL_TEXTURE_2D);
@@ -31,6 +31,12 @@ inline shader_uniform_type get_shader_uniform_type(glm::mat3x3*) { return shader
 inline shader_uniform_type get_shader_uniform_type(glm::mat4x4*) { return shader_uniform_type_matrix4; }
 inline shader_uniform_type get_shader_uniform_type(const texture**) { return shader_uniform_type_texture; }
 
+// arrays of vectors are set in one call
+template <int N> inline shader_uniform_type get_shader_uniform_type(glm::vec4 (*)[N]) { return shader_uniform_type_vector4; }
+
+template <class T> inline GLsizei get_shader_uniform_count(T*) { return 1; }
+template <int N> inline GLsizei get_shader_uniform_count(glm::vec4 (*)[N]) { return N; }
+
 
 struct plain_uniforms
 {
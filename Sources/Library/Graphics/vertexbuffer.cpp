@@ -2,16 +2,249 @@
 //
 // This file is part of the openwar platform (GPL v3 or later), see LICENSE.txt
 
+#include <cstring>
+
 #include "vertexbuffer.h"
 #include "renderer.h"
 
 
 
+vertexstream::vertexstream(GLsizeiptr capacity) :
+_vbo(0),
+_capacity(capacity),
+_offset(0),
+_frameBegin(0),
+_wrapped(false),
+_unsynchronized(false)
+{
+#if OPENWAR_USE_GLEW
+	_unsynchronized = (GLEW_VERSION_3_0 || GLEW_ARB_map_buffer_range) && (GLEW_VERSION_3_2 || GLEW_ARB_sync);
+#endif
+	create();
+}
+
+
+vertexstream::~vertexstream()
+{
+#if OPENWAR_USE_GLEW
+	for (const fenced_region& fence : _fences)
+		glDeleteSync(fence.sync);
+#endif
+	for (GLuint vbo : _retired)
+		glDeleteBuffers(1, &vbo);
+	if (_vbo != 0)
+	{
+		glDeleteBuffers(1, &_vbo);
+		CHECK_ERROR_GL();
+	}
+}
+
+
+vertexstream* vertexstream::shared()
+{
+	static vertexstream* result = nullptr;
+	if (result == nullptr)
+		result = new vertexstream(4 << 20);
+	return result;
+}
+
+
+void vertexstream::frame()
+{
+	for (GLuint vbo : _retired)
+		glDeleteBuffers(1, &vbo);
+	_retired.clear();
+
+#if OPENWAR_USE_GLEW
+	if (_unsynchronized)
+	{
+		if (_offset != _frameBegin || _wrapped)
+		{
+			fenced_region fence;
+			fence.sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			fence.begin = _frameBegin;
+			fence.end = _offset;
+			fence.wrapped = _wrapped;
+			_fences.push_back(fence);
+		}
+
+		// fences are signaled in order, so the finished ones are at the front
+		while (!_fences.empty() && glClientWaitSync(_fences.front().sync, 0, 0) != GL_TIMEOUT_EXPIRED)
+		{
+			glDeleteSync(_fences.front().sync);
+			_fences.pop_front();
+		}
+
+		_frameBegin = _offset;
+		_wrapped = false;
+		return;
+	}
+#endif
+
+	GLsizeiptr used = _offset - _frameBegin;
+	if (_offset + used > _capacity)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, _vbo);
+		CHECK_ERROR_GL();
+		glBufferData(GL_ARRAY_BUFFER, _capacity, nullptr, GL_STREAM_DRAW);
+		CHECK_ERROR_GL();
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		CHECK_ERROR_GL();
+		_offset = 0;
+	}
+
+	_frameBegin = _offset;
+	_wrapped = false;
+}
+
+
+// Data of the current frame is never overwritten: the ring only wraps to
+// the start when the frame began past the end of the new data.
+
+GLintptr vertexstream::append(const void* data, GLsizeiptr size, GLsizei stride)
+{
+	GLintptr offset = (_offset + stride - 1) / stride * stride;
+
+	if (offset + size > (_wrapped ? _frameBegin : _capacity))
+	{
+		if (_unsynchronized && !_wrapped && size <= _frameBegin)
+		{
+			offset = 0;
+			_wrapped = true;
+		}
+		else
+		{
+			replace(size);
+			offset = 0;
+		}
+	}
+
+	write(offset, data, size);
+
+	_offset = offset + size;
+	return offset;
+}
+
+
+void vertexstream::create()
+{
+	glGenBuffers(1, &_vbo);
+	CHECK_ERROR_GL();
+	glBindBuffer(GL_ARRAY_BUFFER, _vbo);
+	CHECK_ERROR_GL();
+	glBufferData(GL_ARRAY_BUFFER, _capacity, nullptr, GL_STREAM_DRAW);
+	CHECK_ERROR_GL();
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	CHECK_ERROR_GL();
+}
+
+
+// Shapes streamed earlier in the frame still refer to the old buffer and
+// may not have been drawn yet, so it is kept until the frame has ended and
+// the data continues in fresh storage of the same size. Only an allocation
+// larger than the whole buffer grows it, and never past max_capacity unless
+// that single allocation needs more.
+
+void vertexstream::replace(GLsizeiptr size)
+{
+	_retired.push_back(_vbo);
+
+	if (size > _capacity)
+	{
+		while (_capacity < size && _capacity < max_capacity)
+			_capacity *= 2;
+		if (_capacity > max_capacity)
+			_capacity = max_capacity;
+		if (_capacity < size)
+			_capacity = size;
+	}
+
+	create();
+
+#if OPENWAR_USE_GLEW
+	for (const fenced_region& fence : _fences)
+		glDeleteSync(fence.sync);
+	_fences.clear();
+#endif
+
+	_offset = 0;
+	_frameBegin = 0;
+	_wrapped = false;
+}
+
+
+void vertexstream::write(GLintptr offset, const void* data, GLsizeiptr size)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, _vbo);
+	CHECK_ERROR_GL();
+
+	bool written = false;
+#if OPENWAR_USE_GLEW
+	if (_unsynchronized)
+	{
+		wait(offset, offset + size);
+		void* p = glMapBufferRange(GL_ARRAY_BUFFER, offset, size, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+		CHECK_ERROR_GL();
+		if (p != nullptr)
+		{
+			std::memcpy(p, data, (size_t)size);
+			written = glUnmapBuffer(GL_ARRAY_BUFFER) == GL_TRUE;
+			CHECK_ERROR_GL();
+		}
+	}
+#endif
+
+	if (!written)
+	{
+		glBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
+		CHECK_ERROR_GL();
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	CHECK_ERROR_GL();
+}
+
+
+// Waits for the GPU to finish the frames whose regions overlap the range.
+// Waiting for one fence means the older ones have been signaled too.
+
+void vertexstream::wait(GLintptr begin, GLintptr end)
+{
+#if OPENWAR_USE_GLEW
+	size_t last = _fences.size();
+	for (size_t i = 0; i < _fences.size(); ++i)
+	{
+		const fenced_region& fence = _fences[i];
+		bool overlaps = fence.wrapped
+			? begin < fence.end || end > fence.begin
+			: begin < fence.end && end > fence.begin;
+		if (overlaps)
+			last = i;
+	}
+	if (last == _fences.size())
+		return;
+
+	while (glClientWaitSync(_fences[last].sync, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+		;
+
+	for (size_t i = 0; i <= last; ++i)
+		glDeleteSync(_fences[i].sync);
+	_fences.erase(_fences.begin(), _fences.begin() + last + 1);
+#endif
+}
+
+
+
 vertexbuffer_base::vertexbuffer_base() :
 _mode(0),
 _vbo(0),
 _vao(0),
-_count(0)
+_ibo(0),
+_count(0),
+_index_count(0),
+_first(0),
+_stream(false),
+_stream_vbo(0)
 {
 }
 
@@ -21,45 +254,83 @@ _count(0)
 
 vertexbuffer_base::~vertexbuffer_base()
 {
-	if (_vao != 0)
+	reset_vertex_array();
+	if (_vbo != 0)
 	{
-		glDeleteVertexArraysOES(1, &_vao);
+		glDeleteBuffers(1, &_vbo);
 		CHECK_ERROR_GL();
 	}
-	if (_vbo != 0)
+	if (_ibo != 0)
 	{
-		glDeleteBuffers(1, &_vbo);
+		glDeleteBuffers(1, &_ibo);
 		CHECK_ERROR_GL();
 	}
 }
 
 
 
-void vertexbuffer_base::_bind(const std::vector<renderer_vertex_attribute>& vertex_attributes, const void* data)
+// The vertex array object captures the array buffer, so it is recreated
+// when the shape moves between its own buffer and the stream.
+
+void vertexbuffer_base::use_stream(bool value)
 {
-	bool setup = _vao == 0;
+	if (_stream != value)
+		reset_vertex_array();
+	_stream = value;
+}
 
-	if (_vbo != 0)
+
+void vertexbuffer_base::use_stream_buffer(GLuint value)
+{
+	if (_stream_vbo != value)
+		reset_vertex_array();
+	_stream_vbo = value;
+}
+
+
+void vertexbuffer_base::reset_vertex_array()
+{
+	if (_vao != 0)
 	{
-		glBindBuffer(GL_ARRAY_BUFFER, _vbo);
+		glstate::shared().forget_vertex_array(_vao);
+		glDeleteVertexArraysOES(1, &_vao);
 		CHECK_ERROR_GL();
-
-		if (_vao == 0)
-		{
-			glGenVertexArraysOES(1, &_vao);
-			CHECK_ERROR_GL();
-		}
+		_vao = 0;
 	}
+}
 
-	if (_vao != 0)
+
+// The attribute pointers and the element buffer are recorded in the vertex
+// array object when it is created, after that binding it is enough.
+
+void vertexbuffer_base::_bind(const std::vector<renderer_vertex_attribute>& vertex_attributes, const void* data)
+{
+	bool setup = _vao == 0;
+	GLuint vbo = array_buffer();
+
+	if (vbo != 0 && _vao == 0)
 	{
-		glBindVertexArrayOES(_vao);
+		glGenVertexArraysOES(1, &_vao);
 		CHECK_ERROR_GL();
 	}
 
+	glstate::shared().bind_vertex_array(_vao);
+
 	if (setup)
 	{
-		const char* ptr = _vbo != 0 ? nullptr : reinterpret_cast<const char*>(data);
+		if (vbo != 0)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, vbo);
+			CHECK_ERROR_GL();
+		}
+
+		if (_ibo != 0)
+		{
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ibo);
+			CHECK_ERROR_GL();
+		}
+
+		const char* ptr = vbo != 0 ? nullptr : reinterpret_cast<const char*>(data);
 		for (GLuint index = 0; index < vertex_attributes.size(); ++index)
 		{
 			glEnableVertexAttribArray(index);
@@ -68,7 +339,13 @@ void vertexbuffer_base::_bind(const std::vector<renderer_vertex_attribute>& vert
 			const renderer_vertex_attribute& item = vertex_attributes[index];
 			const GLvoid* offset = reinterpret_cast<const GLvoid*>(ptr + item._offset);
 
-			glVertexAttribPointer(index, item._size, item._type, GL_FALSE, item._stride, offset);
+			glVertexAttribPointer(index, item._size, item._type, item._normalized, item._stride, offset);
+			CHECK_ERROR_GL();
+		}
+
+		if (vbo != 0)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
 			CHECK_ERROR_GL();
 		}
 	}
@@ -76,25 +353,22 @@ void vertexbuffer_base::_bind(const std::vector<renderer_vertex_attribute>& vert
 
 
 
+// A vertex array object is left bound, the next shape binds its own.
+
 void vertexbuffer_base::unbind(const std::vector<renderer_vertex_attribute>& vertex_attributes)
 {
 	if (_vao != 0)
+		return;
+
+	for (GLuint index = 0; index < vertex_attributes.size(); ++index)
 	{
-		glBindVertexArrayOES(0);
+		glDisableVertexAttribArray(index);
 		CHECK_ERROR_GL();
 	}
-	else
-	{
-		for (GLuint index = 0; index < vertex_attributes.size(); ++index)
-		{
-			glDisableVertexAttribArray(index);
-			CHECK_ERROR_GL();
-		}
-	}
 
-	if (_vbo)
+	if (_ibo != 0)
 	{
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 		CHECK_ERROR_GL();
 	}
 }
@@ -5,6 +5,7 @@
 #ifndef VERTEXBUFFER_H
 #define VERTEXBUFFER_H
 
+#include <deque>
 #include <vector>
 
 #ifdef OPENWAR_USE_XCODE_FRAMEWORKS
@@ -28,6 +29,7 @@
 
 #include "../Algebra/bounds.h"
 #include "vertex.h"
+#include "glstate.h"
 
 #ifndef CHECK_ERROR_GL
 extern void CHECK_ERROR_GL();
@@ -37,17 +39,90 @@ extern void CHECK_ERROR_GL();
 struct renderer_vertex_attribute;
 
 
+// One large GL buffer that geometry rebuilt every frame is appended to,
+// instead of each shape reallocating its own buffer or drawing from client
+// memory. Data appended during a frame stays in place until the frame has
+// ended, since shapes are often streamed before any of them are drawn.
+//
+// Where the driver has unsynchronized buffer mapping and fences, the buffer
+// is used as a ring: each frame's region is fenced when the frame ends, and
+// an append only waits for the fences of the regions it overwrites.
+// Otherwise the storage is orphaned at the start of a frame that might not
+// fit in the rest of it, so the driver can hand out fresh memory rather
+// than wait for draws still reading the old contents. Data that does not
+// fit in the rest of the buffer moves to a new buffer of the same size,
+// which is only larger when a single append needs it, and the old one is
+// deleted when the frame has ended.
+
+class vertexstream
+{
+	static const GLsizeiptr max_capacity = 64 << 20;
+
+#if OPENWAR_USE_GLEW
+	struct fenced_region
+	{
+		GLsync sync;
+		GLintptr begin;
+		GLintptr end;
+		bool wrapped; // covers [begin, capacity) and [0, end)
+	};
+	std::deque<fenced_region> _fences;
+#endif
+
+	GLuint _vbo;
+	GLsizeiptr _capacity;
+	GLintptr _offset;
+	GLintptr _frameBegin;
+	bool _wrapped;
+	bool _unsynchronized;
+	std::vector<GLuint> _retired;
+
+public:
+	explicit vertexstream(GLsizeiptr capacity);
+	~vertexstream();
+
+	static vertexstream* shared();
+
+	// The buffer that the last append went to.
+	GLuint buffer() const { return _vbo; }
+
+	// Call once per frame, before anything is streamed.
+	void frame();
+
+	// Returns the offset of the data, which is a multiple of the stride.
+	GLintptr append(const void* data, GLsizeiptr size, GLsizei stride);
+
+private:
+	void create();
+	void replace(GLsizeiptr size);
+	void write(GLintptr offset, const void* data, GLsizeiptr size);
+	void wait(GLintptr begin, GLintptr end);
+
+	vertexstream(const vertexstream&) {}
+	vertexstream& operator=(const vertexstream&) { return *this; }
+};
+
+
 class vertexbuffer_base
 {
 public:
 	GLenum _mode;
 	GLuint _vbo;
 	GLuint _vao;
+	GLuint _ibo;
 	GLsizei _count;
+	GLsizei _index_count;
+	GLint _first;
+	bool _stream;
+	GLuint _stream_vbo;
 
 	vertexbuffer_base();
 	virtual ~vertexbuffer_base();
 
+	GLuint array_buffer() const { return _stream ? _stream_vbo : _vbo; }
+	void use_stream(bool value);
+	void use_stream_buffer(GLuint value);
+	void reset_vertex_array();
 
 	void _bind(const std::vector<renderer_vertex_attribute>& vertex_attributes, const void* data);
 	void unbind(const std::vector<renderer_vertex_attribute>& vertex_attributes);
@@ -66,18 +141,34 @@ public:
 	typedef _Vertex vertex_type;
 
 	std::vector<vertex_type> _vertices;
+	std::vector<GLushort> _indices;
 
 	vertexbuffer()
 	{
 	}
 
+	bool indexed() const
+	{
+		return _vbo != 0 ? _index_count != 0 : !_indices.empty();
+	}
+
 	GLsizei count() const
 	{
+		if (indexed())
+			return _vbo != 0 ? _index_count : (GLsizei)_indices.size();
 		return _vbo != 0 ? _count : (GLsizei)_vertices.size();
 	}
 
+	const GLvoid* index_data() const
+	{
+		return _ibo != 0 ? nullptr : _indices.data();
+	}
+
 	virtual void update(GLenum usage)
 	{
+		use_stream(false);
+		_first = 0;
+
 		if (_vbo == 0)
 		{
 			glGenBuffers(1, &_vbo);
@@ -97,6 +188,55 @@ public:
 		CHECK_ERROR_GL();
 
 		_count = (GLsizei)_vertices.size();
+
+		update_indices(usage);
+	}
+
+	// Appends the vertices to the shared vertex stream. The stream has no
+	// base vertex for indices, so indexed shapes are updated as usual.
+	void stream()
+	{
+		if (!_indices.empty())
+		{
+			update(GL_STREAM_DRAW);
+			return;
+		}
+
+		use_stream(true);
+		_count = (GLsizei)_vertices.size();
+		_index_count = 0;
+		_first = 0;
+		if (!_vertices.empty())
+		{
+			vertexstream* stream = vertexstream::shared();
+			GLintptr offset = stream->append(_vertices.data(), sizeof(vertex_type) * _vertices.size(), sizeof(vertex_type));
+			use_stream_buffer(stream->buffer());
+			_first = (GLint)(offset / sizeof(vertex_type));
+		}
+	}
+
+	void update_indices(GLenum usage)
+	{
+		if (!_indices.empty())
+		{
+			if (_ibo == 0)
+			{
+				glGenBuffers(1, &_ibo);
+				CHECK_ERROR_GL();
+				reset_vertex_array();
+			}
+
+			// the element buffer binding belongs to the bound vertex array
+			glstate::shared().bind_vertex_array(0);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ibo);
+			CHECK_ERROR_GL();
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort) * _indices.size(), _indices.data(), usage);
+			CHECK_ERROR_GL();
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+			CHECK_ERROR_GL();
+		}
+
+		_index_count = (GLsizei)_indices.size();
 	}
 
 	void bind(const std::vector<renderer_vertex_attribute>& vertex_attributes)
@@ -29,7 +29,9 @@ int BillboardTexture::AddSheet(const image& img)
 
 int BillboardTexture::AddShape(int sheet)
 {
-	return ++_shapeCount;
+	++_shapeCount;
+	_lookup.resize((_shapeCount + 1) * facing_buckets);
+	return _shapeCount;
 }
 
 
@@ -39,31 +41,35 @@ void BillboardTexture::SetTexCoords(int shape, float facing, affine2 const & tex
         _items[shape].push_back(item(shape, facing, texcoords));
     else
         _items[shape] = std::vector<item>(1, item(shape, facing, texcoords));
+
+	UpdateLookup(shape);
 }
 
 
-affine2 BillboardTexture::GetTexCoords(int shape, float facing)
+void BillboardTexture::UpdateLookup(int shape)
 {
-	affine2 result;
-	float diff = 360;
-
-    auto i = _items.find(shape);
-    if (i != _items.end())
-    {
-        const std::vector<item>& items = (*i).second;
-        for (auto j = items.begin(); j != items.end(); ++j)
-        {
-            if ((*j).shape == shape)
-            {
-                float d = glm::abs(diff_degrees((*j).facing, facing));
-                if (d < diff)
-                {
-                    diff = d;
-                    result = (*j).texcoords;
-                }
-            }
-        }
-    }
-
-	return result;
+	if (shape < 0)
+		return;
+	if ((int)_lookup.size() < (shape + 1) * facing_buckets)
+		_lookup.resize((shape + 1) * facing_buckets);
+
+	const std::vector<item>& items = _items[shape];
+	for (int bucket = 0; bucket < facing_buckets; ++bucket)
+	{
+		float facing = bucket * (360.0f / facing_buckets);
+		affine2 result;
+		float diff = 360;
+
+		for (const item& i : items)
+		{
+			float d = glm::abs(diff_degrees(i.facing, facing));
+			if (d < diff)
+			{
+				diff = d;
+				result = i.texcoords;
+			}
+		}
+
+		_lookup[shape * facing_buckets + bucket] = result;
+	}
 }
@@ -23,8 +23,12 @@ class BillboardTexture
 		item(int s, float f, affine2 t) : shape(s), facing(f), texcoords(t) { }
 	};
 
+	// Texcoords of the nearest facing, per shape and quantized angle.
+	static const int facing_buckets = 256;
+
 	texture* _texture;
     std::map<int, std::vector<item>> _items;
+	std::vector<affine2> _lookup;
 	int _shapeCount;
 
 public:
@@ -38,7 +42,15 @@ public:
 
 	void SetTexCoords(int shape, float facing, const affine2& texcoords);
 
-	affine2 GetTexCoords(int shape, float facing);
+	affine2 GetTexCoords(int shape, float facing) const
+	{
+		int bucket = (int)glm::floor(facing * (facing_buckets / 360.0f) + 0.5f) & (facing_buckets - 1);
+		int index = shape * facing_buckets + bucket;
+		return 0 <= index && index < (int)_lookup.size() ? _lookup[index] : affine2();
+	}
+
+private:
+	void UpdateLookup(int shape);
 };
 
 
@@ -83,5 +83,6 @@ void ColorBillboardRenderer::Draw(const glm::mat4x4& transform, const glm::vec3
 	uniforms._upvector = cameraUp;
 	uniforms._viewport_height = 0.25f * renderer_base::pixels_per_point() * viewportHeight;
 
+	_vbo.stream();
 	_renderer->render(_vbo, uniforms);
 }
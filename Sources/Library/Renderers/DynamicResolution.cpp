@@ -0,0 +1,321 @@
+// Copyright (C) 2013 Felix Ungman
+//
+// This file is part of the openwar platform (GPL v3 or later), see LICENSE.txt
+
+#include "DynamicResolution.h"
+
+
+DynamicResolution::DynamicResolution() :
+_framebuffer(nullptr),
+_colorFramebuffer(nullptr),
+_colorbuffer(nullptr),
+_depthbuffer(nullptr),
+_depthTexture(nullptr),
+_bufferSize(0),
+_surfaceSize(0),
+_surfaceFramebuffer(0),
+_hasSurfaceFramebuffer(false),
+_offscreen(false),
+_renderer(nullptr),
+_scale(1),
+_frameTime(0),
+_framesAtScale(0),
+_lastFrame(),
+_hasLastFrame(false),
+#if OPENWAR_USE_GLEW
+_timerQuery(0),
+#endif
+targetFrameTime(1.0f / 30),
+minScale(0.5f),
+sampleableDepth(false)
+{
+#if OPENWAR_USE_GLEW
+	_timerQueries[0] = _timerQueries[1] = 0;
+	_timerPending[0] = _timerPending[1] = false;
+	if (HasTimerQueries())
+		glGenQueries(2, _timerQueries);
+#endif
+
+	_renderer = new renderer<vertex, uniforms>((
+		VERTEX_ATTRIBUTE(vertex, _position),
+		VERTEX_ATTRIBUTE(vertex, _texcoord),
+		SHADER_UNIFORM(uniforms, _texture),
+		VERTEX_SHADER
+		({
+			attribute vec2 position;
+			attribute vec2 texcoord;
+			varying vec2 _texcoord;
+
+			void main()
+			{
+				_texcoord = texcoord;
+
+				gl_Position = vec4(position, 0, 1);
+				gl_PointSize = 1.0;
+			}
+		}),
+		FRAGMENT_SHADER
+		({
+			uniform sampler2D texture;
+			varying vec2 _texcoord;
+
+			void main()
+			{
+				gl_FragColor = texture2D(texture, _texcoord);
+			}
+		})
+	));
+}
+
+
+DynamicResolution::~DynamicResolution()
+{
+	delete _framebuffer;
+	delete _colorFramebuffer;
+	delete _colorbuffer;
+	delete _depthbuffer;
+	delete _depthTexture;
+	delete _renderer;
+
+#if OPENWAR_USE_GLEW
+	if (_timerQueries[0] != 0)
+		glDeleteQueries(2, _timerQueries);
+#endif
+}
+
+
+void DynamicResolution::BeginFrame(glm::ivec2 surfaceSize)
+{
+	_surfaceSize = surfaceSize;
+
+	UpdateScale();
+
+#if OPENWAR_USE_GLEW
+	if (_timerQueries[0] != 0)
+	{
+		glBeginQuery(GL_TIME_ELAPSED, _timerQueries[_timerQuery]);
+		CHECK_ERROR_GL();
+	}
+#endif
+
+	_offscreen = _scale < 1 || sampleableDepth;
+	if (!_offscreen)
+		return;
+
+	UpdateBuffers();
+
+	if (!_hasSurfaceFramebuffer)
+	{
+		glGetIntegerv(GL_FRAMEBUFFER_BINDING, &_surfaceFramebuffer);
+		_hasSurfaceFramebuffer = true;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, _framebuffer->id);
+	CHECK_ERROR_GL();
+}
+
+
+void DynamicResolution::EndFrame()
+{
+	if (_offscreen)
+		DrawOffscreen();
+
+#if OPENWAR_USE_GLEW
+	if (_timerQueries[0] != 0)
+	{
+		glEndQuery(GL_TIME_ELAPSED);
+		CHECK_ERROR_GL();
+		_timerPending[_timerQuery] = true;
+		_timerQuery ^= 1;
+	}
+#endif
+}
+
+
+// The offscreen buffer is drawn without blending, since its alpha is what
+// was left by the blending of the frame, not a coverage.
+
+void DynamicResolution::DrawOffscreen()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, _surfaceFramebuffer);
+	CHECK_ERROR_GL();
+
+	glViewport(0, 0, _surfaceSize.x, _surfaceSize.y);
+	glDisable(GL_DEPTH_TEST);
+	glClear(GL_DEPTH_BUFFER_BIT);
+
+	glm::ivec2 size = glm::ivec2(glm::vec2(_surfaceSize) * _scale);
+	glm::vec2 t = glm::vec2(size) / glm::vec2(_bufferSize);
+
+	_vbo._mode = GL_TRIANGLE_STRIP;
+	_vbo._vertices.clear();
+	_vbo._vertices.push_back(vertex(glm::vec2(-1, -1), glm::vec2(0, 0)));
+	_vbo._vertices.push_back(vertex(glm::vec2(1, -1), glm::vec2(t.x, 0)));
+	_vbo._vertices.push_back(vertex(glm::vec2(-1, 1), glm::vec2(0, t.y)));
+	_vbo._vertices.push_back(vertex(glm::vec2(1, 1), t));
+	_vbo.stream();
+
+	uniforms uniforms;
+	uniforms._texture = _colorbuffer;
+	_renderer->render(_vbo, uniforms);
+}
+
+
+// Timer queries are core in OpenGL 3.3, and of the configurations built
+// here, only GLEW exposes them.
+
+bool DynamicResolution::HasTimerQueries() const
+{
+#if OPENWAR_USE_GLEW
+	return GLEW_ARB_timer_query || GLEW_VERSION_3_3;
+#else
+	return false;
+#endif
+}
+
+
+// The GPU time of a frame is read from the query that ended a frame ago,
+// if its result is available by then; the GPU is never waited for. Without
+// timer queries, as in OpenGL ES 2.0, the time between frames stands in
+// for it, and long pauses, when nothing is rendered, are not counted.
+
+bool DynamicResolution::MeasureFrameTime(float& seconds)
+{
+#if OPENWAR_USE_GLEW
+	if (_timerQueries[0] != 0)
+	{
+		GLuint query = _timerQueries[_timerQuery];
+		if (!_timerPending[_timerQuery])
+			return false;
+
+		_timerPending[_timerQuery] = false;
+
+		GLint available = 0;
+		glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			return false;
+
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+		seconds = (float)(elapsed * 1e-9);
+		return true;
+	}
+#endif
+
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	float interval = std::chrono::duration<float>(now - _lastFrame).count();
+	bool measured = _hasLastFrame && interval < 0.25f;
+	_lastFrame = now;
+	_hasLastFrame = true;
+
+	if (measured)
+		seconds = interval;
+	return measured;
+}
+
+
+// The scale is lowered quickly and raised slowly, since a frame that
+// misses the target is worse than one that is blurry.
+
+void DynamicResolution::UpdateScale()
+{
+	float seconds = 0;
+	if (!MeasureFrameTime(seconds))
+		return;
+
+	if (_frameTime == 0)
+		_frameTime = seconds;
+	else
+		_frameTime += 0.1f * (seconds - _frameTime);
+
+	++_framesAtScale;
+
+	if (_frameTime > 1.2f * targetFrameTime && _framesAtScale >= 15 && _scale > minScale)
+	{
+		_scale = glm::max(minScale, _scale - 0.1f);
+		_framesAtScale = 0;
+	}
+	else if (_frameTime < 1.05f * targetFrameTime && _framesAtScale >= 120 && _scale < 1)
+	{
+		_scale = glm::min(1.0f, _scale + 0.05f);
+		_framesAtScale = 0;
+	}
+}
+
+
+// The buffers are as large as the surface, and only a part of them is
+// used, so that they are not reallocated when the scale changes.
+
+void DynamicResolution::UpdateBuffers()
+{
+	if (_framebuffer != nullptr && _bufferSize == _surfaceSize && (_depthTexture != nullptr) == sampleableDepth)
+		return;
+
+	_bufferSize = _surfaceSize;
+
+	if (_framebuffer == nullptr)
+		_framebuffer = new framebuffer();
+
+	if (_colorbuffer == nullptr)
+	{
+		_colorbuffer = new texture();
+		glstate::shared().bind_texture(_colorbuffer->id);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		CHECK_ERROR_GL();
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		CHECK_ERROR_GL();
+	}
+
+	glstate::shared().bind_texture(_colorbuffer->id);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, _bufferSize.x, _bufferSize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	CHECK_ERROR_GL();
+
+	_framebuffer->attach_color(_colorbuffer);
+
+	if (sampleableDepth)
+	{
+		delete _depthbuffer;
+		_depthbuffer = nullptr;
+
+		if (_depthTexture == nullptr)
+		{
+			_depthTexture = new texture();
+			glstate::shared().bind_texture(_depthTexture->id);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		}
+
+		glstate::shared().bind_texture(_depthTexture->id);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, _bufferSize.x, _bufferSize.y, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_SHORT, nullptr);
+		CHECK_ERROR_GL();
+
+		_framebuffer->attach_depth(_depthTexture);
+
+		bool complete;
+		{
+			bind_framebuffer binding(*_framebuffer);
+			complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+		}
+		if (complete)
+		{
+			if (_colorFramebuffer == nullptr)
+				_colorFramebuffer = new framebuffer();
+			_colorFramebuffer->attach_color(_colorbuffer);
+			return;
+		}
+
+		sampleableDepth = false;
+	}
+
+	delete _depthTexture;
+	_depthTexture = nullptr;
+
+	if (_depthbuffer == nullptr)
+		_depthbuffer = new renderbuffer(GL_DEPTH_COMPONENT16, _bufferSize.x, _bufferSize.y);
+	else
+		_depthbuffer->resize(GL_DEPTH_COMPONENT16, _bufferSize.x, _bufferSize.y);
+
+	_framebuffer->attach_depth(_depthbuffer);
+}
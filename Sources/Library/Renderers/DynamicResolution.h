@@ -0,0 +1,107 @@
+// Copyright (C) 2013 Felix Ungman
+//
+// This file is part of the openwar platform (GPL v3 or later), see LICENSE.txt
+
+#ifndef DynamicResolution_H
+#define DynamicResolution_H
+
+#include <chrono>
+
+#include "../Graphics/framebuffer.h"
+#include "../Graphics/renderbuffer.h"
+#include "../Graphics/renderer.h"
+
+
+// Renders into an offscreen buffer at a fraction of the surface resolution,
+// and draws the result scaled up to the surface. The fraction follows the
+// GPU time of the frame toward a target, but only changes when the frame time has
+// stayed outside a band around the target for a while, so that it does not
+// flicker between sizes. At full resolution, frames are drawn directly to
+// the surface, unless the depth must be sampleable.
+
+class DynamicResolution
+{
+	struct vertex
+	{
+		glm::vec2 _position;
+		glm::vec2 _texcoord;
+
+		vertex() {}
+		vertex(glm::vec2 p, glm::vec2 t) : _position(p), _texcoord(t) {}
+	};
+
+	struct uniforms
+	{
+		const texture* _texture;
+	};
+
+	framebuffer* _framebuffer;
+	framebuffer* _colorFramebuffer; // shares the color buffer, without depth
+	texture* _colorbuffer;
+	renderbuffer* _depthbuffer;
+	texture* _depthTexture;
+	glm::ivec2 _bufferSize; // allocated, in pixels
+	glm::ivec2 _surfaceSize;
+	GLint _surfaceFramebuffer; // queried once, when first needed
+	bool _hasSurfaceFramebuffer;
+	bool _offscreen;
+
+	vertexbuffer<vertex> _vbo;
+	renderer<vertex, uniforms>* _renderer;
+
+	float _scale;
+	float _frameTime; // smoothed, in seconds
+	int _framesAtScale;
+	std::chrono::steady_clock::time_point _lastFrame;
+	bool _hasLastFrame;
+
+#if OPENWAR_USE_GLEW
+	// two queries, so that each is read a frame after it ended
+	GLuint _timerQueries[2];
+	bool _timerPending[2];
+	int _timerQuery;
+#endif
+
+public:
+	float targetFrameTime; // seconds
+	float minScale;
+
+	// Attaches the depth as a texture, so that it can be sampled while the
+	// color framebuffer is bound. Cleared if the framebuffer is incomplete
+	// with one.
+	bool sampleableDepth;
+
+	DynamicResolution();
+	~DynamicResolution();
+
+	float GetScale() const { return _scale; }
+	float GetFrameTime() const { return _frameTime; }
+
+	// The offscreen buffer of the current frame, or null if drawing directly
+	// to the surface.
+	framebuffer* GetFramebuffer() const { return _offscreen ? _framebuffer : nullptr; }
+	texture* GetDepthTexture() const { return _offscreen ? _depthTexture : nullptr; }
+	framebuffer* GetColorFramebuffer() const { return _offscreen && _depthTexture != nullptr ? _colorFramebuffer : nullptr; }
+	glm::ivec2 GetBufferSize() const { return _bufferSize; }
+
+	// Picks the scale from the frame times measured so far and binds the
+	// offscreen buffer, if used. The size is in pixels.
+	void BeginFrame(glm::ivec2 surfaceSize);
+
+	// Binds the surface framebuffer again and draws the offscreen buffer
+	// to it.
+	void EndFrame();
+
+private:
+	void DrawOffscreen();
+	bool HasTimerQueries() const;
+	bool MeasureFrameTime(float& seconds);
+	void UpdateScale();
+	void UpdateBuffers();
+
+	DynamicResolution(const DynamicResolution&) {}
+	DynamicResolution& operator=(const DynamicResolution&) { return *this; }
+};
+
+
+#endif
@@ -55,6 +55,7 @@ void GradientRenderer::Draw(const glm::mat4x4& transform)
 
 	uniforms uniforms;
 	uniforms._transform = transform;
+	_vbo.stream();
 	_renderer->render(_vbo, uniforms);
 }
 
@@ -102,10 +103,16 @@ void GradientTriangleStripRenderer::Reset()
 }
 
 
+// A separator starts a new strip in the same draw, joined to the previous
+// one by degenerate triangles. The join is padded to an even length, so
+// that the new strip keeps its winding.
+
 void GradientTriangleStripRenderer::AddVertex(const glm::vec3& p, const glm::vec4& c, bool separator)
 {
 	if (separator && !_vbo._vertices.empty())
 	{
+		if (_vbo._vertices.size() % 2 != 0)
+			_vbo._vertices.push_back(_vbo._vertices.back());
 		_vbo._vertices.push_back(_vbo._vertices.back());
 		_vbo._vertices.push_back(vertex(p, c));
 	}
@@ -0,0 +1,142 @@
+// Copyright (C) 2013 Felix Ungman
+//
+// This file is part of the openwar platform (GPL v3 or later), see LICENSE.txt
+
+#include "HeightTexture.h"
+#include "../Graphics/renderer.h"
+
+
+
+HeightTexture::HeightTexture(std::function<float(glm::vec2)> getHeight, bounds2f bounds, int size) :
+_getHeight(getHeight),
+_bounds(bounds),
+_size(size),
+_range(0, 1),
+_texture(nullptr)
+{
+	_texture = new texture();
+
+	glstate::shared().bind_texture(_texture->id);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	CHECK_ERROR_GL();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	CHECK_ERROR_GL();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	CHECK_ERROR_GL();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	CHECK_ERROR_GL();
+
+	_heights.resize(_size * _size);
+}
+
+
+HeightTexture::~HeightTexture()
+{
+	delete _texture;
+}
+
+
+bool HeightTexture::IsSupported()
+{
+	GLint units = 0;
+	glGetIntegerv(GL_MAX_VERTEX_TEXTURE_IMAGE_UNITS, &units);
+	CHECK_ERROR_GL();
+	return units > 0;
+}
+
+
+glm::vec4 HeightTexture::GetGridTransform() const
+{
+	glm::vec2 scale = (float)(_size - 1) / _bounds.size();
+	return glm::vec4(_bounds.min.x, _bounds.min.y, scale.x, scale.y);
+}
+
+
+glm::vec2 HeightTexture::GetHeightDecode() const
+{
+	return glm::vec2(_range.min, (_range.max - _range.min) / 65535);
+}
+
+
+// The range is padded, so that editing the terrain rarely moves heights
+// outside it.
+
+void HeightTexture::Update()
+{
+	glm::vec2 step = _bounds.size() / (float)(_size - 1);
+	float min = 0;
+	float max = 0;
+
+	for (int y = 0; y < _size; ++y)
+		for (int x = 0; x < _size; ++x)
+		{
+			float h = _getHeight(_bounds.min + step * glm::vec2((float)x, (float)y));
+			_heights[x + y * _size] = h;
+			if (x == 0 && y == 0)
+				min = max = h;
+			min = glm::min(min, h);
+			max = glm::max(max, h);
+		}
+
+	float padding = 1 + 0.1f * (max - min);
+	_range = bounds1f(min - padding, max + padding);
+
+	Upload(0, 0, _size, _size);
+}
+
+
+void HeightTexture::Update(bounds2f bounds)
+{
+	glm::vec2 scale = (float)(_size - 1) / _bounds.size();
+	glm::vec2 p0 = glm::floor((bounds.min - _bounds.min) * scale);
+	glm::vec2 p1 = glm::ceil((bounds.max - _bounds.min) * scale);
+	int x0 = glm::max(0, (int)p0.x);
+	int y0 = glm::max(0, (int)p0.y);
+	int x1 = glm::min(_size, (int)p1.x + 1);
+	int y1 = glm::min(_size, (int)p1.y + 1);
+	if (x0 >= x1 || y0 >= y1)
+		return;
+
+	glm::vec2 step = _bounds.size() / (float)(_size - 1);
+	for (int y = y0; y < y1; ++y)
+		for (int x = x0; x < x1; ++x)
+		{
+			float h = _getHeight(_bounds.min + step * glm::vec2((float)x, (float)y));
+			if (!_range.contains(h))
+			{
+				Update();
+				return;
+			}
+			_heights[x + y * _size] = h;
+		}
+
+	Upload(x0, y0, x1, y1);
+}
+
+
+void HeightTexture::Upload(int x0, int y0, int x1, int y1)
+{
+	int width = x1 - x0;
+	int height = y1 - y0;
+	float scale = 65535 / (_range.max - _range.min);
+
+	_pixels.resize(4 * width * height);
+	GLubyte* p = _pixels.data();
+	for (int y = y0; y < y1; ++y)
+		for (int x = x0; x < x1; ++x)
+		{
+			float h = (_heights[x + y * _size] - _range.min) * scale;
+			int value = glm::clamp((int)(h + 0.5f), 0, 65535);
+			*p++ = (GLubyte)(value >> 8);
+			*p++ = (GLubyte)(value & 0xff);
+			*p++ = 0;
+			*p++ = 255;
+		}
+
+	glstate::shared().bind_texture(_texture->id);
+	if (width == _size && height == _size)
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, _size, _size, 0, GL_RGBA, GL_UNSIGNED_BYTE, _pixels.data());
+	else
+		glTexSubImage2D(GL_TEXTURE_2D, 0, x0, y0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, _pixels.data());
+	CHECK_ERROR_GL();
+}
@@ -0,0 +1,58 @@
+// Copyright (C) 2013 Felix Ungman
+//
+// This file is part of the openwar platform (GPL v3 or later), see LICENSE.txt
+
+#ifndef HEIGHTTEXTURE_H
+#define HEIGHTTEXTURE_H
+
+#include <functional>
+#include <vector>
+
+#include "../Algebra/bounds.h"
+#include "../Graphics/texture.h"
+
+
+// Terrain heights on a square grid in a texture, so that vertex shaders
+// can place things on the terrain without height lookups on the CPU.
+// Heights are stored in 16 bits, red channel first, relative to the height
+// range. The texture is sampled without filtering, so shaders interpolate
+// between the grid points themselves.
+
+class HeightTexture
+{
+	std::function<float(glm::vec2)> _getHeight;
+	bounds2f _bounds;
+	int _size;
+	bounds1f _range;
+	texture* _texture;
+	std::vector<float> _heights;
+	std::vector<GLubyte> _pixels;
+
+public:
+	HeightTexture(std::function<float(glm::vec2)> getHeight, bounds2f bounds, int size);
+	~HeightTexture();
+
+	// Vertex shader texture lookups are optional in OpenGL ES 2.0.
+	static bool IsSupported();
+
+	texture* GetTexture() const { return _texture; }
+	int GetSize() const { return _size; }
+
+	// Maps a position to grid coordinates: (p - xy) * zw
+	glm::vec4 GetGridTransform() const;
+
+	// Decodes a texel: x + (r * 65280 + g * 255) * y
+	glm::vec2 GetHeightDecode() const;
+
+	void Update();
+	void Update(bounds2f bounds);
+
+private:
+	void Upload(int x0, int y0, int x1, int y1);
+
+	HeightTexture(const HeightTexture&) {}
+	HeightTexture& operator=(const HeightTexture&) { return *this; }
+};
+
+
+#endif
@@ -55,6 +55,7 @@ void PlainRenderer::Draw(const glm::mat4x4& transform, const glm::vec4& color)
 	uniforms._transform = transform;
 	uniforms._color = color;
 
+	_vbo.stream();
 	_renderer->render(_vbo, uniforms);
 }
 
@@ -0,0 +1,110 @@
+// Copyright (C) 2013 Felix Ungman
+//
+// This file is part of the openwar platform (GPL v3 or later), see LICENSE.txt
+
+#include "TerrainLineRenderer.h"
+#include "HeightTexture.h"
+
+
+TerrainLineRenderer::TerrainLineRenderer()
+{
+	_renderer = new renderer<vertex, uniforms>((
+		VERTEX_ATTRIBUTE(vertex, _position),
+		VERTEX_ATTRIBUTE(vertex, _direction),
+		VERTEX_ATTRIBUTE(vertex, _reach),
+		SHADER_UNIFORM(uniforms, _transform),
+		SHADER_UNIFORM(uniforms, _color),
+		SHADER_UNIFORM(uniforms, _heightmap),
+		SHADER_UNIFORM(uniforms, _heightmap_transform),
+		SHADER_UNIFORM(uniforms, _heightmap_decode),
+		SHADER_UNIFORM(uniforms, _heightmap_size),
+		SHADER_UNIFORM(uniforms, _elevation),
+		VERTEX_SHADER
+		({
+			attribute vec2 position;
+			attribute float direction;
+			attribute float reach;
+			uniform mat4 transform;
+			uniform sampler2D heightmap;
+			uniform vec4 heightmap_transform;
+			uniform vec2 heightmap_decode;
+			uniform float heightmap_size;
+			uniform float elevation;
+
+			float get_texel_height(vec2 t)
+			{
+				vec4 c = texture2D(heightmap, (t + 0.5) / heightmap_size);
+				return heightmap_decode.x + (c.r * 65280.0 + c.g * 255.0) * heightmap_decode.y;
+			}
+
+			float get_height(vec2 p)
+			{
+				vec2 g = clamp((p - heightmap_transform.xy) * heightmap_transform.zw, 0.0, heightmap_size - 1.0);
+				vec2 i = min(floor(g), heightmap_size - 2.0);
+				vec2 f = g - i;
+				float h00 = get_texel_height(i);
+				float h10 = get_texel_height(i + vec2(1.0, 0.0));
+				float h01 = get_texel_height(i + vec2(0.0, 1.0));
+				float h11 = get_texel_height(i + vec2(1.0, 1.0));
+				return mix(mix(h00, h10, f.x), mix(h01, h11, f.x), f.y);
+			}
+
+			void main()
+			{
+				vec2 q = position + reach * vec2(cos(direction), sin(direction));
+				vec4 p = transform * vec4(q, get_height(q) + elevation, 1);
+
+				gl_Position = p;
+				gl_PointSize = 1.0;
+			}
+		}),
+		FRAGMENT_SHADER
+		({
+			uniform vec4 color;
+
+			void main()
+			{
+				gl_FragColor = color;
+			}
+		}))
+	);
+	_renderer->_blend_sfactor = GL_SRC_ALPHA;
+	_renderer->_blend_dfactor = GL_ONE_MINUS_SRC_ALPHA;
+}
+
+
+TerrainLineRenderer::~TerrainLineRenderer()
+{
+}
+
+
+void TerrainLineRenderer::Reset()
+{
+	_vbo._mode = GL_LINES;
+	_vbo._vertices.clear();
+}
+
+
+void TerrainLineRenderer::AddLine(glm::vec2 position, float direction, float reach)
+{
+	_vbo._vertices.push_back(vertex(position, direction, 0));
+	_vbo._vertices.push_back(vertex(position, direction, reach));
+}
+
+
+void TerrainLineRenderer::Draw(const glm::mat4x4& transform, const glm::vec4& color, HeightTexture* heightTexture, float elevation)
+{
+	glLineWidth(1);
+
+	uniforms uniforms;
+	uniforms._transform = transform;
+	uniforms._color = color;
+	uniforms._heightmap = heightTexture->GetTexture();
+	uniforms._heightmap_transform = heightTexture->GetGridTransform();
+	uniforms._heightmap_decode = heightTexture->GetHeightDecode();
+	uniforms._heightmap_size = (float)heightTexture->GetSize();
+	uniforms._elevation = elevation;
+
+	_vbo.stream();
+	_renderer->render(_vbo, uniforms);
+}
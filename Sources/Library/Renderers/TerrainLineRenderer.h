@@ -0,0 +1,52 @@
+// Copyright (C) 2013 Felix Ungman
+//
+// This file is part of the openwar platform (GPL v3 or later), see LICENSE.txt
+
+#ifndef TerrainLineRenderer_H
+#define TerrainLineRenderer_H
+
+#include "../Graphics/renderer.h"
+
+class HeightTexture;
+
+
+// Lines from a position on the terrain, in a direction (radians) and with
+// a length, placed at a height above the terrain by the vertex shader.
+
+class TerrainLineRenderer
+{
+	struct vertex
+	{
+		glm::vec2 _position;
+		float _direction;
+		float _reach;
+
+		vertex() {}
+		vertex(glm::vec2 p, float d, float r) : _position(p), _direction(d), _reach(r) {}
+	};
+
+	struct uniforms
+	{
+		glm::mat4x4 _transform;
+		glm::vec4 _color;
+		const texture* _heightmap;
+		glm::vec4 _heightmap_transform;
+		glm::vec2 _heightmap_decode;
+		float _heightmap_size;
+		float _elevation;
+	};
+
+	vertexbuffer<vertex> _vbo;
+	renderer<vertex, uniforms>* _renderer;
+
+public:
+	TerrainLineRenderer();
+	~TerrainLineRenderer();
+
+	void Reset();
+	void AddLine(glm::vec2 position, float direction, float reach);
+	void Draw(const glm::mat4x4& transform, const glm::vec4& color, HeightTexture* heightTexture, float elevation);
+};
+
+
+#endif
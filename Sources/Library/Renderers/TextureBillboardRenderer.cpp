@@ -3,11 +3,39 @@
 // This file is part of the openwar platform (GPL v3 or later), see LICENSE.txt
 
 #include <algorithm>
+#include <cstring>
+#include <limits>
 #include "TextureBillboardRenderer.h"
 
 
-TextureBillboardRenderer::TextureBillboardRenderer()
+// Maps a float to an unsigned key that sorts in reverse order.
+static unsigned descending_key(float value)
 {
+	unsigned bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	return (bits & 0x80000000u) != 0 ? bits : ~(bits | 0x80000000u);
+}
+
+
+
+int BillboardModel::GetTerrainShape(int shape) const
+{
+	for (size_t i = 0; i < terrainShapes.size(); ++i)
+		if (terrainShapes[i] == shape)
+			return (int)i;
+	return -1;
+}
+
+
+
+TextureBillboardRenderer::TextureBillboardRenderer() :
+_staticModel(nullptr),
+_staticVersion(0),
+_staticFlip(false)
+{
+	for (int sector = 0; sector < static_sectors; ++sector)
+		_staticSorted[sector] = false;
+
 	_texture_billboard_renderer = new renderer<texture_billboard_vertex, texture_billboard_uniforms>((
 		VERTEX_ATTRIBUTE(texture_billboard_vertex, _position),
 		VERTEX_ATTRIBUTE(texture_billboard_vertex, _height),
@@ -62,6 +90,100 @@ TextureBillboardRenderer::TextureBillboardRenderer()
 	})));
 	_texture_billboard_renderer->_blend_sfactor = GL_ONE;
 	_texture_billboard_renderer->_blend_dfactor = GL_ONE_MINUS_SRC_ALPHA;
+
+	_terrain_billboard_renderer = new renderer<terrain_billboard_vertex, terrain_billboard_uniforms>((
+		VERTEX_ATTRIBUTE(terrain_billboard_vertex, _position),
+		VERTEX_ATTRIBUTE(terrain_billboard_vertex, _facing),
+		VERTEX_ATTRIBUTE(terrain_billboard_vertex, _shape),
+		VERTEX_ATTRIBUTE(terrain_billboard_vertex, _height),
+		SHADER_UNIFORM(terrain_billboard_uniforms, _transform),
+		SHADER_UNIFORM(terrain_billboard_uniforms, _texture),
+		SHADER_UNIFORM(terrain_billboard_uniforms, _heightmap),
+		SHADER_UNIFORM(terrain_billboard_uniforms, _heightmap_transform),
+		SHADER_UNIFORM(terrain_billboard_uniforms, _heightmap_decode),
+		SHADER_UNIFORM(terrain_billboard_uniforms, _heightmap_size),
+		SHADER_UNIFORM(terrain_billboard_uniforms, _upvector),
+		SHADER_UNIFORM(terrain_billboard_uniforms, _viewport_height),
+		SHADER_UNIFORM(terrain_billboard_uniforms, _elevation),
+		SHADER_UNIFORM(terrain_billboard_uniforms, _facing_offset),
+		SHADER_UNIFORM(terrain_billboard_uniforms, _facing_sign),
+		SHADER_UNIFORM(terrain_billboard_uniforms, _texcoords),
+		VERTEX_SHADER
+		({
+			uniform mat4 transform;
+			uniform sampler2D heightmap;
+			uniform vec4 heightmap_transform;
+			uniform vec2 heightmap_decode;
+			uniform float heightmap_size;
+			uniform vec3 upvector;
+			uniform float viewport_height;
+			uniform float elevation;
+			uniform float facing_offset;
+			uniform float facing_sign;
+			uniform vec4 texcoords[96];
+			attribute vec2 position;
+			attribute float facing;
+			attribute float shape;
+			attribute float height;
+			varying vec2 _texcoord;
+			varying vec2 _texsize;
+
+		float get_texel_height(vec2 t)
+		{
+			vec4 c = texture2D(heightmap, (t + 0.5) / heightmap_size);
+			return heightmap_decode.x + (c.r * 65280.0 + c.g * 255.0) * heightmap_decode.y;
+		}
+
+		float get_height(vec2 p)
+		{
+			vec2 g = clamp((p - heightmap_transform.xy) * heightmap_transform.zw, 0.0, heightmap_size - 1.0);
+			vec2 i = min(floor(g), heightmap_size - 2.0);
+			vec2 f = g - i;
+			float h00 = get_texel_height(i);
+			float h10 = get_texel_height(i + vec2(1.0, 0.0));
+			float h01 = get_texel_height(i + vec2(0.0, 1.0));
+			float h11 = get_texel_height(i + vec2(1.0, 1.0));
+			return mix(mix(h00, h10, f.x), mix(h01, h11, f.x), f.y);
+		}
+
+		void main()
+		{
+			vec3 position1 = vec3(position, get_height(position) + elevation * height);
+			vec3 position2 = position1 + height * 0.5 * viewport_height * upvector;
+			vec4 p = transform * vec4(position1, 1);
+			vec4 q = transform * vec4(position2, 1);
+			float s = min(abs(q.y / q.w - p.y / p.w), 1024.0);
+
+			float f = facing_sign * (degrees(facing) + facing_offset);
+			float slot = mod(floor(f / 22.5 + 0.5), 16.0);
+			vec4 t = texcoords[int(shape * 16.0 + slot + 0.5)];
+
+			_texcoord = t.xy;
+			_texsize = t.zw;
+
+			gl_Position = p;
+			gl_PointSize = s;
+		}
+	}),
+	FRAGMENT_SHADER
+	({
+		uniform sampler2D texture;
+		varying vec2 _texcoord;
+		varying vec2 _texsize;
+
+		void main()
+		{
+			vec4 color = texture2D(texture, _texcoord + gl_PointCoord * _texsize);
+
+			gl_FragColor = color;
+		}
+	})));
+	_terrain_billboard_renderer->_blend_sfactor = GL_ONE;
+	_terrain_billboard_renderer->_blend_dfactor = GL_ONE_MINUS_SRC_ALPHA;
+
+	// drawn with every frame of a battle
+	_texture_billboard_renderer->compile();
+	_terrain_billboard_renderer->compile();
 }
 
 
@@ -77,27 +199,25 @@ void TextureBillboardRenderer::Reset()
 }
 
 
-void TextureBillboardRenderer::AddBillboard(glm::vec3 position, float height, affine2 texcoords)
+static texture_billboard_vertex MakeBillboardVertex(glm::vec3 position, float height, affine2 texcoords)
 {
 	glm::vec2 texpos = texcoords.transform(glm::vec2(0, 0));
 	glm::vec2 texsize = texcoords.transform(glm::vec2(1, 1)) - texpos;
 
-	_vbo._vertices.push_back(texture_billboard_vertex(position, height, texpos, texsize));
+	return texture_billboard_vertex(position, height, texpos, texsize);
 }
 
 
-void TextureBillboardRenderer::Draw(texture* tex, const glm::mat4x4& transform, const glm::vec3& cameraUp, float cameraFacingDegrees, float viewportHeight, bounds1f sizeLimit)
+void TextureBillboardRenderer::AddBillboard(glm::vec3 position, float height, affine2 texcoords)
 {
-	float a = -glm::radians(cameraFacingDegrees);
-	float cos_a = cosf(a);
-	float sin_a = sinf(a);
-	for (texture_billboard_vertex& v : _vbo._vertices)
-		v._order = cos_a * v._position.x - sin_a * v._position.y;
+	_vbo._vertices.push_back(MakeBillboardVertex(position, height, texcoords));
+}
 
-	std::sort(_vbo._vertices.begin(), _vbo._vertices.end(), [](const texture_billboard_vertex& a, const texture_billboard_vertex& b) {
-		return a._order > b._order;
-	});
-	_vbo.update(GL_STATIC_DRAW);
+
+void TextureBillboardRenderer::Draw(texture* tex, const glm::mat4x4& transform, const glm::vec3& cameraUp, float cameraFacingDegrees, float viewportHeight, bounds1f sizeLimit)
+{
+	SortBackToFront(_vbo._vertices, _sortVertices, cameraFacingDegrees);
+	_vbo.stream();
 
 	texture_billboard_uniforms uniforms;
 	uniforms._transform = transform;
@@ -119,27 +239,234 @@ static affine2 FlipY(const affine2& texcoords)
 }
 
 
-void TextureBillboardRenderer::Render(BillboardModel* billboardModel, glm::mat4x4 const & transform, const glm::vec3& cameraUp, float cameraFacingDegrees, float viewportHeight, bool flip)
+static void AppendBillboards(std::vector<texture_billboard_vertex>& vertices, const std::vector<Billboard>& billboards, const BillboardTexture* texture, float cameraFacingDegrees, bool flip)
 {
-	Reset();
-
-	for (const Billboard& billboard : billboardModel->staticBillboards)
+	for (const Billboard& billboard : billboards)
 	{
 		float facing = billboard.facing - cameraFacingDegrees + 180;
-		affine2 texcoords = billboardModel->texture->GetTexCoords(billboard.shape, flip ? -facing : facing);
+		affine2 texcoords = texture->GetTexCoords(billboard.shape, flip ? -facing : facing);
 		if (flip)
 			texcoords = FlipY(texcoords);
-		AddBillboard(billboard.position, billboard.height, texcoords);
+		vertices.push_back(MakeBillboardVertex(billboard.position, billboard.height, texcoords));
+	}
+}
+
+
+void TextureBillboardRenderer::Render(BillboardModel* billboardModel, glm::mat4x4 const & transform, const glm::vec3& cameraUp, float cameraFacingDegrees, float viewportHeight, bool flip)
+{
+	if (_staticModel != billboardModel || _staticVersion != billboardModel->staticVersion || _staticFlip != flip)
+		UpdateStaticBillboards(billboardModel, flip);
+
+	Reset();
+	AppendBillboards(_vbo._vertices, billboardModel->dynamicBillboards, billboardModel->texture, cameraFacingDegrees, flip);
+	SortBackToFront(_vbo._vertices, _sortVertices, cameraFacingDegrees);
+	_vbo.stream();
+
+	// the terrain billboards are taken from the model
+	_terrainVbo._mode = GL_POINTS;
+	_terrainVbo._vertices.swap(billboardModel->terrainBillboards);
+	billboardModel->terrainBillboards.clear();
+	if (billboardModel->heightTexture == nullptr)
+		_terrainVbo._vertices.clear();
+	SortBackToFront(_terrainVbo._vertices, _sortTerrainVertices, cameraFacingDegrees);
+	_terrainVbo.stream();
+
+	int sector = (int)glm::floor(cameraFacingDegrees * (static_sectors / 360.0f) + 0.5f) & (static_sectors - 1);
+	if (!_staticSorted[sector])
+		SortStaticSector(sector);
+
+	vertexbuffer<texture_billboard_vertex>& staticVbo = _staticVbo[sector];
+	const std::vector<glm::vec2>& staticPositions = _staticPositions[sector];
+
+	float a = -glm::radians(cameraFacingDegrees);
+	float cos_a = cosf(a);
+	float sin_a = sinf(a);
+	_staticOrder.resize(staticPositions.size());
+	for (size_t i = 0; i < staticPositions.size(); ++i)
+		_staticOrder[i] = cos_a * staticPositions[i].x - sin_a * staticPositions[i].y;
+	const std::vector<float>& staticOrder = _staticOrder;
+
+	texture_billboard_uniforms uniforms;
+	uniforms._transform = transform;
+	uniforms._texture = billboardModel->texture->GetTexture();
+	uniforms._upvector = cameraUp;
+	uniforms._viewport_height = renderer_base::pixels_per_point() * viewportHeight;
+	uniforms._min_point_size = 0;
+	uniforms._max_point_size = 1024;
+
+	int staticCount = (int)staticOrder.size();
+	int dynamicCount = (int)_vbo._vertices.size();
+	int terrainCount = (int)_terrainVbo._vertices.size();
+
+	terrain_billboard_uniforms terrainUniforms;
+	if (terrainCount != 0)
+	{
+		HeightTexture* heightTexture = billboardModel->heightTexture;
+		terrainUniforms._transform = transform;
+		terrainUniforms._texture = uniforms._texture;
+		terrainUniforms._heightmap = heightTexture->GetTexture();
+		terrainUniforms._heightmap_transform = heightTexture->GetGridTransform();
+		terrainUniforms._heightmap_decode = heightTexture->GetHeightDecode();
+		terrainUniforms._heightmap_size = (float)heightTexture->GetSize();
+		terrainUniforms._upvector = cameraUp;
+		terrainUniforms._viewport_height = uniforms._viewport_height;
+		terrainUniforms._elevation = billboardModel->terrainElevation;
+		terrainUniforms._facing_offset = 180 - cameraFacingDegrees;
+		terrainUniforms._facing_sign = flip ? -1 : 1;
+		SetTerrainTexCoords(terrainUniforms, billboardModel, flip);
+	}
+
+	// Back to front is descending order. At equal order, static billboards
+	// are drawn first, then terrain billboards and then dynamic billboards.
+	// The static order is only nearly descending at facings between the
+	// sectors, which is fine, since a run ends at any billboard of the
+	// other sets that is farther away.
+
+	const float end = -std::numeric_limits<float>::max();
+	auto staticKey = [&](int i) { return i < staticCount ? staticOrder[i] : end; };
+	auto dynamicKey = [&](int j) { return j < dynamicCount ? _vbo._vertices[j]._order : end; };
+	auto terrainKey = [&](int k) { return k < terrainCount ? _terrainVbo._vertices[k]._order : end; };
+
+	int i = 0;
+	int j = 0;
+	int k = 0;
+	while (i < staticCount || j < dynamicCount || k < terrainCount)
+	{
+		int i1 = i;
+		float limit = glm::max(dynamicKey(j), terrainKey(k));
+		while (i1 < staticCount && staticKey(i1) >= limit)
+			++i1;
+
+		int k1 = k;
+		while (k1 < terrainCount && terrainKey(k1) > staticKey(i1) && terrainKey(k1) >= dynamicKey(j))
+			++k1;
+
+		int j1 = j;
+		limit = glm::max(staticKey(i1), terrainKey(k1));
+		while (j1 < dynamicCount && dynamicKey(j1) > limit)
+			++j1;
+
+		_texture_billboard_renderer->render(staticVbo, uniforms, i, i1 - i);
+		_terrain_billboard_renderer->render(_terrainVbo, terrainUniforms, k, k1 - k);
+		_texture_billboard_renderer->render(_vbo, uniforms, j, j1 - j);
+
+		i = i1;
+		j = j1;
+		k = k1;
 	}
+}
+
 
-	for (const Billboard& billboard : billboardModel->dynamicBillboards)
+// The texture coordinates of the nearest facing at the center of each
+// facing slot, which the vertex shader picks from.
+
+void TextureBillboardRenderer::SetTerrainTexCoords(terrain_billboard_uniforms& uniforms, const BillboardModel* billboardModel, bool flip)
+{
+	int shapes = glm::min(terrain_shapes, (int)billboardModel->terrainShapes.size());
+	for (int i = 0; i < terrain_shapes * facing_slots; ++i)
 	{
-		float facing = billboard.facing - cameraFacingDegrees + 180;
-		affine2 texcoords = billboardModel->texture->GetTexCoords(billboard.shape, flip ? -facing : facing);
-		if (flip)
-			texcoords = FlipY(texcoords);
-		AddBillboard(billboard.position, billboard.height, texcoords);
+		int shape = i / facing_slots;
+		if (shape < shapes)
+		{
+			float facing = (i % facing_slots) * (360.0f / facing_slots);
+			affine2 texcoords = billboardModel->texture->GetTexCoords(billboardModel->terrainShapes[shape], facing);
+			if (flip)
+				texcoords = FlipY(texcoords);
+
+			glm::vec2 texpos = texcoords.transform(glm::vec2(0, 0));
+			glm::vec2 texsize = texcoords.transform(glm::vec2(1, 1)) - texpos;
+			uniforms._texcoords[i] = glm::vec4(texpos.x, texpos.y, texsize.x, texsize.y);
+		}
+		else
+		{
+			uniforms._texcoords[i] = glm::vec4();
+		}
+	}
+}
+
+
+void TextureBillboardRenderer::UpdateStaticBillboards(const BillboardModel* billboardModel, bool flip)
+{
+	for (int sector = 0; sector < static_sectors; ++sector)
+		_staticSorted[sector] = false;
+
+	_staticModel = billboardModel;
+	_staticVersion = billboardModel->staticVersion;
+	_staticFlip = flip;
+}
+
+
+void TextureBillboardRenderer::SortStaticSector(int sector)
+{
+	float cameraFacingDegrees = sector * (360.0f / static_sectors);
+	vertexbuffer<texture_billboard_vertex>& vbo = _staticVbo[sector];
+
+	vbo._mode = GL_POINTS;
+	vbo._vertices.clear();
+	AppendBillboards(vbo._vertices, _staticModel->staticBillboards, _staticModel->texture, cameraFacingDegrees, _staticFlip);
+	SortBackToFront(vbo._vertices, _sortVertices, cameraFacingDegrees);
+	vbo.update(GL_STATIC_DRAW);
+
+	// only the positions are needed after the upload
+	std::vector<glm::vec2>& positions = _staticPositions[sector];
+	positions.resize(vbo._vertices.size());
+	for (size_t i = 0; i < positions.size(); ++i)
+		positions[i] = glm::vec2(vbo._vertices[i]._position);
+	std::vector<texture_billboard_vertex>().swap(vbo._vertices);
+
+	_staticSorted[sector] = true;
+}
+
+
+// Back to front is descending _order. The sort is a stable LSD radix sort
+// on the order bits, one byte per pass.
+
+template <class T>
+void TextureBillboardRenderer::SortBackToFront(std::vector<T>& vertices, std::vector<T>& scratch, float cameraFacingDegrees)
+{
+	float a = -glm::radians(cameraFacingDegrees);
+	float cos_a = cosf(a);
+	float sin_a = sinf(a);
+
+	size_t n = vertices.size();
+	_sortKeys.resize(n);
+	_sortIndices.resize(n);
+	_sortScratch.resize(n);
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		T& v = vertices[i];
+		v._order = cos_a * v._position.x - sin_a * v._position.y;
+		_sortKeys[i] = descending_key(v._order);
+		_sortIndices[i] = (unsigned)i;
+	}
+
+	for (int shift = 0; shift < 32; shift += 8)
+	{
+		size_t offsets[256] = { 0 };
+		for (size_t i = 0; i < n; ++i)
+			++offsets[(_sortKeys[i] >> shift) & 0xff];
+
+		size_t sum = 0;
+		for (int k = 0; k < 256; ++k)
+		{
+			size_t count = offsets[k];
+			offsets[k] = sum;
+			sum += count;
+		}
+
+		for (size_t i = 0; i < n; ++i)
+		{
+			unsigned index = _sortIndices[i];
+			_sortScratch[offsets[(_sortKeys[index] >> shift) & 0xff]++] = index;
+		}
+
+		_sortIndices.swap(_sortScratch);
 	}
 
-	Draw(billboardModel->texture->GetTexture(), transform, cameraUp, cameraFacingDegrees, viewportHeight);
+	scratch.clear();
+	scratch.reserve(n);
+	for (size_t i = 0; i < n; ++i)
+		scratch.push_back(vertices[_sortIndices[i]]);
+	vertices.swap(scratch);
 }
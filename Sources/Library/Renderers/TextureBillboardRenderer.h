@@ -7,6 +7,7 @@
 
 #include "../Graphics/renderer.h"
 #include "BillboardTexture.h"
+#include "HeightTexture.h"
 
 
 struct Billboard
@@ -21,11 +22,36 @@ struct Billboard
 };
 
 
+// Billboard standing on the terrain, with the height looked up in the
+// vertex shader. The facing is in radians, and the shape is an index into
+// BillboardModel::terrainShapes.
+
+struct terrain_billboard_vertex
+{
+	glm::vec2 _position;
+	float _facing;
+	float _shape;
+	float _height;
+	float _order;
+
+	terrain_billboard_vertex(glm::vec2 p, float f, float s, float h) : _position(p), _facing(f), _shape(s), _height(h)
+	{
+	}
+};
+
+
 struct BillboardModel
 {
 	BillboardTexture* texture;
 	std::vector<Billboard> staticBillboards;
 	std::vector<Billboard> dynamicBillboards;
+	int staticVersion; // increment when staticBillboards change
+
+	// used when the height texture is set, at most 6 shapes
+	HeightTexture* heightTexture;
+	std::vector<terrain_billboard_vertex> terrainBillboards;
+	std::vector<int> terrainShapes;
+	float terrainElevation; // center above ground, relative to height
 
 	int _billboardTreeShapes[16];
 	int _billboardShapeCasualtyAsh[8];
@@ -38,6 +64,10 @@ struct BillboardModel
 	int _billboardShapeFighterCavBlue;
 	int _billboardShapeFighterCavRed;
 	int _billboardShapeSmoke[8];
+
+	BillboardModel() : texture(nullptr), staticVersion(0), heightTexture(nullptr), terrainElevation(0.5f) {}
+
+	int GetTerrainShape(int shape) const;
 };
 
 
@@ -64,12 +94,58 @@ struct texture_billboard_uniforms
 	float _max_point_size;
 };
 
+struct terrain_billboard_uniforms
+{
+	glm::mat4x4 _transform;
+	const texture* _texture;
+	const texture* _heightmap;
+	glm::vec4 _heightmap_transform;
+	glm::vec2 _heightmap_decode;
+	float _heightmap_size;
+	glm::vec3 _upvector;
+	float _viewport_height;
+	float _elevation;
+	float _facing_offset;
+	float _facing_sign;
+	glm::vec4 _texcoords[96]; // texture position and size, per terrain shape and facing slot
+};
+
+
+// Static billboards are kept in vertex buffers presorted back to front for
+// a number of camera facing sectors. When they change, each sector is
+// sorted again when it is next drawn, so that a change costs at most the
+// one sort of a dynamic set, and a sector is not sorted again until then.
+// Dynamic and terrain billboards are radix sorted every frame, and the sets
+// are merged at draw time by alternating between ranges of the buffers. The
+// merge compares depths at the actual camera facing; the static depths are
+// computed every frame, and the presort only decides their order.
 
 class TextureBillboardRenderer
 {
+	static const int static_sectors = 16;
+	static const int terrain_shapes = 6;
+	static const int facing_slots = 16;
+
 public:
 	renderer<texture_billboard_vertex, texture_billboard_uniforms>* _texture_billboard_renderer;
+	renderer<terrain_billboard_vertex, terrain_billboard_uniforms>* _terrain_billboard_renderer;
 	vertexbuffer<texture_billboard_vertex> _vbo;
+	vertexbuffer<terrain_billboard_vertex> _terrainVbo;
+
+private:
+	vertexbuffer<texture_billboard_vertex> _staticVbo[static_sectors];
+	std::vector<glm::vec2> _staticPositions[static_sectors]; // in drawing order
+	std::vector<float> _staticOrder; // for the current facing
+	bool _staticSorted[static_sectors];
+	const BillboardModel* _staticModel;
+	int _staticVersion;
+	bool _staticFlip;
+
+	std::vector<unsigned> _sortKeys;
+	std::vector<unsigned> _sortIndices;
+	std::vector<unsigned> _sortScratch;
+	std::vector<texture_billboard_vertex> _sortVertices;
+	std::vector<terrain_billboard_vertex> _sortTerrainVertices;
 
 public:
 	TextureBillboardRenderer();
@@ -80,6 +156,14 @@ public:
 	void Draw(texture* tex, const glm::mat4x4& transform, const glm::vec3& cameraUp, float cameraFacingDegrees, float viewportHeight, bounds1f sizeLimit = bounds1f(0, 1024));
 
 	void Render(BillboardModel* billboardModel, const glm::mat4x4& transform, const glm::vec3& cameraUp, float viewportHeight, float cameraFacingDegrees, bool flip);
+
+private:
+	void UpdateStaticBillboards(const BillboardModel* billboardModel, bool flip);
+	void SortStaticSector(int sector);
+	static void SetTerrainTexCoords(terrain_billboard_uniforms& uniforms, const BillboardModel* billboardModel, bool flip);
+
+	template <class T>
+	void SortBackToFront(std::vector<T>& vertices, std::vector<T>& scratch, float cameraFacingDegrees);
 };
 
 
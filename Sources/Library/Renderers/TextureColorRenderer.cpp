@@ -0,0 +1,79 @@
+// Copyright (C) 2013 Felix Ungman
+//
+// This file is part of the openwar platform (GPL v3 or later), see LICENSE.txt
+
+#include "TextureColorRenderer.h"
+
+
+TextureColorRenderer::TextureColorRenderer()
+{
+	_renderer = new renderer<vertex, uniforms>((
+		VERTEX_ATTRIBUTE(vertex, _position),
+		VERTEX_ATTRIBUTE(vertex, _texcoord),
+		VERTEX_ATTRIBUTE(vertex, _color),
+		SHADER_UNIFORM(uniforms, _transform),
+		SHADER_UNIFORM(uniforms, _texture),
+		VERTEX_SHADER
+		({
+			uniform mat4 transform;
+			attribute vec3 position;
+			attribute vec2 texcoord;
+			attribute vec4 color;
+			varying vec2 _texcoord;
+			varying vec4 _color;
+
+			void main()
+			{
+				vec4 p = transform * vec4(position, 1);
+
+				_texcoord = texcoord;
+				_color = vec4(color.rgb * color.a, color.a);
+
+				gl_Position = p;
+				gl_PointSize = 1.0;
+			}
+		}),
+		FRAGMENT_SHADER
+		({
+			uniform sampler2D texture;
+			varying vec2 _texcoord;
+			varying vec4 _color;
+
+			void main()
+			{
+				gl_FragColor = texture2D(texture, _texcoord) * _color;
+			}
+		})
+	));
+	_renderer->_blend_sfactor = GL_ONE;
+	_renderer->_blend_dfactor = GL_ONE_MINUS_SRC_ALPHA;
+}
+
+
+TextureColorRenderer::~TextureColorRenderer()
+{
+}
+
+
+void TextureColorRenderer::Reset()
+{
+	_vbo._mode = GL_TRIANGLES;
+	_vbo._vertices.clear();
+}
+
+
+void TextureColorRenderer::AddVertex(glm::vec3 p, glm::vec2 t, glm::vec4 c)
+{
+	_vbo._vertices.push_back(vertex(p, t, c));
+}
+
+
+void TextureColorRenderer::Draw(const glm::mat4x4& transform, const texture* texture)
+{
+	uniforms uniforms;
+	uniforms._transform = transform;
+	uniforms._texture = texture;
+
+	_vbo.stream();
+	_renderer->render(_vbo, uniforms);
+}
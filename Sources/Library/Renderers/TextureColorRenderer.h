@@ -0,0 +1,45 @@
+// Copyright (C) 2013 Felix Ungman
+//
+// This file is part of the openwar platform (GPL v3 or later), see LICENSE.txt
+
+#ifndef TextureColorRenderer_H
+#define TextureColorRenderer_H
+
+#include "../Graphics/renderer.h"
+
+
+// Triangles with a premultiplied texture, tinted and faded by a color per
+// vertex. The color is not premultiplied.
+
+class TextureColorRenderer
+{
+	struct vertex
+	{
+		glm::vec3 _position;
+		glm::vec2 _texcoord;
+		glm::vec4 _color;
+
+		vertex() {}
+		vertex(glm::vec3 p, glm::vec2 t, glm::vec4 c) : _position(p), _texcoord(t), _color(c) {}
+	};
+
+	struct uniforms
+	{
+		glm::mat4x4 _transform;
+		const texture* _texture;
+	};
+
+	vertexbuffer<vertex> _vbo;
+	renderer<vertex, uniforms>* _renderer;
+
+public:
+	TextureColorRenderer();
+	~TextureColorRenderer();
+
+	void Reset();
+	void AddVertex(glm::vec3 p, glm::vec2 t, glm::vec4 c);
+	void Draw(const glm::mat4x4& transform, const texture* texture);
+};
+
+
+#endif
@@ -63,6 +63,7 @@ void TextureRenderer::Draw(const glm::mat4x4& transform, const texture* texture)
 	uniforms._transform = transform;
 	uniforms._texture = texture;
 
+	_vbo.stream();
 	_renderer->render(_vbo, uniforms);
 }
 
@@ -218,6 +218,8 @@ static char TranslateKeyCode(const SDL_Keysym& keysym)
 		case SDLK_a: return 'A';
 		case SDLK_s: return 'S';
 		case SDLK_d: return 'D';
+		case SDLK_y: return 'Y';
+		case SDLK_z: return 'Z';
 		case SDLK_1: return '1';
 		case SDLK_2: return '2';
 		case SDLK_3: return '3';
@@ -0,0 +1,127 @@
+// Copyright (C) 2013 Felix Ungman
+//
+// This file is part of the openwar platform (GPL v3 or later), see LICENSE.txt
+
+#ifdef OPENWAR_USE_NSBUNDLE_RESOURCES
+#import <Foundation/Foundation.h>
+#else
+#include <iostream>
+#endif
+
+#include <cstring>
+#include "profiler.h"
+
+
+static bool has_prefix(const std::string& name, const char* prefix)
+{
+	return name.compare(0, std::strlen(prefix), prefix) == 0;
+}
+
+
+profiler& profiler::shared()
+{
+	static profiler singleton;
+	return singleton;
+}
+
+
+void profiler::add_time(const char* name, double milliseconds)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	find(name).milliseconds += milliseconds;
+}
+
+
+void profiler::add_count(const char* name, int count)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	find(name).count += count;
+}
+
+
+double profiler::get_time(const char* name) const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	const entry* e = find(name);
+	return e != nullptr ? e->milliseconds : 0;
+}
+
+
+int profiler::get_count(const char* name) const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	const entry* e = find(name);
+	return e != nullptr ? e->count : 0;
+}
+
+
+void profiler::reset(const char* prefix)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	for (entry& e : _entries)
+		if (has_prefix(e.name, prefix))
+		{
+			e.milliseconds = 0;
+			e.count = 0;
+		}
+}
+
+
+void profiler::log(const char* prefix) const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	double total = 0;
+	for (const entry& e : _entries)
+	{
+		if (!has_prefix(e.name, prefix))
+			continue;
+
+		total += e.milliseconds;
+#ifdef OPENWAR_USE_NSBUNDLE_RESOURCES
+		NSLog(@"PROFILER %-32s %8.2f ms %8d", e.name.c_str(), e.milliseconds, e.count);
+#else
+		std::cout << "PROFILER " << e.name << " " << e.milliseconds << " ms " << e.count << std::endl;
+#endif
+	}
+
+#ifdef OPENWAR_USE_NSBUNDLE_RESOURCES
+	NSLog(@"PROFILER %-32s %8.2f ms", prefix, total);
+#else
+	std::cout << "PROFILER " << prefix << " " << total << " ms" << std::endl;
+#endif
+}
+
+
+profiler::entry& profiler::find(const char* name)
+{
+	for (entry& e : _entries)
+		if (e.name == name)
+			return e;
+
+	_entries.push_back(entry(name));
+	return _entries.back();
+}
+
+
+const profiler::entry* profiler::find(const char* name) const
+{
+	for (const entry& e : _entries)
+		if (e.name == name)
+			return &e;
+
+	return nullptr;
+}
+
+
+profile_scope::profile_scope(const char* name) :
+_name(name),
+_start(std::chrono::steady_clock::now())
+{
+}
+
+
+profile_scope::~profile_scope()
+{
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - _start;
+	profiler::shared().add_time(_name, elapsed.count());
+}
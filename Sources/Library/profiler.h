@@ -0,0 +1,62 @@
+// Copyright (C) 2013 Felix Ungman
+//
+// This file is part of the openwar platform (GPL v3 or later), see LICENSE.txt
+
+#ifndef profiler_H
+#define profiler_H
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+// Named timings (in milliseconds) and counters, kept in the order they
+// were first recorded. Names are dotted, e.g. "terrain.normals", so that
+// related entries can be logged and reset together by prefix.
+
+class profiler
+{
+	struct entry
+	{
+		std::string name;
+		double milliseconds;
+		int count;
+		entry(const std::string& n) : name(n), milliseconds(0), count(0) {}
+	};
+
+	mutable std::mutex _mutex;
+	std::vector<entry> _entries;
+
+public:
+	static profiler& shared();
+
+	void add_time(const char* name, double milliseconds);
+	void add_count(const char* name, int count);
+
+	double get_time(const char* name) const;
+	int get_count(const char* name) const;
+
+	void reset(const char* prefix);
+	void log(const char* prefix) const;
+
+private:
+	entry& find(const char* name);
+	const entry* find(const char* name) const;
+};
+
+
+// Adds the lifetime of the object to a named profiler timing.
+
+class profile_scope
+{
+	const char* _name;
+	std::chrono::steady_clock::time_point _start;
+
+public:
+	explicit profile_scope(const char* name);
+	~profile_scope();
+};
+
+
+#endif
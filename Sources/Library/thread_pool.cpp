@@ -0,0 +1,125 @@
+// Copyright (C) 2013 Felix Ungman
+//
+// This file is part of the openwar platform (GPL v3 or later), see LICENSE.txt
+
+#include <atomic>
+#include <memory>
+#include "thread_pool.h"
+
+
+thread_pool& thread_pool::shared()
+{
+	static thread_pool* singleton = nullptr;
+	static std::once_flag once;
+	std::call_once(once, []() {
+		int threads = (int)std::thread::hardware_concurrency() - 1;
+		singleton = new thread_pool(threads > 0 ? threads : 1);
+	});
+	return *singleton;
+}
+
+
+thread_pool::thread_pool(int threads) :
+_stopping(false)
+{
+	for (int i = 0; i < threads; ++i)
+		_threads.push_back(std::thread(&thread_pool::run, this));
+}
+
+
+thread_pool::~thread_pool()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stopping = true;
+	}
+	_condition.notify_all();
+
+	for (std::thread& thread : _threads)
+		thread.join();
+}
+
+
+void thread_pool::enqueue(std::function<void()> job)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_jobs.push_back(job);
+	}
+	_condition.notify_one();
+}
+
+
+struct parallel_for_state
+{
+	int begin;
+	int end;
+	int grain;
+	int count;
+	std::function<void(int, int)> body;
+	std::atomic<int> next;
+	std::atomic<int> done;
+	std::mutex mutex;
+	std::condition_variable finished;
+
+	parallel_for_state(int b, int e, int g, std::function<void(int, int)> f) : begin(b), end(e), grain(g), count((e - b + g - 1) / g), body(f), next(0), done(0) {}
+
+	// Runs chunks until none are left. Chunks are claimed through an atomic
+	// counter, so a caller never waits for work that nobody has picked up.
+	void work()
+	{
+		int chunk;
+		while ((chunk = next.fetch_add(1)) < count)
+		{
+			int first = begin + chunk * grain;
+			int last = first + grain < end ? first + grain : end;
+			body(first, last);
+
+			if (done.fetch_add(1) + 1 == count)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				finished.notify_all();
+			}
+		}
+	}
+};
+
+
+void thread_pool::parallel_for(int begin, int end, int grain, std::function<void(int, int)> body)
+{
+	if (end <= begin)
+		return;
+	if (grain < 1)
+		grain = 1;
+
+	std::shared_ptr<parallel_for_state> state(new parallel_for_state(begin, end, grain, body));
+
+	int helpers = state->count - 1 < size() ? state->count - 1 : size();
+	for (int i = 0; i < helpers; ++i)
+		enqueue([state]() { state->work(); });
+
+	state->work();
+
+	std::unique_lock<std::mutex> lock(state->mutex);
+	while (state->done.load() < state->count)
+		state->finished.wait(lock);
+}
+
+
+void thread_pool::run()
+{
+	while (true)
+	{
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			while (!_stopping && _jobs.empty())
+				_condition.wait(lock);
+			if (_stopping && _jobs.empty())
+				return;
+			job = _jobs.front();
+			_jobs.pop_front();
+		}
+		job();
+	}
+}
@@ -0,0 +1,50 @@
+// Copyright (C) 2013 Felix Ungman
+//
+// This file is part of the openwar platform (GPL v3 or later), see LICENSE.txt
+
+#ifndef thread_pool_H
+#define thread_pool_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Fixed set of worker threads. Jobs must not touch GL state, since the
+// workers have no GL context.
+
+class thread_pool
+{
+	std::vector<std::thread> _threads;
+	std::deque<std::function<void()>> _jobs;
+	std::mutex _mutex;
+	std::condition_variable _condition;
+	bool _stopping;
+
+public:
+	static thread_pool& shared();
+
+	explicit thread_pool(int threads);
+	~thread_pool();
+
+	int size() const { return (int)_threads.size(); }
+
+	void enqueue(std::function<void()> job);
+
+	// Calls body(first, last) for consecutive ranges of at most 'grain'
+	// items covering [begin, end). The calling thread takes part in the
+	// work, and the call returns when all ranges are done.
+	void parallel_for(int begin, int end, int grain, std::function<void(int, int)> body);
+
+private:
+	thread_pool(const thread_pool&);
+	thread_pool& operator=(const thread_pool&);
+
+	void run();
+};
+
+
+#endif
@@ -153,6 +153,85 @@ void Unit::SetUnitUpdate(UnitUpdate unitUpdate, BattleModel* battleModel)
 }
 
 
+UnitCommandUpdate::UnitCommandUpdate() :
+unitId(0),
+fields(UnitCommandFieldAll),
+path(),
+facing(0),
+running(false),
+meleeTargetId(0),
+missileTargetId(0),
+missileTargetLocked(false),
+holdFire(false),
+timeUntilSwapFighters(0),
+sequence(0)
+{
+}
+
+
+int UnitCommandUpdate::GetChangedFields(const UnitCommandUpdate& other) const
+{
+	int result = 0;
+
+	if (path != other.path)
+		result |= UnitCommandFieldPath;
+	if (facing != other.facing)
+		result |= UnitCommandFieldFacing;
+	if (running != other.running)
+		result |= UnitCommandFieldRunning;
+	if (meleeTargetId != other.meleeTargetId)
+		result |= UnitCommandFieldMeleeTarget;
+	if (missileTargetId != other.missileTargetId || missileTargetLocked != other.missileTargetLocked)
+		result |= UnitCommandFieldMissileTarget;
+	if (holdFire != other.holdFire)
+		result |= UnitCommandFieldHoldFire;
+
+	return result;
+}
+
+
+UnitCommandUpdate Unit::GetCommandUpdate() const
+{
+	UnitCommandUpdate result;
+
+	result.unitId = unitId;
+	result.path = command.path;
+	result.facing = command.facing;
+	result.running = command.running;
+	result.meleeTargetId = command.meleeTarget != nullptr ? command.meleeTarget->unitId : 0;
+	result.missileTargetId = command.missileTarget != nullptr ? command.missileTarget->unitId : 0;
+	result.missileTargetLocked = command.missileTargetLocked;
+	result.holdFire = command.holdFire;
+
+	return result;
+}
+
+
+void Unit::SetCommandUpdate(const UnitCommandUpdate& commandUpdate, BattleModel* battleModel)
+{
+	int fields = commandUpdate.fields;
+
+	if (fields & UnitCommandFieldPath)
+		command.path = commandUpdate.path;
+	if (fields & UnitCommandFieldFacing)
+		command.facing = commandUpdate.facing;
+	if (fields & UnitCommandFieldRunning)
+		command.running = commandUpdate.running;
+	if (fields & UnitCommandFieldMeleeTarget)
+		command.meleeTarget = battleModel->GetUnit(commandUpdate.meleeTargetId);
+	if (fields & UnitCommandFieldMissileTarget)
+	{
+		command.missileTarget = battleModel->GetUnit(commandUpdate.missileTargetId);
+		command.missileTargetLocked = commandUpdate.missileTargetLocked;
+	}
+	if (fields & UnitCommandFieldHoldFire)
+		command.holdFire = commandUpdate.holdFire;
+
+	if (commandUpdate.timeUntilSwapFighters != 0)
+		timeUntilSwapFighters = commandUpdate.timeUntilSwapFighters;
+}
+
+
 UnitStats::UnitStats() :
 unitPlatform(UnitPlatformCav),
 unitWeapon(UnitWeaponYari),
@@ -23,6 +23,7 @@ class UnitTrackingMarker;
 struct Fighter;
 struct Unit;
 struct UnitUpdate;
+struct UnitCommandUpdate;
 
 
 enum PlayMode
@@ -283,6 +284,42 @@ struct UnitCommand
 };
 
 
+enum UnitCommandField
+{
+	UnitCommandFieldPath = 1,
+	UnitCommandFieldFacing = 2,
+	UnitCommandFieldRunning = 4,
+	UnitCommandFieldMeleeTarget = 8,
+	UnitCommandFieldMissileTarget = 16, // including missileTargetLocked
+	UnitCommandFieldHoldFire = 32,
+	UnitCommandFieldAll = 63
+};
+
+
+// A unit's command with the target units given by id, so that it can be
+// passed between battle models. Only the fields in the mask are set when
+// the update is applied.
+
+struct UnitCommandUpdate
+{
+	int unitId;
+	int fields;
+	std::vector<glm::vec2> path;
+	float facing;
+	bool running;
+	int meleeTargetId;
+	int missileTargetId;
+	bool missileTargetLocked;
+	bool holdFire;
+	float timeUntilSwapFighters; // zero leaves the receiving unit's timer
+	int sequence;
+
+	UnitCommandUpdate();
+
+	int GetChangedFields(const UnitCommandUpdate& other) const;
+};
+
+
 struct Unit
 {
 	// static attributes
@@ -309,6 +346,9 @@ struct Unit
 	UnitUpdate GetUnitUpdate();
 	void SetUnitUpdate(UnitUpdate unitUpdate, BattleModel* battleModel);
 
+	UnitCommandUpdate GetCommandUpdate() const;
+	void SetCommandUpdate(const UnitCommandUpdate& commandUpdate, BattleModel* battleModel);
+
 	glm::vec2 CalculateUnitCenter();
 
 	float GetSpeed();
@@ -4,6 +4,7 @@
 
 #include "SmokeCounter.h"
 #include "../../Library/Audio/SoundPlayer.h"
+#include "../../Library/Algebra/geometry.h"
 #include "../../Library/Renderers/TextureBillboardRenderer.h"
 
 
@@ -65,17 +66,27 @@ bool SmokeCounter::Animate(float seconds)
 }
 
 
-void SmokeCounter::AppendSmokeBillboards(BillboardModel* billboardModel)
+int SmokeCounter::AppendSmokeBillboards(BillboardModel* billboardModel, const frustum& view)
 {
+	int culled = 0;
 	for (SmokeCounter::Particle& projectile : particles)
 	{
 		if (projectile.time > 0)
 		{
+			float height = 1 + 3 * projectile.time;
+			if (!view.intersects(projectile.position, height))
+			{
+				++culled;
+				continue;
+			}
+
 			int i = (int)(8 * projectile.time);
 			if (i > 7)
 				i = 7;
 
-			billboardModel->dynamicBillboards.push_back(Billboard(projectile.position, 0, 1 + 3 * projectile.time, billboardModel->_billboardShapeSmoke[i]));
+			billboardModel->dynamicBillboards.push_back(Billboard(projectile.position, 0, height, billboardModel->_billboardShapeSmoke[i]));
 		}
 	}
+
+	return culled;
 }
@@ -7,6 +7,7 @@
 
 #include "BattleModel.h"
 class BillboardModel;
+struct frustum;
 
 
 class SmokeCounter
@@ -35,7 +36,7 @@ public:
 
 	bool Animate(float seconds);
 	void AddParticle(glm::vec3 position1, glm::vec3 position2, float delay);
-	void AppendSmokeBillboards(BillboardModel* billboardModel);
+	int AppendSmokeBillboards(BillboardModel* billboardModel, const frustum& view); // returns the number culled
 };
 
 
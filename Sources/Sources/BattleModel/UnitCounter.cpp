@@ -6,8 +6,9 @@
 
 #include "UnitCounter.h"
 #include "BattleModel.h"
-#include "../../Library/Renderers/PlainRenderer.h"
+#include "../../Library/Renderers/TerrainLineRenderer.h"
 #include "../../Library/Renderers/TextureBillboardRenderer.h"
+#include "../../Library/Renderers/TextureColorRenderer.h"
 #include "../../Library/Renderers/TextureRenderer.h"
 #include "../BattleView/BattleView.h"
 
@@ -15,7 +16,9 @@
 UnitCounter::UnitCounter(BattleModel* battleModel, Unit* unit) :
 _battleModel(battleModel),
 _unit(unit),
-_routingTimer(0)
+_routingTimer(0),
+_impostorBlend(0),
+_visible(true)
 {
 }
 
@@ -43,6 +46,40 @@ bool UnitCounter::Animate(float seconds)
 }
 
 
+// The fighters' extent on the ground, with heights sampled at the corners
+// and center only, padded for the height of the fighters and for hills in
+// between.
+
+bounds3f UnitCounter::GetFighterBounds() const
+{
+	bounds2f bounds(_unit->state.center, _unit->state.center);
+	for (Fighter* fighter = _unit->fighters, * end = fighter + _unit->fightersCount; fighter != end; ++fighter)
+	{
+		bounds.min = glm::min(bounds.min, fighter->state.position);
+		bounds.max = glm::max(bounds.max, fighter->state.position);
+	}
+
+	TerrainSurface* terrainSurface = _battleModel->terrainSurface;
+	float heights[5] = {
+		terrainSurface->GetHeight(bounds.p11()),
+		terrainSurface->GetHeight(bounds.p12()),
+		terrainSurface->GetHeight(bounds.p21()),
+		terrainSurface->GetHeight(bounds.p22()),
+		terrainSurface->GetHeight(bounds.center())
+	};
+
+	float min = heights[0];
+	float max = heights[0];
+	for (float height : heights)
+	{
+		min = glm::min(min, height);
+		max = glm::max(max, height);
+	}
+
+	return bounds3f(bounds.grow(3), bounds1f(min - 5, max + 8));
+}
+
+
 void UnitCounter::AppendUnitMarker(TextureBillboardRenderer* renderer1, TextureBillboardRenderer* renderer2, bool flip)
 {
 	bool routingIndicator = false;
@@ -129,52 +166,141 @@ void UnitCounter::AppendFacingMarker(TextureTriangleRenderer* renderer, BattleVi
 }
 
 
-void UnitCounter::AppendFighterWeapons(PlainLineRenderer* renderer)
+void UnitCounter::AppendFighterWeapons(std::vector<glm::vec3>& lines) const
 {
-	if (_unit->stats.weaponReach > 0)
+	if (_unit->stats.weaponReach > 0 && _impostorBlend < 1)
 	{
-		for (Fighter* fighter = _unit->fighters, * end = fighter + _unit->fightersCount; fighter != end; ++fighter)
+		for (int i = 0; i < _unit->fightersCount; ++i)
 		{
+			if (!IsFighterShown(i))
+				continue;
+
+			const Fighter* fighter = _unit->fighters + i;
 			glm::vec2 p1 = fighter->state.position;
 			glm::vec2 p2 = p1 + _unit->stats.weaponReach * vector2_from_angle(fighter->state.direction);
 
-			renderer->AddLine(
-					_battleModel->terrainSurface->GetPosition(p1, 1),
-					_battleModel->terrainSurface->GetPosition(p2, 1));
+			lines.push_back(_battleModel->terrainSurface->GetPosition(p1, 1));
+			lines.push_back(_battleModel->terrainSurface->GetPosition(p2, 1));
 		}
 	}
 }
 
 
-void UnitCounter::AppendFighterBillboards(BillboardModel* billboardModel)
+void UnitCounter::AppendFighterWeapons(TerrainLineRenderer* renderer)
 {
-	for (Fighter* fighter = _unit->fighters, * end = fighter + _unit->fightersCount; fighter != end; ++fighter)
+	if (_unit->stats.weaponReach > 0 && _impostorBlend < 1)
 	{
-		float size = 2.0;
-		int shape = 0;
-		switch (_unit->stats.unitPlatform)
-		{
-			case UnitPlatformCav:
-			case UnitPlatformGen:
-				shape = _unit->player == _battleModel->bluePlayer ? billboardModel->_billboardShapeFighterCavBlue : billboardModel->_billboardShapeFighterCavRed;
-				size = 3.0;
-				break;
-
-			case UnitPlatformSam:
-				shape = _unit->player == _battleModel->bluePlayer ? billboardModel->_billboardShapeFighterSamBlue : billboardModel->_billboardShapeFighterSamRed;
-				size = 2.0;
-				break;
-
-			case UnitPlatformAsh:
-				shape = _unit->player == _battleModel->bluePlayer ? billboardModel->_billboardShapeFighterAshBlue : billboardModel->_billboardShapeFighterAshRed;
-				size = 2.0;
-				break;
-		}
+		for (int i = 0; i < _unit->fightersCount; ++i)
+			if (IsFighterShown(i))
+				renderer->AddLine(_unit->fighters[i].state.position, _unit->fighters[i].state.direction, _unit->stats.weaponReach);
+	}
+}
+
+
+// With a height texture, the fighters are copied as they are, and the
+// vertex shader does the rest.
+
+void UnitCounter::AppendFighterBillboards(const BillboardModel* billboardModel, std::vector<Billboard>& billboards, std::vector<terrain_billboard_vertex>& terrainBillboards) const
+{
+	if (_impostorBlend >= 1)
+		return;
+
+	float size = 2.0;
+	int shape = GetFighterShape(billboardModel, size);
+
+	int terrainShape = billboardModel->heightTexture != nullptr ? billboardModel->GetTerrainShape(shape) : -1;
+	if (terrainShape != -1)
+	{
+		for (int i = 0; i < _unit->fightersCount; ++i)
+			if (IsFighterShown(i))
+				terrainBillboards.push_back(terrain_billboard_vertex(_unit->fighters[i].state.position, _unit->fighters[i].state.direction, (float)terrainShape, size));
+		return;
+	}
 
+	for (int i = 0; i < _unit->fightersCount; ++i)
+	{
+		if (!IsFighterShown(i))
+			continue;
 
+		const Fighter* fighter = _unit->fighters + i;
 		const float adjust = 0.5 - 2.0 / 64.0; // place texture 2 texels below ground
 		glm::vec3 p = _battleModel->terrainSurface->GetPosition(fighter->state.position, adjust * size);
 		float facing = glm::degrees(fighter->state.direction);
-		billboardModel->dynamicBillboards.push_back(Billboard(p, facing, size, shape));
+		billboards.push_back(Billboard(p, facing, size, shape));
+	}
+}
+
+
+// The impostor covers the formation, ranks by files, with one fighter
+// blob per texture repeat. It follows the terrain on a coarse grid, so that
+// its cost does not grow with the number of fighters.
+
+void UnitCounter::AppendFormationImpostor(TextureColorRenderer* renderer) const
+{
+	Formation formation = _unit->formation;
+	int files = formation.numberOfFiles;
+	int ranks = formation.numberOfRanks;
+	if (_impostorBlend <= 0 || files <= 0 || ranks <= 0)
+		return;
+
+	glm::vec2 origin = formation.GetFrontLeft(_unit->state.center) - 0.5f * (formation.towardRight + formation.towardBack);
+	glm::vec4 color = _unit->player == _battleModel->bluePlayer ? glm::vec4(0, 0, 1, _impostorBlend) : glm::vec4(1, 0, 0, _impostorBlend);
+
+	const int cells = 4;
+	int nx = glm::min(files, cells);
+	int ny = glm::min(ranks, cells);
+
+	glm::vec3 positions[cells + 1][cells + 1];
+	glm::vec2 texcoords[cells + 1][cells + 1];
+	for (int y = 0; y <= ny; ++y)
+		for (int x = 0; x <= nx; ++x)
+		{
+			glm::vec2 t((float)files * x / nx, (float)ranks * y / ny);
+			positions[x][y] = _battleModel->terrainSurface->GetPosition(origin + t.x * formation.towardRight + t.y * formation.towardBack, 1);
+			texcoords[x][y] = t;
+		}
+
+	for (int y = 0; y < ny; ++y)
+		for (int x = 0; x < nx; ++x)
+		{
+			renderer->AddVertex(positions[x][y], texcoords[x][y], color);
+			renderer->AddVertex(positions[x + 1][y], texcoords[x + 1][y], color);
+			renderer->AddVertex(positions[x + 1][y + 1], texcoords[x + 1][y + 1], color);
+
+			renderer->AddVertex(positions[x + 1][y + 1], texcoords[x + 1][y + 1], color);
+			renderer->AddVertex(positions[x][y + 1], texcoords[x][y + 1], color);
+			renderer->AddVertex(positions[x][y], texcoords[x][y], color);
+		}
+}
+
+
+// A fixed subset of the fighters is left out for a given blend, so that
+// fighters fade out one by one instead of flickering.
+
+bool UnitCounter::IsFighterShown(int index) const
+{
+	unsigned int hash = (unsigned int)index * 2654435761u;
+	return (float)((hash >> 16) & 0xffff) / 65536.0f >= _impostorBlend;
+}
+
+
+int UnitCounter::GetFighterShape(const BillboardModel* billboardModel, float& size) const
+{
+	switch (_unit->stats.unitPlatform)
+	{
+		case UnitPlatformCav:
+		case UnitPlatformGen:
+			size = 3.0;
+			return _unit->player == _battleModel->bluePlayer ? billboardModel->_billboardShapeFighterCavBlue : billboardModel->_billboardShapeFighterCavRed;
+
+		case UnitPlatformSam:
+			size = 2.0;
+			return _unit->player == _battleModel->bluePlayer ? billboardModel->_billboardShapeFighterSamBlue : billboardModel->_billboardShapeFighterSamRed;
+
+		case UnitPlatformAsh:
+			size = 2.0;
+			return _unit->player == _battleModel->bluePlayer ? billboardModel->_billboardShapeFighterAshBlue : billboardModel->_billboardShapeFighterAshRed;
 	}
+
+	return 0;
 }
@@ -5,15 +5,20 @@
 #ifndef UnitCounter_H
 #define UnitCounter_H
 
+#include <vector>
+
 #include "../../Library/Algebra/bounds.h"
 
 class BattleModel;
 class BattleView;
 class BillboardModel;
-class PlainLineRenderer;
+class TerrainLineRenderer;
 class TextureBillboardRenderer;
+class TextureColorRenderer;
 class TextureTriangleRenderer;
 class Unit;
+struct Billboard;
+struct terrain_billboard_vertex;
 
 
 class UnitCounter
@@ -23,19 +28,35 @@ public:
 	Unit* _unit;
 	float _routingTimer;
 
+	// 0 draws every fighter, 1 only the formation impostor; in between, the
+	// impostor fades in as fighters are left out
+	float _impostorBlend;
+
+	// set by the view each frame, fighters are only appended when visible
+	bool _visible;
+
 public:
 	UnitCounter(BattleModel* battleModel, Unit* unit);
 	~UnitCounter();
 
 	Unit* GetUnit() const { return _unit; }
+	bounds3f GetFighterBounds() const;
 
 	bool Animate(float seconds);
 
 	void AppendUnitMarker(TextureBillboardRenderer* renderer1, TextureBillboardRenderer* renderer2, bool flip);
 	void AppendFacingMarker(TextureTriangleRenderer* renderer, BattleView* battleView);
 
-	void AppendFighterWeapons(PlainLineRenderer* renderer);
-	void AppendFighterBillboards(BillboardModel* billboardModel);
+	// Safe to call for several counters in parallel.
+	void AppendFighterWeapons(std::vector<glm::vec3>& lines) const;
+	void AppendFighterBillboards(const BillboardModel* billboardModel, std::vector<Billboard>& billboards, std::vector<terrain_billboard_vertex>& terrainBillboards) const;
+
+	void AppendFighterWeapons(TerrainLineRenderer* renderer);
+	void AppendFormationImpostor(TextureColorRenderer* renderer) const;
+
+private:
+	bool IsFighterShown(int index) const;
+	int GetFighterShape(const BillboardModel* billboardModel, float& size) const;
 };
 
 
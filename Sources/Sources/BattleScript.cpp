@@ -9,11 +9,11 @@
 #include "BattleModel/BattleModel.h"
 #include "Simulator/BattleSimulator.h"
 #include "TerrainForest/BillboardTerrainForest.h"
+#include "SmoothTerrain/SmoothTerrainMap.h"
 #include "SmoothTerrain/SmoothTerrainSurface.h"
 #include "TerrainSurface/TiledTerrainSurface.h"
 #include "SmoothTerrain/SmoothTerrainWater.h"
 #include "TerrainSky/SmoothTerrainSky.h"
-#include "../Library/Renderers/GradientRenderer.h"
 
 
 static BattleScript* _battlescript = nullptr;
@@ -31,6 +31,7 @@ static void print_log(const char* operation, const char* message)
 BattleScript::BattleScript() :
 _battleModel(nullptr),
 _battleSimulator(nullptr),
+_hints(nullptr),
 _state(nullptr)
 {
 	_battleModel = new BattleModel();
@@ -191,7 +192,7 @@ void BattleScript::Tick(double secondsSinceLastUpdate)
 }
 
 
-void BattleScript::RenderHints(GradientLineRenderer* renderer)
+void BattleScript::RenderHints(std::vector<glm::vec3>& hints)
 {
 	lua_getglobal(_state, "openwar_render_hints");
 
@@ -201,7 +202,7 @@ void BattleScript::RenderHints(GradientLineRenderer* renderer)
 	}
 	else
 	{
-		_renderer = renderer;
+		_hints = &hints;
 
 		int error = lua_pcall(_state, 0, 0, 0);
 		if (error)
@@ -220,21 +221,26 @@ int BattleScript::NewUnit(Player player, UnitPlatform platform, UnitWeapon weapo
 	Unit* unit = _battleModel->AddUnit(player, strength, unitStats, position);
 	unit->command.facing = glm::radians(90 - bearing);
 
-	_battleModel->AddUnitMarker(unit);
-
 	return unit->unitId;
 }
 
 
+// The script runs on the simulation thread between time steps, so its
+// commands are applied directly rather than through the command queue.
+
 void BattleScript::SetUnitMovement(int unitId, bool running, std::vector<glm::vec2> path, int chargeId, float heading)
 {
 	Unit* unit = _battleModel->GetUnit(unitId);
 	if (unit != nullptr)
 	{
-		unit->command.path = path;
-		unit->command.facing = heading;
-		unit->command.meleeTarget = _battleModel->GetUnit(chargeId);
-		unit->command.running = running;
+		UnitCommandUpdate commandUpdate;
+		commandUpdate.unitId = unitId;
+		commandUpdate.fields = UnitCommandFieldPath | UnitCommandFieldFacing | UnitCommandFieldRunning | UnitCommandFieldMeleeTarget;
+		commandUpdate.path = path;
+		commandUpdate.facing = heading;
+		commandUpdate.meleeTargetId = chargeId;
+		commandUpdate.running = running;
+		unit->SetCommandUpdate(commandUpdate, _battleModel);
 
 		//if (_battleModel->GetMovementMarker(unit) == nullptr)
 		//	_battleModel->AddMovementMarker(unit);
@@ -259,22 +265,48 @@ int BattleScript::openwar_terrain_init(lua_State* L)
 		const char* p = n < 2 ? nullptr : lua_tostring(L, 2);
 		const double size = n < 3 ? 1024 : lua_tonumber(L, 3);
 
+		bounds2f bounds(0, 0, size, size);
+
+		// a map compiled for the same bounds, see --compile-map, is used
+		// instead of deriving the terrain from the groundmap; it is
+		// read-only, so the terrain editor is off while it is used
+		SmoothTerrainMap* compiled = new SmoothTerrainMap();
+
 #ifdef OPENWAR_USE_SDL
 
-		image* map = new image(resource("Maps/DefaultMap.tiff"));
-		bounds2f bounds(0, 0, size, size);
+		bool opened = compiled->Open(resource("Maps/DefaultMap.owmap").path());
 
 #else
 
 		NSString* path = [NSString stringWithCString:p encoding:NSASCIIStringEncoding];
-		NSData* data = [NSData dataWithContentsOfFile:path];
-		image* map = ConvertTiffToImage(data);
-		bounds2f bounds(0, 0, size, size);
+		bool opened = compiled->Open([path.stringByDeletingPathExtension stringByAppendingPathExtension:@"owmap"].UTF8String);
+
+#endif
+
+		if (opened && compiled->GetBounds().min == bounds.min && compiled->GetBounds().max == bounds.max)
+		{
+			_battlescript->_battleModel->terrainSurface = new SmoothTerrainSurface(bounds, compiled);
+			_battlescript->_battleModel->terrainWater = new SmoothTerrainWater(bounds, compiled);
+		}
+		else
+		{
+			delete compiled;
+
+#ifdef OPENWAR_USE_SDL
+
+			image* map = new image(resource("Maps/DefaultMap.tiff"));
+
+#else
+
+			NSData* data = [NSData dataWithContentsOfFile:path];
+			image* map = ConvertTiffToImage(data);
 
 #endif
 
-		_battlescript->_battleModel->terrainSurface = new SmoothTerrainSurface(bounds, map);
-		_battlescript->_battleModel->terrainWater = new SmoothTerrainWater(bounds, map);
+			_battlescript->_battleModel->terrainSurface = new SmoothTerrainSurface(bounds, map);
+			_battlescript->_battleModel->terrainWater = new SmoothTerrainWater(bounds, map);
+		}
+
 		_battlescript->_battleModel->terrainSky = new SmoothTerrainSky();
 	}
 	else if (s != nullptr && std::strcmp(s, "tiled") == 0)
@@ -310,9 +342,8 @@ int BattleScript::openwar_render_hint_line(lua_State* L)
 	float z1 = _battlescript->_battleModel->terrainSurface->GetHeight(glm::vec2(x1, y1));
 	float z2 = _battlescript->_battleModel->terrainSurface->GetHeight(glm::vec2(x2, y2));
 
-	glm::vec4 c(0, 0, 0, 0.5f);
-
-	_battlescript->_renderer->AddLine(glm::vec3(x1, y1, z1), glm::vec3(x2, y2, z2), c, c);
+	_battlescript->_hints->push_back(glm::vec3(x1, y1, z1));
+	_battlescript->_hints->push_back(glm::vec3(x2, y2, z2));
 
 	return 0;
 }
@@ -326,8 +357,6 @@ int BattleScript::openwar_render_hint_circle(lua_State* L)
 	float y = n < 2 ? 0 : (float)lua_tonumber(L, 2);
 	float r = n < 3 ? 0 : (float)lua_tonumber(L, 3);
 
-	glm::vec4 c(0, 0, 0, 0.5f);
-
 	float da = 2 * glm::pi<float>() / 16;
 	for (int i = 0; i < 16; ++i)
 	{
@@ -341,7 +370,8 @@ int BattleScript::openwar_render_hint_circle(lua_State* L)
 		float z1 = _battlescript->_battleModel->terrainSurface->GetHeight(glm::vec2(x1, y1));
 		float z2 = _battlescript->_battleModel->terrainSurface->GetHeight(glm::vec2(x2, y2));
 
-		_battlescript->_renderer->AddLine(glm::vec3(x1, y1, z1), glm::vec3(x2, y2, z2), c, c);
+		_battlescript->_hints->push_back(glm::vec3(x1, y1, z1));
+		_battlescript->_hints->push_back(glm::vec3(x2, y2, z2));
 	}
 
 	return 0;
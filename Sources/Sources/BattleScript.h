@@ -11,7 +11,6 @@
 
 class BattleModel;
 class BattleSimulator;
-class GradientLineRenderer;
 class TiledTerrainSurfaceRenderer;
 
 
@@ -30,7 +29,7 @@ class BattleScript
 
 	BattleModel* _battleModel;
 	BattleSimulator* _battleSimulator;
-	GradientLineRenderer* _renderer;
+	std::vector<glm::vec3>* _hints;
 	lua_State* _state;
 
 public:
@@ -47,7 +46,7 @@ public:
 	BattleSimulator* GetBattleSimulator() const { return _battleSimulator; }
 
 	void Tick(double secondsSinceLastTick);
-	void RenderHints(GradientLineRenderer* renderer);
+	void RenderHints(std::vector<glm::vec3>& hints);
 
 private:
 	int NewUnit(Player player, UnitPlatform platform, UnitWeapon weapon, int strength, glm::vec2 position, float bearing);
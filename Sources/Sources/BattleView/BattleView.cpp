@@ -19,10 +19,15 @@
 #include "../../Library/Renderers/GradientRenderer.h"
 #include "../../Library/Renderers/ColorBillboardRenderer.h"
 #include "../SmoothTerrain/SmoothTerrainWater.h"
+#include "../TerrainForest/SmoothTerrainForest.h"
 #include "../TerrainSky/SmoothTerrainSky.h"
 #include "../../Library/Renderers/PlainRenderer.h"
+#include "../../Library/Renderers/TerrainLineRenderer.h"
+#include "../../Library/Renderers/TextureColorRenderer.h"
 #include "../../Library/Renderers/TextureRenderer.h"
 #include "../../Library/Renderers/sprite.h"
+#include "../../Library/profiler.h"
+#include "../../Library/thread_pool.h"
 
 
 
@@ -37,12 +42,36 @@ static affine2 billboard_texcoords(int x, int y, bool flip)
 
 
 
+// One fighter seen from above, a soft premultiplied blob, to be repeated
+// across formation impostors and tinted by player.
+
+static texture* CreateImpostorTexture()
+{
+	const int size = 16;
+	image img(size, size);
+	for (int y = 0; y < size; ++y)
+		for (int x = 0; x < size; ++x)
+		{
+			glm::vec2 d = glm::vec2(x, y) + 0.5f - 0.5f * size;
+			float a = glm::clamp(1.5f - glm::length(d) / (0.25f * size), 0.0f, 1.0f);
+			img.set_pixel(x, y, glm::vec4(a, a, a, a));
+		}
+
+	texture* result = new texture(img);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	CHECK_ERROR_GL();
+	return result;
+}
+
+
 BattleView::BattleView(Surface* screen, BattleModel* battleModel, renderers* r) : TerrainView(screen, battleModel->terrainSurface),
 _renderers(r),
 _battleModel(battleModel),
 _lightNormal(),
 _billboardTexture(nullptr),
 _billboardModel(nullptr),
+_heightTexture(nullptr),
+_smoothTerrainForest(nullptr),
 _textureBillboardRenderer(nullptr),
 _textureBillboardRenderer1(nullptr),
 _textureBillboardRenderer2(nullptr),
@@ -56,16 +85,22 @@ _gradientTriangleRenderer(nullptr),
 _gradientTriangleStripRenderer(nullptr),
 _colorBillboardRenderer(nullptr),
 _textureTriangleRenderer(nullptr),
+_terrainLineRenderer(nullptr),
+_textureColorRenderer(nullptr),
 _textureUnitMarkers(nullptr),
 _textureTouchMarker(nullptr),
 _textureFacing(nullptr),
+_textureImpostor(nullptr),
+_renderScale(1),
 _smoothTerrainSurface(nullptr),
 _terrainSurfaceRendererTiled(nullptr),
-_player(PlayerNone)
+_player(PlayerNone),
+_impostorFighterSize(3)
 {
 	_textureUnitMarkers = new texture(resource("Textures/Texture256x256.png"));
 	_textureTouchMarker = new texture(resource("Textures/TouchMarker.png"));
 	_textureFacing = new texture(resource("Textures/Facing.png"));
+	_textureImpostor = CreateImpostorTexture();
 
 	SetContentBounds(_terrainSurface->GetBounds());
 
@@ -142,6 +177,15 @@ _player(PlayerNone)
 	_billboardTexture->SetTexCoords(_billboardModel->_billboardShapeFighterCavRed, 315, billboard_texcoords(7, 2, true));
 
 
+	_billboardModel->terrainShapes.push_back(_billboardModel->_billboardShapeFighterSamBlue);
+	_billboardModel->terrainShapes.push_back(_billboardModel->_billboardShapeFighterSamRed);
+	_billboardModel->terrainShapes.push_back(_billboardModel->_billboardShapeFighterAshBlue);
+	_billboardModel->terrainShapes.push_back(_billboardModel->_billboardShapeFighterAshRed);
+	_billboardModel->terrainShapes.push_back(_billboardModel->_billboardShapeFighterCavBlue);
+	_billboardModel->terrainShapes.push_back(_billboardModel->_billboardShapeFighterCavRed);
+	_billboardModel->terrainElevation = 0.5f - 2.0f / 64.0f; // place texture 2 texels below ground
+
+
 	for (int i = 0; i < 8; ++i)
 	{
 		_billboardModel->_billboardShapeSmoke[i] = _billboardTexture->AddShape(1);
@@ -161,6 +205,8 @@ _player(PlayerNone)
 	_gradientTriangleStripRenderer = new GradientTriangleStripRenderer();
 	_colorBillboardRenderer = new ColorBillboardRenderer();
 	_textureTriangleRenderer = new TextureTriangleRenderer();
+	_terrainLineRenderer = new TerrainLineRenderer();
+	_textureColorRenderer = new TextureColorRenderer();
 }
 
 
@@ -178,9 +224,12 @@ BattleView::~BattleView()
 	delete _textureUnitMarkers;
 	delete _textureTouchMarker;
 	delete _textureFacing;
+	delete _textureImpostor;
 
 	delete _billboardTexture;
 	delete _billboardModel;
+	delete _heightTexture;
+	delete _smoothTerrainForest;
 
 	delete _textureBillboardRenderer;
 	delete _textureBillboardRenderer1;
@@ -193,6 +242,8 @@ BattleView::~BattleView()
 	delete _gradientTriangleStripRenderer;
 	delete _colorBillboardRenderer;
 	delete _textureTriangleRenderer;
+	delete _terrainLineRenderer;
+	delete _textureColorRenderer;
 }
 
 
@@ -215,14 +266,16 @@ void BattleView::AddCasualty(const Casualty& casualty)
 }
 
 
-static float random_float()
-{
-	return (float)(rand() & 0x7fff) / 0x7fff;
-}
-
-
 void BattleView::Initialize()
 {
+	if (HeightTexture::IsSupported())
+	{
+		TerrainSurface* terrainSurface = _terrainSurface;
+		_heightTexture = new HeightTexture([terrainSurface](glm::vec2 p) { return terrainSurface->GetHeight(p); }, _terrainSurface->GetBounds(), 512);
+		_heightTexture->Update();
+		_billboardModel->heightTexture = _heightTexture;
+	}
+
 	InitializeTerrainTrees();
 
 	InitializeCameraPosition(_battleModel->units);
@@ -231,82 +284,30 @@ void BattleView::Initialize()
 
 void BattleView::InitializeTerrainTrees()
 {
-	UpdateTerrainTrees(_terrainSurface->GetBounds());
-}
-
-
-struct random_generator
-{
-	int _count;
-	float* _values;
-
-	random_generator(int count) : _count(count), _values(new float [count])
-	{
-		for (int i = 0; i < count; ++i)
-			_values[i] = random_float();
-	}
-};
+	delete _smoothTerrainForest;
+	_smoothTerrainForest = nullptr;
+	_billboardModel->staticBillboards.clear();
+	++_billboardModel->staticVersion;
 
-struct random_iterator
-{
-	const random_generator& _gen;
-	int _index;
-	random_iterator(const random_generator& gen) : _gen(gen), _index(0) { }
-	float next()
-	{
-		float result = _gen._values[_index++];
-		if (_index == _gen._count)
-			_index = 0;
-		return result;
-	}
-};
+	if (_smoothTerrainSurface != nullptr)
+		_smoothTerrainForest = new SmoothTerrainForest(_terrainSurface, _billboardModel->_billboardTreeShapes);
+}
 
 
 void BattleView::UpdateTerrainTrees(bounds2f bounds)
 {
-	if (_smoothTerrainSurface != nullptr)
-	{
-		auto pos2 = std::remove_if(_billboardModel->staticBillboards.begin(), _billboardModel->staticBillboards.end(), [bounds](const Billboard& billboard) {
-			return bounds.contains(billboard.position.xy());
-		});
-		_billboardModel->staticBillboards.erase(pos2, _billboardModel->staticBillboards.end());
-
-
-		static random_generator* _randoms = nullptr;
-		if (_randoms == nullptr)
-			_randoms = new random_generator(997);
+	if (_smoothTerrainForest != nullptr)
+		_smoothTerrainForest->Update(bounds);
+}
 
-		int treeType = 0;
-		random_iterator random(*_randoms);
-		bounds2f mapbounds = _terrainSurface->GetBounds();
-		glm::vec2 center = mapbounds.center();
-		float radius = mapbounds.width() / 2;
 
-		float d = 5 * mapbounds.width() / 1024;
-		for (float x = mapbounds.min.x; x < mapbounds.max.x; x += d)
-			for (float y = mapbounds.min.y; y < mapbounds.max.y; y += d)
-			{
-				float dx = d * (random.next() - 0.5f);
-				float dy = d * (random.next() - 0.5f);
-				int shape = (int)(15 * random.next()) & 15;
-
-				glm::vec2 position = glm::vec2(x + dx, y + dy);
-				if (bounds.contains(position) && glm::distance(position, center) < radius)
-				{
-					if (_terrainSurface->GetHeight(position) > 0 && _terrainSurface->IsForest(position))
-					{
-						const float adjust = 0.5 - 2.0 / 64.0; // place texture 2 texels below ground
-						_billboardModel->staticBillboards.push_back(Billboard(GetPosition(position, adjust * 5), 0, 5, _billboardModel->_billboardTreeShapes[shape]));
-					}
-				}
-
-				++treeType;
-			}
-	}
+void BattleView::UpdateTerrainHeights(bounds2f bounds)
+{
+	if (_heightTexture != nullptr)
+		_heightTexture->Update(bounds);
 }
 
 
-
 void BattleView::InitializeCameraPosition(const std::map<int, Unit*>& units)
 {
 	glm::vec2 friendlyCenter;
@@ -348,7 +349,14 @@ void BattleView::InitializeCameraPosition(const std::map<int, Unit*>& units)
 
 void BattleView::Render()
 {
-	UseViewport();
+	bounds2f viewport = GetViewportBounds() * (GetSurface()->GetPixelDensity() * _renderScale);
+	glViewport((GLint)viewport.min.x, (GLint)viewport.min.y, (GLsizei)viewport.size().x, (GLsizei)viewport.size().y);
+
+	// billboard sizes are in pixels of the framebuffer
+	float viewportHeight = _renderScale * GetViewportBounds().height();
+
+	_viewFrustum = frustum(GetTransform());
+	profiler::shared().reset("cull.");
 
 	glm::vec2 facing = vector2_from_angle(GetCameraFacing() - 2.5f * (float)M_PI_4);
 	_lightNormal = glm::normalize(glm::vec3(facing, -1));
@@ -383,45 +391,98 @@ void BattleView::Render()
 		_battleModel->terrainWater->Render(GetTransform());
 
 
-	// Fighter Weapons
+	// Forest Canopy
 
 	glDepthMask(false);
-	_plainLineRenderer->Reset();
+	if (_smoothTerrainForest != nullptr)
+		_smoothTerrainForest->RenderCanopy(GetTransform());
+
+
+	// Formation Impostors
+
+	UpdateUnitCounters();
+
+	_textureColorRenderer->Reset();
 	for (UnitCounter* marker : _battleModel->_unitMarkers)
-		marker->AppendFighterWeapons(_plainLineRenderer);
-	_plainLineRenderer->Draw(GetTransform(), glm::vec4(0.4, 0.4, 0.4, 0.6));
+		if (marker->_visible)
+			marker->AppendFormationImpostor(_textureColorRenderer);
+	_textureColorRenderer->Draw(GetTransform(), _textureImpostor);
+
+
+	// Fighter Weapons
+
+	BuildFighterBuffers();
+
+	if (_heightTexture != nullptr)
+	{
+		_terrainLineRenderer->Reset();
+		for (UnitCounter* marker : _battleModel->_unitMarkers)
+			if (marker->_visible)
+				marker->AppendFighterWeapons(_terrainLineRenderer);
+		_terrainLineRenderer->Draw(GetTransform(), glm::vec4(0.4, 0.4, 0.4, 0.6), _heightTexture, 1);
+	}
+	else
+	{
+		_plainLineRenderer->Reset();
+		for (const FighterBuffer& buffer : _fighterBuffers)
+			for (size_t i = 0; i + 1 < buffer.weapons.size(); i += 2)
+				_plainLineRenderer->AddLine(buffer.weapons[i], buffer.weapons[i + 1]);
+		_plainLineRenderer->Draw(GetTransform(), glm::vec4(0.4, 0.4, 0.4, 0.6));
+	}
 
 
 	// Color Billboards
 
 	_colorBillboardRenderer->Reset();
-	_casualtyMarker->RenderCasualtyColorBillboards(_colorBillboardRenderer);
-	_colorBillboardRenderer->Draw(GetTransform(), GetCameraUpVector(), GetViewportBounds().height());
+	_casualtyMarker->RenderCasualtyColorBillboards(_colorBillboardRenderer, _viewFrustum);
+	_colorBillboardRenderer->Draw(GetTransform(), GetCameraUpVector(), viewportHeight);
 
 
 	// Texture Billboards
 
 	_billboardModel->dynamicBillboards.clear();
-	_casualtyMarker->AppendCasualtyBillboards(_billboardModel);
-	for (UnitCounter* marker : _battleModel->_unitMarkers)
-		marker->AppendFighterBillboards(_billboardModel);
+	_billboardModel->terrainBillboards.clear();
+
+	if (_smoothTerrainForest != nullptr)
+	{
+		int canopyCulled = _smoothTerrainForest->UpdateTreeBillboards(GetCameraPosition(), _viewFrustum, _billboardModel);
+		profiler::shared().add_count("cull.canopy.total", canopyCulled + _smoothTerrainForest->GetCanopyPatchCount());
+		profiler::shared().add_count("cull.canopy.culled", canopyCulled);
+	}
+
+	size_t count = _billboardModel->dynamicBillboards.size();
+	int culled = _casualtyMarker->AppendCasualtyBillboards(_billboardModel, _viewFrustum);
+	profiler::shared().add_count("cull.casualties.total", culled + (int)(_billboardModel->dynamicBillboards.size() - count));
+	profiler::shared().add_count("cull.casualties.culled", culled);
+
+	for (const FighterBuffer& buffer : _fighterBuffers)
+	{
+		_billboardModel->dynamicBillboards.insert(_billboardModel->dynamicBillboards.end(), buffer.billboards.begin(), buffer.billboards.end());
+		_billboardModel->terrainBillboards.insert(_billboardModel->terrainBillboards.end(), buffer.terrainBillboards.begin(), buffer.terrainBillboards.end());
+	}
+
+	count = _billboardModel->dynamicBillboards.size();
+	culled = 0;
 	for (SmokeCounter* marker : _battleModel->_smokeMarkers)
-		marker->AppendSmokeBillboards(_billboardModel);
-	_textureBillboardRenderer->Render(_billboardModel, GetTransform(), GetCameraUpVector(), glm::degrees(GetCameraFacing()), GetViewportBounds().height(), GetFlip());
+		culled += marker->AppendSmokeBillboards(_billboardModel, _viewFrustum);
+	profiler::shared().add_count("cull.smoke.total", culled + (int)(_billboardModel->dynamicBillboards.size() - count));
+	profiler::shared().add_count("cull.smoke.culled", culled);
+
+	_textureBillboardRenderer->Render(_billboardModel, GetTransform(), GetCameraUpVector(), glm::degrees(GetCameraFacing()), viewportHeight, GetFlip());
 
 
 	// Range Markers
 
+	_gradientTriangleStripRenderer->Reset();
 	for (std::pair<int, Unit*> item : _battleModel->units)
 	{
 		if (item.second->player == _player)
 		{
 			RangeMarker marker(_battleModel, item.second);
-			_gradientTriangleStripRenderer->Reset();
 			marker.Render(_gradientTriangleStripRenderer);
-			_gradientTriangleStripRenderer->Draw(GetTransform());
 		}
 	}
+	_gradientTriangleStripRenderer->Draw(GetTransform());
 
 
 	// Unit Facing Markers
@@ -430,10 +491,10 @@ void BattleView::Render()
 	_textureTriangleRenderer->Reset();
 
 	for (UnitCounter* marker : _battleModel->_unitMarkers)
-		if (marker->GetUnit()->player == _player)
+		if (marker->GetUnit()->player == _player && IsMarkerVisible(marker->GetUnit()->state.center))
 			marker->AppendFacingMarker(_textureTriangleRenderer, this);
 	for (UnitMovementMarker* marker : _movementMarkers)
-		if (marker->GetUnit()->player == _player)
+		if (marker->GetUnit()->player == _player && IsMarkerVisible(marker->GetUnit()->command.GetDestination()))
 			marker->AppendFacingMarker(_textureTriangleRenderer, this);
 	for (UnitTrackingMarker* marker : _trackingMarkers)
 		if (marker->GetUnit()->player == _player)
@@ -448,48 +509,67 @@ void BattleView::Render()
 	_textureBillboardRenderer1->Reset();
 	_textureBillboardRenderer2->Reset();
 
+	culled = 0;
 	for (UnitCounter* marker : _battleModel->_unitMarkers)
-		marker->AppendUnitMarker(_textureBillboardRenderer1, _textureBillboardRenderer2, GetFlip());
+	{
+		if (IsMarkerVisible(marker->GetUnit()->state.center))
+			marker->AppendUnitMarker(_textureBillboardRenderer1, _textureBillboardRenderer2, GetFlip());
+		else
+			++culled;
+	}
 	for (UnitMovementMarker* marker : _movementMarkers)
-		marker->RenderMovementMarker(_textureBillboardRenderer1);
+	{
+		if (IsMarkerVisible(marker->GetUnit()->command.GetDestination()))
+			marker->RenderMovementMarker(_textureBillboardRenderer1);
+		else
+			++culled;
+	}
+	profiler::shared().add_count("cull.markers.total", (int)(_battleModel->_unitMarkers.size() + _movementMarkers.size()));
+	profiler::shared().add_count("cull.markers.culled", culled);
 	for (UnitTrackingMarker* marker : _trackingMarkers)
 		marker->RenderTrackingMarker(_textureBillboardRenderer1);
 
 	bounds1f sizeLimit = GetUnitIconSizeLimit();
-	_textureBillboardRenderer1->Draw(_textureUnitMarkers, GetTransform(), GetCameraUpVector(), glm::degrees(GetCameraFacing()), GetViewportBounds().height(), sizeLimit);
-	_textureBillboardRenderer2->Draw(_textureUnitMarkers, GetTransform(), GetCameraUpVector(), glm::degrees(GetCameraFacing()), GetViewportBounds().height(), sizeLimit);
+	_textureBillboardRenderer1->Draw(_textureUnitMarkers, GetTransform(), GetCameraUpVector(), glm::degrees(GetCameraFacing()), viewportHeight, sizeLimit * _renderScale);
+	_textureBillboardRenderer2->Draw(_textureUnitMarkers, GetTransform(), GetCameraUpVector(), glm::degrees(GetCameraFacing()), viewportHeight, sizeLimit * _renderScale);
 
 
 	// Tracking Markers
 
 	glDisable(GL_DEPTH_TEST);
+	_textureBillboardRenderer1->Reset();
 	for (UnitTrackingMarker* marker : _trackingMarkers)
-	{
-		_textureBillboardRenderer1->Reset();
 		marker->RenderTrackingShadow(_textureBillboardRenderer1);
-		_textureBillboardRenderer1->Draw(_textureTouchMarker, GetTransform(), GetCameraUpVector(), glm::degrees(GetCameraFacing()), GetViewportBounds().height(), bounds1f(64, 64));
-	}
+	_textureBillboardRenderer1->Draw(_textureTouchMarker, GetTransform(), GetCameraUpVector(), glm::degrees(GetCameraFacing()), viewportHeight, bounds1f(64, 64) * _renderScale);
 
 
 	// Movement Paths
 
 	glEnable(GL_DEPTH_TEST);
 	_gradientTriangleRenderer->Reset();
+	culled = 0;
 	for (UnitMovementMarker* marker : _movementMarkers)
-		marker->RenderMovementPath(_gradientTriangleRenderer);
+	{
+		if (IsMovementVisible(marker->GetUnit()))
+			marker->RenderMovementPath(_gradientTriangleRenderer);
+		else
+			++culled;
+	}
+	profiler::shared().add_count("cull.paths.total", (int)_movementMarkers.size());
+	profiler::shared().add_count("cull.paths.culled", culled);
 	_gradientTriangleRenderer->Draw(GetTransform());//, glm::vec4(0.5, 0.5, 1, 0.25));
 
 
 	// Tracking Path
 
 	glDisable(GL_DEPTH_TEST);
+	_gradientTriangleRenderer->Reset();
 	for (UnitTrackingMarker* marker : _trackingMarkers)
 	{
-		_gradientTriangleRenderer->Reset();
 		marker->RenderTrackingPath(_gradientTriangleRenderer);
 		marker->RenderOrientation(_gradientTriangleRenderer);
-		_gradientTriangleRenderer->Draw(GetTransform());
 	}
+	_gradientTriangleRenderer->Draw(GetTransform());
 
 
 	// Tracking Fighters
@@ -498,15 +578,16 @@ void BattleView::Render()
 	_colorBillboardRenderer->Reset();
 	for (UnitTrackingMarker* marker : _trackingMarkers)
 		marker->RenderTrackingFighters(_colorBillboardRenderer);
-	_colorBillboardRenderer->Draw(GetTransform(), GetCameraUpVector(), GetViewportBounds().height());
+	_colorBillboardRenderer->Draw(GetTransform(), GetCameraUpVector(), viewportHeight);
 
 
 	// Movement Fighters
 
 	_colorBillboardRenderer->Reset();
 	for (UnitMovementMarker* marker : _movementMarkers)
-		marker->RenderMovementFighters(_colorBillboardRenderer);
-	_colorBillboardRenderer->Draw(GetTransform(), GetCameraUpVector(), GetViewportBounds().height());
+		if (IsMovementVisible(marker->GetUnit()))
+			marker->RenderMovementFighters(_colorBillboardRenderer);
+	_colorBillboardRenderer->Draw(GetTransform(), GetCameraUpVector(), viewportHeight);
 
 
 	// Shooting Counters
@@ -529,6 +610,112 @@ void BattleView::Render()
 }
 
 
+// Size in pixels of a vertical line on screen, at a position in the world.
+
+float BattleView::GetScreenSize(glm::vec3 position, float size)
+{
+	glm::mat4x4 transform = GetTransform();
+	glm::vec4 p = transform * glm::vec4(position, 1);
+	glm::vec4 q = transform * glm::vec4(position + size * GetCameraUpVector(), 1);
+
+	return 0.5f * GetViewportBounds().height() * glm::abs(q.y / q.w - p.y / p.w);
+}
+
+
+// Unit markers are billboards of a limited size on screen, with the facing
+// marker beside them.
+
+bool BattleView::IsMarkerVisible(glm::vec2 center)
+{
+	glm::vec3 position = GetPosition(center, 0);
+	if ((GetTransform() * glm::vec4(position, 1)).w <= 0)
+		return false;
+
+	bounds2f bounds = GetBillboardBounds(position, 32);
+	return GetViewportBounds().intersects(bounds.grow(bounds.height()));
+}
+
+
+// The path with the fighters at its end, as far as the formation reaches.
+
+bool BattleView::IsMovementVisible(Unit* unit)
+{
+	const std::vector<glm::vec2>& path = unit->command.path;
+	bounds2f bounds(unit->state.center, unit->state.center);
+	bounds1f heights(GetPosition(unit->state.center, 0).z);
+	for (glm::vec2 p : path)
+	{
+		bounds.min = glm::min(bounds.min, p);
+		bounds.max = glm::max(bounds.max, p);
+		float h = GetPosition(p, 0).z;
+		heights.min = glm::min(heights.min, h);
+		heights.max = glm::max(heights.max, h);
+	}
+
+	const Formation& formation = unit->formation;
+	float reach = glm::length(formation.towardRight) * formation.numberOfFiles + glm::length(formation.towardBack) * formation.numberOfRanks;
+
+	return _viewFrustum.intersects(bounds3f(bounds.grow(reach), bounds1f(heights.min - 5, heights.max + 8)));
+}
+
+
+// Far from the camera, each fighter covers a pixel or less, and the unit is
+// drawn as one impostor instead, at a cost that does not grow with the
+// number of fighters. Units outside the view are neither.
+
+void BattleView::UpdateUnitCounters()
+{
+	int culled = 0;
+	for (UnitCounter* marker : _battleModel->_unitMarkers)
+	{
+		marker->_visible = _viewFrustum.intersects(marker->GetFighterBounds());
+		if (!marker->_visible)
+		{
+			++culled;
+			continue;
+		}
+
+		Unit* unit = marker->GetUnit();
+		float size = GetScreenSize(GetPosition(unit->state.center, 0), 2);
+		marker->_impostorBlend = glm::clamp(2 - size / _impostorFighterSize, 0.0f, 1.0f);
+	}
+
+	profiler::shared().add_count("cull.units.total", (int)_battleModel->_unitMarkers.size());
+	profiler::shared().add_count("cull.units.culled", culled);
+}
+
+
+// Fighters are the bulk of what is drawn, and are appended in parallel.
+// Terrain heights are read-only here, and the buffers are concatenated in
+// counter order, so the result is the same as appending them one by one.
+// Weapons drawn with the height texture are plain copies and are left to
+// the terrain line renderer.
+
+void BattleView::BuildFighterBuffers()
+{
+	const std::vector<UnitCounter*>& markers = _battleModel->_unitMarkers;
+	const int grain = 4;
+	bool weapons = _heightTexture == nullptr;
+
+	_fighterBuffers.resize((markers.size() + grain - 1) / grain);
+	thread_pool::shared().parallel_for(0, (int)markers.size(), grain, [this, &markers, grain, weapons](int first, int last) {
+		FighterBuffer& buffer = _fighterBuffers[first / grain];
+		buffer.weapons.clear();
+		buffer.billboards.clear();
+		buffer.terrainBillboards.clear();
+
+		for (int i = first; i < last; ++i)
+		{
+			if (!markers[i]->_visible)
+				continue;
+			if (weapons)
+				markers[i]->AppendFighterWeapons(buffer.weapons);
+			markers[i]->AppendFighterBillboards(_billboardModel, buffer.billboards, buffer.terrainBillboards);
+		}
+	});
+}
+
+
 template <class T> void AnimateMarkers(std::vector<T*>& markers, float seconds)
 {
 	size_t index = 0;
@@ -26,6 +26,9 @@ class PlainLineRenderer;
 class PlainTriangleRenderer;
 class RangeMarker;
 class ShootingCounter;
+class SmoothTerrainForest;
+class TerrainLineRenderer;
+class TextureColorRenderer;
 class TextureTriangleRenderer;
 class UnitTrackingMarker;
 class UnitCounter;
@@ -40,6 +43,8 @@ class BattleView : public TerrainView, public SimulationListener
 
 	BillboardTexture* _billboardTexture;
 	BillboardModel* _billboardModel;
+	HeightTexture* _heightTexture;
+	SmoothTerrainForest* _smoothTerrainForest;
 	TextureBillboardRenderer* _textureBillboardRenderer;
 	TextureBillboardRenderer* _textureBillboardRenderer1;
 	TextureBillboardRenderer* _textureBillboardRenderer2;
@@ -55,16 +60,35 @@ class BattleView : public TerrainView, public SimulationListener
 	GradientTriangleStripRenderer* _gradientTriangleStripRenderer;
 	ColorBillboardRenderer* _colorBillboardRenderer;
 	TextureTriangleRenderer* _textureTriangleRenderer;
+	TerrainLineRenderer* _terrainLineRenderer;
+	TextureColorRenderer* _textureColorRenderer;
 
 	texture* _textureUnitMarkers;
 	texture* _textureTouchMarker;
 	texture* _textureFacing;
+	texture* _textureImpostor;
+
+	frustum _viewFrustum; // of the current frame
+	float _renderScale;
+
+	// fighter weapons and billboards, one buffer per range of unit counters
+	struct FighterBuffer
+	{
+		std::vector<glm::vec3> weapons;
+		std::vector<Billboard> billboards;
+		std::vector<terrain_billboard_vertex> terrainBillboards;
+	};
+	std::vector<FighterBuffer> _fighterBuffers;
 
 public:
 	SmoothTerrainSurface* _smoothTerrainSurface;
 	TiledTerrainSurfaceRenderer* _terrainSurfaceRendererTiled;
 	Player _player;
 
+	// units whose fighters are drawn smaller than this, in pixels, are drawn
+	// as formation impostors, crossfading up to twice the size
+	float _impostorFighterSize;
+
 	BattleView(Surface* screen, BattleModel* battleModel, renderers* r);
 	~BattleView();
 
@@ -87,9 +111,15 @@ public:
 
 	void InitializeTerrainTrees();
 	void UpdateTerrainTrees(bounds2f bounds);
+	void UpdateTerrainHeights(bounds2f bounds);
 
 	void InitializeCameraPosition(const std::map<int, Unit*>& units);
 
+	// Fraction of the surface resolution that Render draws at, from the
+	// bottom left corner of the framebuffer.
+	float GetRenderScale() const { return _renderScale; }
+	void SetRenderScale(float value) { _renderScale = value; }
+
 	virtual void Render();
 	virtual void Update(double secondsSinceLastUpdate);
 
@@ -103,6 +133,13 @@ public:
 	bounds2f GetUnitFutureFacingMarkerBounds(Unit* unit);
 
 	bounds1f GetUnitIconSizeLimit() const;
+
+private:
+	float GetScreenSize(glm::vec3 position, float size);
+	bool IsMarkerVisible(glm::vec2 center);
+	bool IsMovementVisible(Unit* unit);
+	void UpdateUnitCounters();
+	void BuildFighterBuffers();
 };
 
 
@@ -36,7 +36,7 @@ bool CasualtyMarker::Animate(float seconds)
 
 
 
-void CasualtyMarker::RenderCasualtyColorBillboards(ColorBillboardRenderer* renderer)
+void CasualtyMarker::RenderCasualtyColorBillboards(ColorBillboardRenderer* renderer, const frustum& view)
 {
 	if (casualties.empty())
 		return;
@@ -47,7 +47,7 @@ void CasualtyMarker::RenderCasualtyColorBillboards(ColorBillboardRenderer* rende
 
 	for (const CasualtyMarker::Casualty& casualty : casualties)
 	{
-		if (casualty.time <= 1)
+		if (casualty.time <= 1 && view.intersects(casualty.position, 1))
 		{
 			glm::vec4 c = glm::mix(c1, casualty.player == Player1 ? cb : cr, casualty.time);
 			renderer->AddBillboard(casualty.position, c, 6.0);
@@ -56,10 +56,17 @@ void CasualtyMarker::RenderCasualtyColorBillboards(ColorBillboardRenderer* rende
 }
 
 
-void CasualtyMarker::AppendCasualtyBillboards(BillboardModel* billboardModel)
+int CasualtyMarker::AppendCasualtyBillboards(BillboardModel* billboardModel, const frustum& view)
 {
+	int culled = 0;
 	for (const CasualtyMarker::Casualty& casualty : casualties)
 	{
+		if (!view.intersects(casualty.position, 3))
+		{
+			++culled;
+			continue;
+		}
+
 		int shape = 0;
 		float height = 0;
 		//int j = 0, i = 0;
@@ -89,6 +96,7 @@ void CasualtyMarker::AppendCasualtyBillboards(BillboardModel* billboardModel)
 		const float adjust = 0.5 - 2.0 / 64.0; // place texture 2 texels below ground
 		glm::vec3 p = _battleModel->terrainSurface->GetPosition(casualty.position.xy(), adjust * height);
 		billboardModel->dynamicBillboards.push_back(Billboard(p, 0, height, shape));
-
 	}
+
+	return culled;
 }
@@ -9,6 +9,7 @@
 #include "../BattleModel/BattleModel.h"
 class ColorBillboardRenderer;
 class BillboardModel;
+struct frustum;
 
 
 class CasualtyMarker
@@ -36,8 +37,10 @@ public:
 	void AddCasualty(glm::vec3 position, Player player, UnitPlatform platform);
 	bool Animate(float seconds);
 
-	void RenderCasualtyColorBillboards(ColorBillboardRenderer* renderer);
-	void AppendCasualtyBillboards(BillboardModel* billboardModel);
+	// Casualties outside the view are skipped, and the append returns how
+	// many were.
+	void RenderCasualtyColorBillboards(ColorBillboardRenderer* renderer, const frustum& view);
+	int AppendCasualtyBillboards(BillboardModel* billboardModel, const frustum& view);
 };
 
 
@@ -47,7 +47,7 @@ void RangeMarker::RenderMissileRange(GradientTriangleStripRenderer* renderer, gl
 	for (int i = 0; i <= 8; ++i)
 	{
 		float t = i / 8.0f;
-		renderer->AddVertex(GetPosition(position + glm::mix(p3, p5, t)), c0);
+		renderer->AddVertex(GetPosition(position + glm::mix(p3, p5, t)), c0, i == 0);
 		renderer->AddVertex(GetPosition(position + glm::mix(p1, p2, t)), c1);
 	}
 
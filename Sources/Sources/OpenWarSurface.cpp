@@ -10,21 +10,26 @@
 #include "../Library/ViewExtra/ButtonGesture.h"
 #include "TerrainView/EditorGesture.h"
 #include "Simulator/BattleSimulator.h"
+#include "Simulator/SimulationThread.h"
 #include "../Library/Audio/SoundPlayer.h"
 #include "TerrainView/TerrainGesture.h"
 #include "TerrainSurface/TiledTerrainSurface.h"
 #include "BattleModel/UnitCounter.h"
 #include "../Library/Renderers/GradientRenderer.h"
+#include "../Library/Renderers/DynamicResolution.h"
 
 
 
 OpenWarSurface::OpenWarSurface(glm::vec2 size, float pixelDensity) : Surface(size, pixelDensity),
 _mode(Mode::None),
 _battleScript(nullptr),
+_simulationThread(nullptr),
+_battleModel(nullptr),
 _battleView(nullptr),
 _renderers(nullptr),
 _buttonRendering(nullptr),
 _editorModel(nullptr),
+_editable(false),
 _buttonsTopLeft(nullptr),
 _buttonsTopRight(nullptr),
 _terrainGesture(nullptr),
@@ -39,7 +44,8 @@ _buttonItemHills(nullptr),
 _buttonItemTrees(nullptr),
 _buttonItemWater(nullptr),
 _buttonItemFords(nullptr),
-_scriptHintRenderer(nullptr)
+_scriptHintRenderer(nullptr),
+_dynamicResolution(nullptr)
 {
 	SoundPlayer::Initialize();
 	SoundPlayer::singleton->Pause();
@@ -87,6 +93,7 @@ _scriptHintRenderer(nullptr)
 	UpdateButtonsAndGestures();
 
 	_scriptHintRenderer = new GradientLineRenderer();
+	_dynamicResolution = new DynamicResolution();
 }
 
 
@@ -122,6 +129,12 @@ void OpenWarSurface::Reset(BattleScript* battleScript)
 	delete _battleView;
 	_battleView = nullptr;
 
+	delete _battleModel;
+	_battleModel = nullptr;
+
+	delete _simulationThread;
+	_simulationThread = nullptr;
+
 	delete _battleScript;
 	_battleScript = nullptr;
 
@@ -129,8 +142,26 @@ void OpenWarSurface::Reset(BattleScript* battleScript)
 
 	_battleScript = battleScript;
 
-	battleScript->GetBattleModel()->bluePlayer = Player1;
-	_battleView = new BattleView(this, battleScript->GetBattleModel(), _renderers);
+	BattleModel* battleModel = battleScript->GetBattleModel();
+	battleModel->bluePlayer = Player1;
+
+	if (battleScript->GetBattleSimulator() != nullptr)
+		battleScript->GetBattleSimulator()->currentPlayer = Player1;
+
+	// The view has a battle model of its own, kept up to date by the
+	// simulation thread, and shares the terrain with the script's model.
+	_battleModel = new BattleModel();
+	_battleModel->bluePlayer = Player1;
+	_battleModel->timeStep = battleModel->timeStep;
+	_battleModel->terrainSurface = battleModel->terrainSurface;
+	_battleModel->terrainForest = battleModel->terrainForest;
+	_battleModel->terrainWater = battleModel->terrainWater;
+	_battleModel->terrainSky = battleModel->terrainSky;
+
+	_simulationThread = new SimulationThread(battleScript);
+	_simulationThread->Synchronize(_battleModel);
+
+	_battleView = new BattleView(this, _battleModel, _renderers);
 	_battleView->_player = Player1;
 
 	SmoothTerrainSurface* smoothTerrainSurface = dynamic_cast<SmoothTerrainSurface*>(battleScript->GetBattleModel()->terrainSurface);
@@ -140,12 +171,16 @@ void OpenWarSurface::Reset(BattleScript* battleScript)
 		_battleView->_smoothTerrainSurface->EnableRenderEdges();
 	}
 
+	// terrain edges are found in the depth of the battle's framebuffer
+	_dynamicResolution->sampleableDepth = smoothTerrainSurface != nullptr;
+
 	TiledTerrainSurface* terrainSurfaceModelTiled = dynamic_cast<TiledTerrainSurface*>(battleScript->GetBattleModel()->terrainSurface);
 	if (terrainSurfaceModelTiled != nullptr)
 		_battleView->_terrainSurfaceRendererTiled = new TiledTerrainSurfaceRenderer(terrainSurfaceModelTiled);
 
 	_battleView->Initialize();
 
+	_editable = smoothTerrainSurface == nullptr || smoothTerrainSurface->IsEditable();
 	_editorModel = new EditorModel(_battleView, _battleView->_smoothTerrainSurface);
 	_editorGesture = new EditorGesture(_battleView, _editorModel);
 
@@ -156,11 +191,7 @@ void OpenWarSurface::Reset(BattleScript* battleScript)
 	//_mode = Mode::Playing;
 	UpdateButtonsAndGestures();
 
-	if (battleScript->GetBattleSimulator() != nullptr)
-	{
-		battleScript->GetBattleSimulator()->listener = _battleView;
-		battleScript->GetBattleSimulator()->currentPlayer = Player1;
-	}
+	_simulationThread->listener = _battleView;
 }
 
 
@@ -176,11 +207,12 @@ void OpenWarSurface::ScreenSizeChanged()
 
 void OpenWarSurface::Update(double secondsSinceLastUpdate)
 {
+	if (_simulationThread != nullptr)
+		_simulationThread->Synchronize(_battleModel);
+
 	if (_mode == Mode::Playing)
-	{
-		_battleScript->Tick(secondsSinceLastUpdate);
 		UpdateSoundPlayer();
-	}
+
 	if (_battleView != nullptr)
 	{
 		_battleView->Update(secondsSinceLastUpdate);
@@ -197,20 +229,37 @@ bool OpenWarSurface::NeedsRender() const
 
 void OpenWarSurface::Render()
 {
+	glstate::shared().frame();
+	vertexstream::shared()->frame();
+
+	if (_editorModel != nullptr)
+		_editorModel->UpdateChanges();
+
+	// The battle is drawn at the dynamic resolution, the buttons at the
+	// surface resolution.
+	_dynamicResolution->BeginFrame(glm::ivec2(GetSize() * GetPixelDensity()));
+
 	glClearColor(0.9137f, 0.8666f, 0.7647f, 1.0f);
 	glClearDepth(1.0f);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	glEnable(GL_BLEND);
+	glstate::shared().enable_blend(true);
 
 	if (_battleView != nullptr)
 	{
+		_battleView->SetRenderScale(_dynamicResolution->GetScale());
+		if (_battleView->_smoothTerrainSurface != nullptr)
+			_battleView->_smoothTerrainSurface->SetEdgeDepth(_dynamicResolution->GetFramebuffer(), _dynamicResolution->GetColorFramebuffer(), _dynamicResolution->GetDepthTexture(), _dynamicResolution->GetBufferSize());
 		_battleView->Render();
 
-		if (_battleScript != nullptr)
+		if (_simulationThread != nullptr)
 		{
+			const std::vector<glm::vec3>& hints = _simulationThread->GetSnapshot().hints;
+			glm::vec4 c(0, 0, 0, 0.5f);
+
 			_scriptHintRenderer->Reset();
-			_battleScript->RenderHints(_scriptHintRenderer);
+			for (size_t i = 0; i + 1 < hints.size(); i += 2)
+				_scriptHintRenderer->AddLine(hints[i], hints[i + 1], c, c);
 			_scriptHintRenderer->Draw(_battleView->GetTransform());
 		}
 	}
@@ -218,6 +267,10 @@ void OpenWarSurface::Render()
 	if (_battleGesture == nullptr)
 		_battleGesture->RenderHints();
 
+	_dynamicResolution->EndFrame();
+
+	glstate::shared().enable_blend(true);
+
 	_buttonsTopLeft->Render();
 	_buttonsTopRight->Render();
 }
@@ -254,7 +307,7 @@ void OpenWarSurface::UpdateSoundPlayer()
 		for (UnitCounter* unitMarker : _battleView->GetBattleModel()->_unitMarkers)
 		{
 			Unit* unit = unitMarker->_unit;
-			if (_battleScript->GetBattleModel()->GetUnit(unit->unitId) != 0 && glm::length(unit->command.GetDestination() - unit->state.center) > 4.0f)
+			if (_battleModel->GetUnit(unit->unitId) != 0 && glm::length(unit->command.GetDestination() - unit->state.center) > 4.0f)
 			{
 				if (unit->stats.unitPlatform == UnitPlatformCav || unit->stats.unitPlatform == UnitPlatformGen)
 				{
@@ -282,7 +335,7 @@ void OpenWarSurface::UpdateSoundPlayer()
 		SoundPlayer::singleton->UpdateCavalryWalking(horseTrot != 0);
 		SoundPlayer::singleton->UpdateCavalryRunning(horseGallop != 0);
 
-		SoundPlayer::singleton->UpdateFighting(_battleScript->GetBattleModel()->IsMelee());
+		SoundPlayer::singleton->UpdateFighting(_battleModel->IsMelee());
 	}
 }
 
@@ -290,6 +343,7 @@ void OpenWarSurface::UpdateSoundPlayer()
 void OpenWarSurface::ClickedPlay()
 {
 	_mode = Mode::Playing;
+	_simulationThread->SetRunning(true);
 	SoundPlayer::singleton->Resume();
 	UpdateButtonsAndGestures();
 }
@@ -298,6 +352,7 @@ void OpenWarSurface::ClickedPlay()
 void OpenWarSurface::ClickedPause()
 {
 	_mode = Mode::Editing;
+	_simulationThread->SetRunning(false);
 	SoundPlayer::singleton->Pause();
 	UpdateButtonsAndGestures();
 }
@@ -325,14 +380,16 @@ void OpenWarSurface::SetEditorFeature(TerrainFeature terrainFeature)
 
 void OpenWarSurface::UpdateButtonsAndGestures()
 {
-	_buttonItemHand->SetDisabled(_mode != Mode::Editing);
-	_buttonItemPaint->SetDisabled(_mode != Mode::Editing);
-	_buttonItemErase->SetDisabled(_mode != Mode::Editing);
-	_buttonItemSmear->SetDisabled(_mode != Mode::Editing);
-	_buttonItemHills->SetDisabled(_mode != Mode::Editing);
-	_buttonItemTrees->SetDisabled(_mode != Mode::Editing);
-	_buttonItemWater->SetDisabled(_mode != Mode::Editing);
-	_buttonItemFords->SetDisabled(_mode != Mode::Editing);
+	bool editing = _mode == Mode::Editing && _editable;
+
+	_buttonItemHand->SetDisabled(!editing);
+	_buttonItemPaint->SetDisabled(!editing);
+	_buttonItemErase->SetDisabled(!editing);
+	_buttonItemSmear->SetDisabled(!editing);
+	_buttonItemHills->SetDisabled(!editing);
+	_buttonItemTrees->SetDisabled(!editing);
+	_buttonItemWater->SetDisabled(!editing);
+	_buttonItemFords->SetDisabled(!editing);
 
 	if (_mode == Mode::None)
 		return;
@@ -347,7 +404,7 @@ void OpenWarSurface::UpdateButtonsAndGestures()
 	_buttonItemFords->SetSelected(_editorModel->GetTerrainFeature() == TerrainFeature::Fords);
 
 	_battleGesture->SetEnabled(_mode == Mode::Playing);
-	_editorGesture->SetEnabled(_mode == Mode::Editing);
+	_editorGesture->SetEnabled(editing);
 
 	_buttonsTopRight->Reset();
 	switch (_mode)
@@ -17,8 +17,10 @@ class ButtonItem;
 class ButtonRendering;
 class ButtonView;
 class BattleSimulator;
+class DynamicResolution;
 class EditorGesture;
 class GradientLineRenderer;
+class SimulationThread;
 class SmoothTerrainSurfaceRenderer;
 class TerrainGesture;
 class TiledTerrainSurfaceRenderer;
@@ -31,12 +33,15 @@ public: // TODO: just testing
 	Mode _mode;
 
 	BattleScript* _battleScript;
+	SimulationThread* _simulationThread;
+	BattleModel* _battleModel;
 	BattleView* _battleView;
 
 	renderers* _renderers;
 	ButtonRendering* _buttonRendering;
 
 	EditorModel* _editorModel;
+	bool _editable; // false for compiled maps, which are read-only
 
 	ButtonView* _buttonsTopLeft;
 	ButtonView* _buttonsTopRight;
@@ -56,6 +61,7 @@ public: // TODO: just testing
 	ButtonItem* _buttonItemFords;
 
 	GradientLineRenderer* _scriptHintRenderer;
+	DynamicResolution* _dynamicResolution;
 
 public:
 	OpenWarSurface(glm::vec2 size, float pixelDensity);
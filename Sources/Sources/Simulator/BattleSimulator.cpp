@@ -27,6 +27,8 @@ _weaponQuadTree(
 	battleModel->terrainSurface->GetBounds().max.x,
 	battleModel->terrainSurface->GetBounds().max.y),
 _secondsSinceLastTimeStep(0),
+_commands(256),
+_commandSequence(0),
 listener(0),
 currentPlayer(PlayerNone),
 practice(false)
@@ -90,8 +92,15 @@ void BattleSimulator::AdvanceTime(float secondsSinceLastTime)
 }
 
 
+bool BattleSimulator::PostCommand(const UnitCommandUpdate& commandUpdate)
+{
+	return _commands.push(commandUpdate);
+}
+
+
 void BattleSimulator::SimulateOneTimeStep()
 {
+	ApplyCommands();
 	RebuildQuadTree();
 
 	for (std::map<int, Unit*>::iterator i = _battleModel->units.begin(); i != _battleModel->units.end(); ++i)
@@ -112,6 +121,19 @@ void BattleSimulator::SimulateOneTimeStep()
 }
 
 
+void BattleSimulator::ApplyCommands()
+{
+	UnitCommandUpdate commandUpdate;
+	while (_commands.pop(commandUpdate))
+	{
+		Unit* unit = _battleModel->GetUnit(commandUpdate.unitId);
+		if (unit != nullptr)
+			unit->SetCommandUpdate(commandUpdate, _battleModel);
+		_commandSequence = commandUpdate.sequence;
+	}
+}
+
+
 void BattleSimulator::RebuildQuadTree()
 {
 	_fighterQuadTree.clear();
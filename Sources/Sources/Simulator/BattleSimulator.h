@@ -7,6 +7,7 @@
 
 #include "../BattleModel/BattleModel.h"
 #include "../../Library/Algorithms/quadtree.h"
+#include "../../Library/Algorithms/spsc_queue.h"
 
 class Fighter;
 class Unit;
@@ -30,6 +31,8 @@ class BattleSimulator
 	quadtree<Fighter*> _weaponQuadTree;
 	quadtree<Fighter*> _fighterQuadTree;
 	float _secondsSinceLastTimeStep;
+	spsc_queue<UnitCommandUpdate> _commands;
+	int _commandSequence;
 
 public:
 	Player currentPlayer;
@@ -44,8 +47,16 @@ public:
 
 	void AdvanceTime(float secondsSinceLastTime);
 
+	// Queues a command from another thread, to be applied at the start of
+	// the next time step. Fails when the queue is full.
+	bool PostCommand(const UnitCommandUpdate& commandUpdate);
+
+	// The sequence number of the last command applied.
+	int GetCommandSequence() const { return _commandSequence; }
+
 private:
 	void SimulateOneTimeStep();
+	void ApplyCommands();
 
 	void RebuildQuadTree();
 
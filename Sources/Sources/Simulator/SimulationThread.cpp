@@ -0,0 +1,327 @@
+// Copyright (C) 2013 Felix Ungman
+//
+// This file is part of the openwar platform (GPL v3 or later), see LICENSE.txt
+
+#include <algorithm>
+#include <chrono>
+
+#include "SimulationThread.h"
+#include "BattleSimulator.h"
+#include "../BattleScript.h"
+#include "../../Library/profiler.h"
+
+
+
+BattleSnapshot::BattleSnapshot() :
+number(0),
+time(0),
+winner(PlayerNone),
+commandSequence(0)
+{
+}
+
+
+SimulationThread::SimulationThread(BattleScript* battleScript) :
+_battleScript(battleScript),
+_published(1),
+_writing(0),
+_reading(2),
+_acquired(0),
+_snapshotNumber(0),
+_commandSequence(0),
+_running(false),
+_stopping(false),
+listener(nullptr)
+{
+	Publish();
+	_thread = std::thread(&SimulationThread::Run, this);
+}
+
+
+SimulationThread::~SimulationThread()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stopping = true;
+	}
+	_condition.notify_all();
+	_thread.join();
+}
+
+
+void SimulationThread::SetRunning(bool running)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_running = running;
+	}
+	_condition.notify_all();
+}
+
+
+void SimulationThread::Synchronize(BattleModel* battleModel)
+{
+	PostCommands(battleModel);
+
+	if ((_published.load() & SnapshotFresh) == 0)
+		return;
+
+	_reading = _published.exchange(_reading) & SnapshotSlot;
+	int replayed = _acquired.load();
+
+	const BattleSnapshot& snapshot = _snapshots[_reading];
+	ApplySnapshot(snapshot, battleModel);
+
+	for (const SimulationEvents& events : snapshot.events)
+	{
+		if (events.number <= replayed || listener == nullptr)
+			continue;
+
+		for (const Shooting& shooting : events.shootings)
+			listener->OnShooting(shooting);
+
+		for (const Casualty& casualty : events.casualties)
+			listener->OnCasualty(casualty);
+	}
+
+	_acquired.store(snapshot.number);
+}
+
+
+// Steps are paced by the simulator's time step, which is as often as the
+// battle changes. The lock is held while stepping, and released while
+// waiting for the next step.
+
+void SimulationThread::Run()
+{
+	std::chrono::duration<float> interval(_battleScript->GetBattleModel()->timeStep);
+	std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (!_stopping)
+	{
+		if (!_running)
+		{
+			_condition.wait(lock);
+			last = std::chrono::steady_clock::now();
+			continue;
+		}
+
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		Step(std::chrono::duration<float>(now - last).count());
+		last = now;
+
+		_condition.wait_until(lock, now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(interval));
+	}
+}
+
+
+void SimulationThread::Step(float secondsSinceLastStep)
+{
+	profile_scope scope("simulation.step");
+
+	_battleScript->Tick(secondsSinceLastStep);
+	Publish();
+}
+
+
+void SimulationThread::Publish()
+{
+	BattleModel* battleModel = _battleScript->GetBattleModel();
+	BattleSimulator* battleSimulator = _battleScript->GetBattleSimulator();
+	BattleSnapshot& snapshot = _snapshots[_writing];
+
+	snapshot.number = ++_snapshotNumber;
+	snapshot.time = battleModel->time;
+	snapshot.winner = battleModel->winner;
+	snapshot.commandSequence = battleSimulator != nullptr ? battleSimulator->GetCommandSequence() : 0;
+
+	snapshot.units.resize(battleModel->units.size());
+	std::vector<UnitSnapshot>::iterator unitSnapshot = snapshot.units.begin();
+	for (std::pair<int, Unit*> item : battleModel->units)
+	{
+		Unit* unit = item.second;
+		unitSnapshot->unitId = unit->unitId;
+		unitSnapshot->player = unit->player;
+		unitSnapshot->stats = unit->stats;
+		unitSnapshot->state = unit->state;
+		unitSnapshot->formation = unit->formation;
+		unitSnapshot->shootingCounter = unit->shootingCounter;
+		unitSnapshot->command = unit->GetCommandUpdate();
+
+		unitSnapshot->fighters.resize(unit->fightersCount);
+		for (int i = 0; i < unit->fightersCount; ++i)
+		{
+			const FighterState& state = unit->fighters[i].state;
+			FighterSnapshot& fighterSnapshot = unitSnapshot->fighters[i];
+			fighterSnapshot.position = state.position;
+			fighterSnapshot.direction = state.direction;
+			fighterSnapshot.readyState = state.readyState;
+			fighterSnapshot.opponentUnitId = state.opponent != nullptr ? state.opponent->unit->unitId : 0;
+			fighterSnapshot.opponentIndex = state.opponent != nullptr ? (int)(state.opponent - state.opponent->unit->fighters) : -1;
+		}
+
+		++unitSnapshot;
+	}
+
+	int acquired = _acquired.load();
+	while (!_events.empty() && _events.front().number <= acquired)
+		_events.pop_front();
+
+	if (battleSimulator != nullptr && (!battleSimulator->recentShootings.empty() || !battleSimulator->recentCasualties.empty()))
+	{
+		SimulationEvents events;
+		events.number = snapshot.number;
+		events.shootings = battleSimulator->recentShootings;
+		events.casualties = battleSimulator->recentCasualties;
+		_events.push_back(events);
+	}
+
+	snapshot.events.assign(_events.begin(), _events.end());
+
+	snapshot.hints.clear();
+	_battleScript->RenderHints(snapshot.hints);
+
+	_writing = _published.exchange(_writing | SnapshotFresh) & SnapshotSlot;
+}
+
+
+// Commands that differ from the last known ones were given on the main
+// thread since the previous frame. Only the changed fields are sent, so that
+// changes made by the simulator to the others are kept. Until the simulator
+// has applied them, snapshots still carry the old commands, which must not
+// overwrite the new. Commands that do not fit in the queue are kept in order
+// for the next frame.
+
+void SimulationThread::PostCommands(BattleModel* battleModel)
+{
+	for (std::pair<int, Unit*> item : battleModel->units)
+	{
+		Unit* unit = item.second;
+		std::map<int, UnitCommandUpdate>::iterator known = _knownCommands.find(unit->unitId);
+		if (known == _knownCommands.end())
+			continue;
+
+		UnitCommandUpdate commandUpdate = unit->GetCommandUpdate();
+		int fields = commandUpdate.GetChangedFields(known->second);
+		if (fields == 0 && unit->timeUntilSwapFighters == 0)
+			continue;
+
+		known->second = commandUpdate;
+
+		commandUpdate.fields = fields;
+		commandUpdate.timeUntilSwapFighters = unit->timeUntilSwapFighters;
+		commandUpdate.sequence = ++_commandSequence;
+		unit->timeUntilSwapFighters = 0;
+
+		_pendingSequences[unit->unitId] = commandUpdate.sequence;
+		_unsentCommands.push_back(commandUpdate);
+	}
+
+	BattleSimulator* battleSimulator = _battleScript->GetBattleSimulator();
+	if (battleSimulator == nullptr)
+	{
+		_unsentCommands.clear();
+		return;
+	}
+
+	size_t sent = 0;
+	while (sent < _unsentCommands.size() && battleSimulator->PostCommand(_unsentCommands[sent]))
+		++sent;
+	_unsentCommands.erase(_unsentCommands.begin(), _unsentCommands.begin() + sent);
+}
+
+
+void SimulationThread::ApplySnapshot(const BattleSnapshot& snapshot, BattleModel* battleModel)
+{
+	battleModel->time = snapshot.time;
+	battleModel->winner = snapshot.winner;
+
+	// Like the simulator, removed units are only taken out of the map, since
+	// markers may still refer to them.
+	std::vector<int> removed;
+	std::vector<UnitSnapshot>::const_iterator s = snapshot.units.begin();
+	for (std::pair<int, Unit*> item : battleModel->units)
+	{
+		while (s != snapshot.units.end() && s->unitId < item.first)
+			++s;
+		if (s == snapshot.units.end() || s->unitId != item.first)
+			removed.push_back(item.first);
+	}
+	for (int unitId : removed)
+	{
+		battleModel->units.erase(unitId);
+		_knownCommands.erase(unitId);
+		_pendingSequences.erase(unitId);
+	}
+
+	for (const UnitSnapshot& unitSnapshot : snapshot.units)
+	{
+		Unit* unit = battleModel->GetUnit(unitSnapshot.unitId);
+		if (unit == nullptr)
+			unit = AddUnit(battleModel, unitSnapshot);
+
+		unit->state = unitSnapshot.state;
+		unit->formation = unitSnapshot.formation;
+		unit->shootingCounter = unitSnapshot.shootingCounter;
+		unit->fightersCount = std::min(unit->fightersCount, (int)unitSnapshot.fighters.size());
+
+		for (int i = 0; i < unit->fightersCount; ++i)
+		{
+			const FighterSnapshot& fighterSnapshot = unitSnapshot.fighters[i];
+			FighterState& state = unit->fighters[i].state;
+			state.position = fighterSnapshot.position;
+			state.direction = fighterSnapshot.direction;
+			state.readyState = fighterSnapshot.readyState;
+		}
+	}
+
+	// Targets and opponents refer to other units, so they are resolved once
+	// all units are in place.
+	for (const UnitSnapshot& unitSnapshot : snapshot.units)
+	{
+		Unit* unit = battleModel->GetUnit(unitSnapshot.unitId);
+
+		for (int i = 0; i < unit->fightersCount; ++i)
+		{
+			const FighterSnapshot& fighterSnapshot = unitSnapshot.fighters[i];
+			Unit* opponent = battleModel->GetUnit(fighterSnapshot.opponentUnitId);
+			unit->fighters[i].state.opponent = opponent != nullptr && fighterSnapshot.opponentIndex < opponent->fightersCount
+				? opponent->fighters + fighterSnapshot.opponentIndex
+				: nullptr;
+		}
+
+		std::map<int, int>::iterator pending = _pendingSequences.find(unit->unitId);
+		if (pending != _pendingSequences.end())
+		{
+			if (snapshot.commandSequence < pending->second)
+				continue;
+			_pendingSequences.erase(pending);
+		}
+
+		unit->SetCommandUpdate(unitSnapshot.command, battleModel);
+		_knownCommands[unit->unitId] = unitSnapshot.command;
+	}
+}
+
+
+Unit* SimulationThread::AddUnit(BattleModel* battleModel, const UnitSnapshot& unitSnapshot)
+{
+	int fightersCount = (int)unitSnapshot.fighters.size();
+
+	Unit* unit = new Unit();
+	unit->unitId = unitSnapshot.unitId;
+	unit->player = unitSnapshot.player;
+	unit->stats = unitSnapshot.stats;
+	unit->fightersCount = fightersCount;
+	unit->fighters = new Fighter[fightersCount > 0 ? fightersCount : 1];
+
+	for (Fighter* i = unit->fighters, * end = i + fightersCount; i != end; ++i)
+		i->unit = unit;
+
+	battleModel->units[unit->unitId] = unit;
+	battleModel->lastUnitId = std::max(battleModel->lastUnitId, unit->unitId);
+	battleModel->AddUnitMarker(unit);
+
+	return unit;
+}
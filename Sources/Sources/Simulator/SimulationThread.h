@@ -0,0 +1,132 @@
+// Copyright (C) 2013 Felix Ungman
+//
+// This file is part of the openwar platform (GPL v3 or later), see LICENSE.txt
+
+#ifndef SimulationThread_H
+#define SimulationThread_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "../BattleModel/BattleModel.h"
+
+class BattleScript;
+class SimulationListener;
+
+
+struct FighterSnapshot
+{
+	glm::vec2 position;
+	float direction;
+	ReadyState readyState;
+	int opponentUnitId;
+	int opponentIndex;
+};
+
+
+struct UnitSnapshot
+{
+	int unitId;
+	Player player;
+	UnitStats stats;
+	UnitState state;
+	Formation formation;
+	int shootingCounter;
+	UnitCommandUpdate command;
+	std::vector<FighterSnapshot> fighters;
+};
+
+
+struct SimulationEvents
+{
+	int number;
+	std::vector<Shooting> shootings;
+	std::vector<Casualty> casualties;
+};
+
+
+// The battle as of one simulation step. Events are numbered by snapshot,
+// and are repeated in later snapshots until the view has acquired one that
+// contains them, so none are lost when the view skips a snapshot. Hints are
+// line segments, two points each.
+
+struct BattleSnapshot
+{
+	int number;
+	float time;
+	Player winner;
+	int commandSequence;
+	std::vector<UnitSnapshot> units;
+	std::vector<SimulationEvents> events;
+	std::vector<glm::vec3> hints;
+
+	BattleSnapshot();
+};
+
+
+// Runs the battle script and simulator on a thread of its own, publishing
+// a snapshot after each step through a triple buffer: the simulation always
+// has a free slot to write and the view always has the latest complete one,
+// so neither side waits for the other. The view keeps a battle model of its
+// own, which Synchronize brings up to date once per frame. Changes to the
+// commands of the view's units are sent to the simulator's command queue.
+
+class SimulationThread
+{
+	enum { SnapshotSlot = 3, SnapshotFresh = 4 };
+
+	BattleScript* _battleScript;
+	BattleSnapshot _snapshots[3];
+	std::atomic<int> _published;
+	int _writing;
+	int _reading;
+
+	std::deque<SimulationEvents> _events;
+	std::atomic<int> _acquired;
+	int _snapshotNumber;
+
+	int _commandSequence;
+	std::vector<UnitCommandUpdate> _unsentCommands;
+	std::map<int, UnitCommandUpdate> _knownCommands;
+	std::map<int, int> _pendingSequences;
+
+	std::mutex _mutex;
+	std::condition_variable _condition;
+	bool _running;
+	bool _stopping;
+	std::thread _thread;
+
+public:
+	SimulationListener* listener;
+
+	SimulationThread(BattleScript* battleScript);
+	~SimulationThread();
+
+	// Waits for a step in progress, so that the battle model and terrain
+	// may be changed from the main thread while paused.
+	void SetRunning(bool running);
+
+	// Main thread only.
+	void Synchronize(BattleModel* battleModel);
+	const BattleSnapshot& GetSnapshot() const { return _snapshots[_reading]; }
+
+private:
+	SimulationThread(const SimulationThread&);
+	SimulationThread& operator=(const SimulationThread&);
+
+	void Run();
+	void Step(float secondsSinceLastStep);
+	void Publish();
+
+	void PostCommands(BattleModel* battleModel);
+	void ApplySnapshot(const BattleSnapshot& snapshot, BattleModel* battleModel);
+	static Unit* AddUnit(BattleModel* battleModel, const UnitSnapshot& unitSnapshot);
+};
+
+
+#endif
@@ -0,0 +1,380 @@
+// Copyright (C) 2013 Felix Ungman
+//
+// This file is part of the openwar platform (GPL v3 or later), see LICENSE.txt
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../../Library/Algebra/image.h"
+#include "SmoothTerrainMap.h"
+#include "SmoothTerrainSurface.h"
+
+
+static const char smooth_terrain_map_magic[4] = { 'O', 'W', 'T', 'M' };
+static const uint32_t smooth_terrain_map_version = 1;
+static const long smooth_terrain_map_page = 4096;
+
+
+static bool pad_to_page(FILE* file)
+{
+	long position = std::ftell(file);
+	long padding = (smooth_terrain_map_page - position % smooth_terrain_map_page) % smooth_terrain_map_page;
+	for (long i = 0; i < padding; ++i)
+		if (std::fputc(0, file) == EOF)
+			return false;
+	return true;
+}
+
+
+template <class T>
+static bool write_section(FILE* file, uint64_t& offset, const std::vector<T>& data)
+{
+	if (!pad_to_page(file))
+		return false;
+	offset = (uint64_t)std::ftell(file);
+	return data.empty() || std::fwrite(data.data(), sizeof(T), data.size(), file) == data.size();
+}
+
+
+
+SmoothTerrainMap::SmoothTerrainMap() :
+_fd(-1),
+_mapping(nullptr),
+_length(0),
+_header(nullptr)
+{
+}
+
+
+SmoothTerrainMap::~SmoothTerrainMap()
+{
+	Close();
+}
+
+
+bool SmoothTerrainMap::Open(const char* path)
+{
+	Close();
+
+	_fd = open(path, O_RDONLY);
+	if (_fd == -1)
+		return false;
+
+	struct stat st;
+	if (fstat(_fd, &st) != 0 || (size_t)st.st_size < sizeof(SmoothTerrainMapHeader))
+	{
+		Close();
+		return false;
+	}
+
+	_length = (size_t)st.st_size;
+	_mapping = mmap(nullptr, _length, PROT_READ, MAP_PRIVATE, _fd, 0);
+	if (_mapping == MAP_FAILED)
+	{
+		_mapping = nullptr;
+		Close();
+		return false;
+	}
+
+	_header = static_cast<const SmoothTerrainMapHeader*>(_mapping);
+	if (std::memcmp(_header->magic, smooth_terrain_map_magic, 4) != 0
+		|| _header->version != smooth_terrain_map_version
+		|| _header->length != _length
+		|| !HasSection(_header->groundmapOffset, _header->groundmapLength)
+		|| !_groundmap.attach(GetSection(_header->groundmapOffset), (size_t)_header->groundmapLength)
+		|| !HasValidSections())
+	{
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+
+bool SmoothTerrainMap::HasSection(uint64_t offset, uint64_t length) const
+{
+	return offset % smooth_terrain_map_page == 0 && offset <= _length && length <= _length - offset;
+}
+
+
+// The sizes are checked before they are multiplied, so that a corrupt
+// header cannot overflow them, and every section must lie within the
+// file, so that no accessor reads beyond the mapping.
+
+bool SmoothTerrainMap::HasValidSections() const
+{
+	uint64_t size = _header->size;
+	uint64_t chunkSize = _header->chunkSize;
+	uint64_t chunkCount = _header->chunkCount;
+	if (size < 2 || size > 65537 || chunkSize == 0 || chunkCount == 0 || chunkSize * chunkCount != size - 1)
+		return false;
+
+	glm::ivec2 mapsize = _groundmap.size();
+	uint64_t pixels = (uint64_t)mapsize.x * (uint64_t)mapsize.y;
+	uint64_t chunks = chunkCount * chunkCount;
+
+	if (!HasSection(_header->tilesOffset, chunks * GetTileLength())
+		|| !HasSection(_header->splatmapOffset, 4 * pixels)
+		|| !HasSection(_header->flagsOffset, pixels)
+		|| !HasSection(_header->chunksOffset, chunks * GetChunkLength())
+		|| !HasSection(_header->skirtOffset, (uint64_t)_header->skirtCount * sizeof(skirt_vertex)))
+		return false;
+
+	uint64_t keys = _header->indexKeys;
+	if (keys > 65536 || !HasSection(_header->indicesOffset, 2 * keys * sizeof(uint32_t)))
+		return false;
+
+	const uint32_t* table = reinterpret_cast<const uint32_t*>(GetSection(_header->indicesOffset));
+	uint64_t indices = (_length - _header->indicesOffset - 2 * keys * sizeof(uint32_t)) / sizeof(GLushort);
+	for (uint64_t key = 0; key < keys; ++key)
+		if ((uint64_t)table[2 * key] + table[2 * key + 1] > indices)
+			return false;
+
+	return true;
+}
+
+
+void SmoothTerrainMap::Close()
+{
+	_groundmap.close();
+
+	if (_mapping != nullptr)
+		munmap(_mapping, _length);
+	if (_fd != -1)
+		close(_fd);
+
+	_fd = -1;
+	_mapping = nullptr;
+	_length = 0;
+	_header = nullptr;
+}
+
+
+// Derives everything from a surface built on an in-memory groundmap, so
+// that the compiled data is exactly what the surface would have computed.
+
+bool SmoothTerrainMap::Write(const char* path, SmoothTerrainSurface& surface)
+{
+	image* groundmap = surface.GetGroundMap();
+	if (groundmap == nullptr)
+		return false;
+
+	FILE* file = std::fopen(path, "wb");
+	if (file == nullptr)
+		return false;
+
+	int size = surface.GetGridSize();
+	int chunkSize = surface.GetChunkSize();
+	int chunkCount = surface.GetChunkCount();
+	int k = chunkSize + 1;
+	glm::ivec2 mapsize = groundmap->size();
+	bounds2f bounds = surface.GetBounds();
+	bounds1f heightBounds = surface.GetHeightBounds();
+
+	SmoothTerrainMapHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, smooth_terrain_map_magic, 4);
+	header.version = smooth_terrain_map_version;
+	header.bounds[0] = bounds.min.x;
+	header.bounds[1] = bounds.min.y;
+	header.bounds[2] = bounds.max.x;
+	header.bounds[3] = bounds.max.y;
+	header.heightBounds[0] = heightBounds.min;
+	header.heightBounds[1] = heightBounds.max;
+	header.size = (uint32_t)size;
+	header.chunkSize = (uint32_t)chunkSize;
+	header.chunkCount = (uint32_t)chunkCount;
+
+	bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+
+// groundmap
+	ok = ok && pad_to_page(file);
+	header.groundmapOffset = (uint64_t)std::ftell(file);
+	ok = ok && paged_image::write(file, groundmap->view(), 64);
+	header.groundmapLength = (uint64_t)std::ftell(file) - header.groundmapOffset;
+
+// tiles
+	SmoothTerrainSurface::pin_tiles pin(surface);
+	std::vector<float> tiles;
+	tiles.reserve(chunkCount * chunkCount * k * k * 4);
+	for (int ty = 0; ty < chunkCount; ++ty)
+		for (int tx = 0; tx < chunkCount; ++tx)
+		{
+			const terrain_tile* tile = surface.GetTile(tx, ty);
+			tiles.insert(tiles.end(), tile->_heights.begin(), tile->_heights.end());
+			for (const glm::vec3& n : tile->_normals)
+			{
+				tiles.push_back(n.x);
+				tiles.push_back(n.y);
+				tiles.push_back(n.z);
+			}
+		}
+	ok = ok && write_section(file, header.tilesOffset, tiles);
+	std::vector<float>().swap(tiles);
+
+// splatmap
+	std::vector<GLubyte> splatmap;
+	surface.BuildSplatmap(glm::ivec2(), mapsize, splatmap);
+	ok = ok && write_section(file, header.splatmapOffset, splatmap);
+	std::vector<GLubyte>().swap(splatmap);
+
+// flags
+	pixel_view<const rgba8> ground = static_cast<const image*>(groundmap)->view();
+	std::vector<unsigned char> flags(mapsize.x * mapsize.y);
+	for (int y = 0; y < mapsize.y; ++y)
+		for (int x = 0; x < mapsize.x; ++x)
+		{
+			rgba8 c = ground.at(x, y);
+			unsigned char f = 0;
+			if (c.b >= 128)
+				f |= SmoothTerrainFlagWater;
+			if (c.r >= 128)
+				f |= SmoothTerrainFlagFords;
+			if (surface.GetForestValue(x, y) >= 0.5f)
+				f |= SmoothTerrainFlagForest;
+			if (surface.GetImpassableValue(c, x, y) >= 0.5f)
+				f |= SmoothTerrainFlagImpassable;
+			flags[x + y * mapsize.x] = f;
+		}
+	ok = ok && write_section(file, header.flagsOffset, flags);
+
+// chunks
+	std::vector<char> chunks;
+	chunks.reserve(chunkCount * chunkCount * (2 * sizeof(float) + k * k * sizeof(terrain_vertex)));
+	for (int cy = 0; cy < chunkCount; ++cy)
+		for (int cx = 0; cx < chunkCount; ++cx)
+		{
+			terrain_chunk chunk(glm::ivec2(cx, cy) * chunkSize);
+			surface.UpdateChunkVertices(chunk);
+
+			float height[2] = { chunk._bounds.min.z, chunk._bounds.max.z };
+			const char* h = reinterpret_cast<const char*>(height);
+			const char* v = reinterpret_cast<const char*>(chunk._vbo._vertices.data());
+			chunks.insert(chunks.end(), h, h + sizeof(height));
+			chunks.insert(chunks.end(), v, v + k * k * sizeof(terrain_vertex));
+		}
+	ok = ok && write_section(file, header.chunksOffset, chunks);
+	std::vector<char>().swap(chunks);
+
+// indices: a table of (first, count) per key, followed by the indices
+	header.indexKeys = (uint32_t)(16 * (surface.GetMaxLod() + 1));
+	std::vector<uint32_t> table;
+	std::vector<GLushort> indices;
+	for (int key = 0; key < (int)header.indexKeys; ++key)
+	{
+		const std::vector<GLushort>& pattern = surface.GetChunkIndices(key / 16, key % 16);
+		table.push_back((uint32_t)indices.size());
+		table.push_back((uint32_t)pattern.size());
+		indices.insert(indices.end(), pattern.begin(), pattern.end());
+	}
+	ok = ok && write_section(file, header.indicesOffset, table);
+	ok = ok && std::fwrite(indices.data(), sizeof(GLushort), indices.size(), file) == indices.size();
+
+// skirt
+	const std::vector<skirt_vertex>& skirt = surface.GetSkirtVertices();
+	header.skirtCount = (uint32_t)skirt.size();
+	ok = ok && write_section(file, header.skirtOffset, skirt);
+
+	header.length = (uint64_t)std::ftell(file);
+	ok = ok && std::fseek(file, 0, SEEK_SET) == 0;
+	ok = ok && std::fwrite(&header, sizeof(header), 1, file) == 1;
+
+	return std::fclose(file) == 0 && ok;
+}
+
+
+bounds2f SmoothTerrainMap::GetBounds() const
+{
+	return bounds2f(_header->bounds[0], _header->bounds[1], _header->bounds[2], _header->bounds[3]);
+}
+
+
+bounds1f SmoothTerrainMap::GetHeightBounds() const
+{
+	return bounds1f(_header->heightBounds[0], _header->heightBounds[1]);
+}
+
+
+size_t SmoothTerrainMap::GetTileLength() const
+{
+	size_t k = _header->chunkSize + 1;
+	return k * k * 4 * sizeof(float);
+}
+
+
+size_t SmoothTerrainMap::GetChunkLength() const
+{
+	size_t k = _header->chunkSize + 1;
+	return 2 * sizeof(float) + k * k * sizeof(terrain_vertex);
+}
+
+
+const float* SmoothTerrainMap::GetTileHeights(int tx, int ty) const
+{
+	const char* tile = GetSection(_header->tilesOffset) + (tx + ty * _header->chunkCount) * GetTileLength();
+	return reinterpret_cast<const float*>(tile);
+}
+
+
+const glm::vec3* SmoothTerrainMap::GetTileNormals(int tx, int ty) const
+{
+	size_t k = _header->chunkSize + 1;
+	return reinterpret_cast<const glm::vec3*>(GetTileHeights(tx, ty) + k * k);
+}
+
+
+const GLubyte* SmoothTerrainMap::GetSplatmap() const
+{
+	return reinterpret_cast<const GLubyte*>(GetSection(_header->splatmapOffset));
+}
+
+
+unsigned char SmoothTerrainMap::GetFlags(int x, int y) const
+{
+	glm::ivec2 size = _groundmap.size();
+	if (x < 0 || x >= size.x || y < 0 || y >= size.y)
+		return 0;
+	return reinterpret_cast<const unsigned char*>(GetSection(_header->flagsOffset))[x + y * size.x];
+}
+
+
+bounds1f SmoothTerrainMap::GetChunkHeightBounds(int cx, int cy) const
+{
+	const float* height = reinterpret_cast<const float*>(GetSection(_header->chunksOffset) + (cx + cy * _header->chunkCount) * GetChunkLength());
+	return bounds1f(height[0], height[1]);
+}
+
+
+const terrain_vertex* SmoothTerrainMap::GetChunkVertices(int cx, int cy) const
+{
+	const char* chunk = GetSection(_header->chunksOffset) + (cx + cy * _header->chunkCount) * GetChunkLength();
+	return reinterpret_cast<const terrain_vertex*>(chunk + 2 * sizeof(float));
+}
+
+
+const GLushort* SmoothTerrainMap::GetChunkIndices(int key, int& count) const
+{
+	if (key < 0 || key >= (int)_header->indexKeys)
+	{
+		count = 0;
+		return nullptr;
+	}
+
+	const uint32_t* table = reinterpret_cast<const uint32_t*>(GetSection(_header->indicesOffset));
+	const GLushort* indices = reinterpret_cast<const GLushort*>(table + 2 * _header->indexKeys);
+	count = (int)table[2 * key + 1];
+	return indices + table[2 * key];
+}
+
+
+const skirt_vertex* SmoothTerrainMap::GetSkirtVertices(int& count) const
+{
+	count = (int)_header->skirtCount;
+	return reinterpret_cast<const skirt_vertex*>(GetSection(_header->skirtOffset));
+}
@@ -0,0 +1,109 @@
+// Copyright (C) 2013 Felix Ungman
+//
+// This file is part of the openwar platform (GPL v3 or later), see LICENSE.txt
+
+#ifndef SmoothTerrainMap_H
+#define SmoothTerrainMap_H
+
+#include <stdint.h>
+#include "../../Library/Algebra/bounds.h"
+#include "../../Library/Algebra/paged_image.h"
+#include "SmoothTerrainSurfaceRenderer.h"
+
+class SmoothTerrainSurface;
+
+
+enum SmoothTerrainFlag
+{
+	SmoothTerrainFlagWater = 1,
+	SmoothTerrainFlagFords = 2,
+	SmoothTerrainFlagForest = 4,
+	SmoothTerrainFlagImpassable = 8
+};
+
+
+struct SmoothTerrainMapHeader
+{
+	char magic[4];
+	uint32_t version;
+	float bounds[4];
+	float heightBounds[2];
+	uint32_t size;
+	uint32_t chunkSize;
+	uint32_t chunkCount;
+	uint32_t indexKeys;
+	uint32_t skirtCount;
+	uint32_t reserved;
+	uint64_t groundmapOffset;
+	uint64_t groundmapLength;
+	uint64_t tilesOffset;
+	uint64_t splatmapOffset;
+	uint64_t flagsOffset;
+	uint64_t chunksOffset;
+	uint64_t indicesOffset;
+	uint64_t skirtOffset;
+	uint64_t length;
+};
+
+
+// Precompiled smooth terrain: the groundmap together with the heights,
+// normals, splatmap, attribute flags, chunk vertices, chunk index patterns
+// and skirt that SmoothTerrainSurface would otherwise derive from it. The
+// file is memory-mapped, and the surface uploads straight from the mapping.
+//
+// Sections start at page boundaries. Tiles and chunks are stored in row
+// order, one contiguous block each, with (chunkSize + 1)^2 grid points.
+
+class SmoothTerrainMap
+{
+	int _fd;
+	void* _mapping;
+	size_t _length;
+	const SmoothTerrainMapHeader* _header;
+	paged_image _groundmap;
+
+public:
+	SmoothTerrainMap();
+	~SmoothTerrainMap();
+
+	bool Open(const char* path);
+	void Close();
+
+	static bool Write(const char* path, SmoothTerrainSurface& surface);
+
+	bounds2f GetBounds() const;
+	bounds1f GetHeightBounds() const;
+	int GetSize() const { return (int)_header->size; }
+	int GetChunkSize() const { return (int)_header->chunkSize; }
+	int GetChunkCount() const { return (int)_header->chunkCount; }
+
+	paged_image* GetGroundMap() { return &_groundmap; }
+	glm::ivec2 GetGroundMapSize() const { return _groundmap.size(); }
+
+	const float* GetTileHeights(int tx, int ty) const;
+	const glm::vec3* GetTileNormals(int tx, int ty) const;
+
+	const GLubyte* GetSplatmap() const;
+	unsigned char GetFlags(int x, int y) const;
+
+	bounds1f GetChunkHeightBounds(int cx, int cy) const;
+	const terrain_vertex* GetChunkVertices(int cx, int cy) const;
+
+	int GetIndexKeys() const { return (int)_header->indexKeys; }
+	const GLushort* GetChunkIndices(int key, int& count) const;
+
+	const skirt_vertex* GetSkirtVertices(int& count) const;
+
+private:
+	SmoothTerrainMap(const SmoothTerrainMap&);
+	SmoothTerrainMap& operator=(const SmoothTerrainMap&);
+
+	const char* GetSection(uint64_t offset) const { return static_cast<const char*>(_mapping) + offset; }
+	bool HasSection(uint64_t offset, uint64_t length) const;
+	bool HasValidSections() const;
+	size_t GetTileLength() const;
+	size_t GetChunkLength() const;
+};
+
+
+#endif
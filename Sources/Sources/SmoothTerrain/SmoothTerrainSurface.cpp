@@ -2,45 +2,184 @@
 //
 // This file is part of the openwar platform (GPL v3 or later), see LICENSE.txt
 
+#include <algorithm>
 #include "../../Library/Algebra/image.h"
+#include "../../Library/Algebra/paged_image.h"
+#include "../../Library/profiler.h"
+#include "../../Library/thread_pool.h"
+#include "SmoothTerrainMap.h"
 #include "SmoothTerrainSurface.h"
 
 
+static int feature_channel(TerrainFeature feature)
+{
+	switch (feature)
+	{
+		case TerrainFeature::Hills:
+			return pixel_channel_a;
+		case TerrainFeature::Trees:
+			return pixel_channel_g;
+		case TerrainFeature::Water:
+			return pixel_channel_b;
+		case TerrainFeature::Fords:
+		default:
+			return pixel_channel_r;
+	}
+}
+
+
 
 SmoothTerrainSurface::SmoothTerrainSurface(bounds2f bounds, image* groundmap) :
 _bounds(bounds),
 _groundmap(groundmap),
-_framebuffer_width(0),
-_framebuffer_height(0),
-_framebuffer(nullptr),
-_colorbuffer(nullptr),
-_depth(nullptr),
+_pagedGroundmap(nullptr),
+_map(nullptr),
+_groundmapSize(groundmap->size()),
+_renderEdges(false),
+_edgeFramebuffer(nullptr),
+_edgeColorFramebuffer(nullptr),
+_edgeDepth(nullptr),
+_edgeDepthSize(0),
 _colormap(nullptr),
 _splatmap(nullptr),
-_size(255),
-_heights(nullptr),
-_normals(nullptr)
+_size(groundmap->size().x | 1),
+_heightBounds(-2.5f, 125.0f),
+_chunkSize(64),
+_chunkCount(0),
+_lodDistance(32),
+_tiles(nullptr),
+_residentTiles(0),
+_tileCapacity(0),
+_residentChunks(0),
+_chunkCapacity(0),
+_frame(0)
 {
-	if (groundmap->size() != glm::ivec2(256, 256))
-		NSLog(@"SmoothTerrainSurface: ILLEGAL SIZE ############# %d x %d", groundmap->size().x, groundmap->size().y);
+	Initialize();
+}
 
-	_renderers = new terrain_renderers();
-	_colormap = terrain_renderers::create_colormap();
 
-	_heights = new float [_size * _size];
-	_normals = new glm::vec3[_size * _size];
+SmoothTerrainSurface::SmoothTerrainSurface(bounds2f bounds, paged_image* groundmap) :
+_bounds(bounds),
+_groundmap(nullptr),
+_pagedGroundmap(groundmap),
+_map(nullptr),
+_groundmapSize(groundmap->size()),
+_renderEdges(false),
+_edgeFramebuffer(nullptr),
+_edgeColorFramebuffer(nullptr),
+_edgeDepth(nullptr),
+_edgeDepthSize(0),
+_colormap(nullptr),
+_splatmap(nullptr),
+_size(groundmap->size().x | 1),
+_heightBounds(-2.5f, 125.0f),
+_chunkSize(64),
+_chunkCount(0),
+_lodDistance(32),
+_tiles(nullptr),
+_residentTiles(0),
+_tileCapacity(0),
+_residentChunks(0),
+_chunkCapacity(0),
+_frame(0)
+{
+	Initialize();
+}
+
+
+SmoothTerrainSurface::SmoothTerrainSurface(bounds2f bounds, SmoothTerrainMap* map) :
+_bounds(bounds),
+_groundmap(nullptr),
+_pagedGroundmap(map->GetGroundMap()),
+_map(map),
+_groundmapSize(map->GetGroundMap()->size()),
+_renderEdges(false),
+_edgeFramebuffer(nullptr),
+_edgeColorFramebuffer(nullptr),
+_edgeDepth(nullptr),
+_edgeDepthSize(0),
+_colormap(nullptr),
+_splatmap(nullptr),
+_size(map->GetSize()),
+_heightBounds(map->GetHeightBounds()),
+_chunkSize(64),
+_chunkCount(0),
+_lodDistance(32),
+_tiles(nullptr),
+_residentTiles(0),
+_tileCapacity(0),
+_residentChunks(0),
+_chunkCapacity(0),
+_frame(0)
+{
+	Initialize();
+}
 
-	UpdateHeights();
-	UpdateNormals();
 
+// The CPU stages run on the thread pool, only the GL uploads run on the
+// calling thread. With a paged groundmap, the tiles, the chunks and their
+// part of the splatmap are left to be loaded when they become visible.
+
+void SmoothTerrainSurface::Initialize()
+{
+	_renderers = new terrain_renderers();
+	_renderers->compile_programs();
+	_colormap = terrain_renderers::create_colormap();
 	_splatmap = new texture();
-	UpdateSplatmap();
 
-	InitializeSkirt();
-	InitializeShadow();
-	InitializeLines();
+	InitializeTiles();
+
+	profiler::shared().reset("terrain.");
 
-	BuildTriangles();
+	std::vector<GLubyte> splatmap;
+	const GLubyte* splatmapData = nullptr;
+	if (_map != nullptr)
+	{
+		splatmapData = _map->GetSplatmap();
+	}
+	else if (_pagedGroundmap == nullptr)
+	{
+		{
+			profile_scope scope("terrain.tiles");
+			thread_pool::shared().parallel_for(0, _chunkCount * _chunkCount, 1, [this](int first, int last) {
+				for (int i = first; i < last; ++i)
+					GetTile(i % _chunkCount, i / _chunkCount);
+			});
+		}
+		{
+			profile_scope scope("terrain.splatmap");
+			BuildSplatmap(glm::ivec2(), _groundmapSize, splatmap);
+			splatmapData = splatmap.data();
+		}
+	}
+	{
+		profile_scope scope("terrain.skirt");
+		if (_map != nullptr)
+		{
+			int count;
+			const skirt_vertex* vertices = _map->GetSkirtVertices(count);
+			_vboSkirt._mode = GL_TRIANGLE_STRIP;
+			_vboSkirt._vertices.assign(vertices, vertices + count);
+		}
+		else
+		{
+			InitializeSkirt();
+		}
+	}
+	{
+		profile_scope scope("terrain.shadow");
+		InitializeShadow();
+	}
+	{
+		profile_scope scope("terrain.chunks");
+		InitializeChunks();
+	}
+	{
+		profile_scope scope("terrain.upload");
+		UploadSplatmap(glm::ivec2(), _groundmapSize, splatmapData);
+		_vboSkirt.update(GL_STATIC_DRAW);
+		_vboShadow.update(GL_STATIC_DRAW);
+	}
 }
 
 
@@ -48,38 +187,49 @@ SmoothTerrainSurface::~SmoothTerrainSurface()
 {
 	delete _colormap;
 	delete _splatmap;
-	delete _framebuffer;
-	delete _colorbuffer;
-	delete _depth;
 	delete _renderers;
+
+	for (terrain_chunk* chunk : _chunks)
+		delete chunk;
+
+	for (int i = 0; i < _chunkCount * _chunkCount; ++i)
+		delete _tiles[i].load();
+	delete[] _tiles;
+
+	for (std::vector<terrain_tile*>& retired : _retiredTiles)
+		for (terrain_tile* tile : retired)
+			delete tile;
 }
 
 
 float SmoothTerrainSurface::GetHeight(glm::vec2 position) const
 {
+	pin_tiles pin(*this);
 	return InterpolateHeight(position);
 }
 
 
-const float* SmoothTerrainSurface::Intersect(ray r)
+intersection SmoothTerrainSurface::Intersect(ray r) const
 {
 	glm::vec3 offset = glm::vec3(_bounds.min, 0);
 	glm::vec3 scale = glm::vec3(glm::vec2(_size - 1, _size - 1) / _bounds.size(), 1);
 
 	ray r2 = ray(scale * (r.origin - offset), glm::normalize(scale * r.direction));
-	const float* d = InternalIntersect(r2);
-	if (d == nullptr)
-		return nullptr;
+	pin_tiles pin(*this);
+	intersection i = InternalIntersect(r2);
+	if (!i.hit)
+		return intersection();
 
-	static float result;
-	result = glm::length((r2.point(*d) - r2.origin) / scale);
-	return &result;
+	float d = glm::length((i.point - r2.origin) / scale) / glm::length(r.direction);
+	return intersection(r, d, scale_normal(i.normal, 1.0f / scale));
 }
 
 
 bool SmoothTerrainSurface::IsForest(glm::vec2 position) const
 {
 	glm::ivec2 coord = MapWorldToImage(position);
+	if (_map != nullptr)
+		return (_map->GetFlags(coord.x, coord.y) & SmoothTerrainFlagForest) != 0;
 	return GetForestValue(coord.x, coord.y) >= 0.5;
 }
 
@@ -87,6 +237,9 @@ bool SmoothTerrainSurface::IsForest(glm::vec2 position) const
 bool SmoothTerrainSurface::IsImpassable(glm::vec2 position) const
 {
 	glm::ivec2 coord = MapWorldToImage(position);
+	if (_map != nullptr)
+		return (_map->GetFlags(coord.x, coord.y) & SmoothTerrainFlagImpassable) != 0;
+	pin_tiles pin(*this);
 	return GetImpassableValue(coord.x, coord.y) >= 0.5;
 }
 
@@ -95,6 +248,11 @@ void SmoothTerrainSurface::Render(const glm::mat4x4& transform, const glm::vec3&
 {
 	glm::vec4 map_bounds = glm::vec4(_bounds.min, _bounds.size());
 
+	++_frame;
+	SelectChunks(transform);
+	TrimChunks();
+	TrimTiles();
+
 	glDepthMask(false);
 
 	terrain_uniforms shadow_uniforms;
@@ -108,37 +266,30 @@ void SmoothTerrainSurface::Render(const glm::mat4x4& transform, const glm::vec3&
 	terrain_uniforms uniforms;
 	uniforms._transform = transform;
 	uniforms._map_bounds = map_bounds;
+	uniforms._height_bounds = glm::vec2(_heightBounds.min, _heightBounds.size());
+	uniforms._grid_scale = 1.0f / (_size - 1);
 	uniforms._light_normal = lightNormal;
 	uniforms._colormap = _colormap;
 	uniforms._splatmap = _splatmap;
 
 
-	if (_framebuffer != nullptr)
-	{
-		UpdateDepthTextureSize();
-
-		bind_framebuffer binding(*_framebuffer);
-
-		glClear(GL_DEPTH_BUFFER_BIT);
-
-		terrain_uniforms du;
-		du._transform = uniforms._transform;
-		du._map_bounds = map_bounds;
+	for (terrain_chunk* chunk : _chunks)
+		if (chunk->_visible && chunk->_inside == 2)
+			_renderers->render_terrain_inside(chunk->_vbo, uniforms);
 
-		_renderers->render_depth_inside(_vboInside, du);
-		_renderers->render_depth_border(_vboBorder, du);
-
-		plain_uniforms pu;
-		pu._transform = uniforms._transform;
-		_renderers->render_depth_skirt(_vboSkirt, pu);
-	}
-
-	_renderers->render_terrain_inside(_vboInside, uniforms);
-	_renderers->render_terrain_border(_vboBorder, uniforms);
+	for (terrain_chunk* chunk : _chunks)
+		if (chunk->_visible && chunk->_inside == 1)
+			_renderers->render_terrain_border(chunk->_vbo, uniforms);
 
 	bool showLines = this == nullptr;
 	if (showLines)
 	{
+		if (_vboLines._vertices.empty())
+		{
+			InitializeLines();
+			_vboLines.update(GL_STATIC_DRAW);
+		}
+
 		glDisable(GL_DEPTH_TEST);
 		gradient_uniforms g;
 		g._transform = uniforms._transform;
@@ -151,11 +302,13 @@ void SmoothTerrainSurface::Render(const glm::mat4x4& transform, const glm::vec3&
 	tu._texture = _colormap;
 	_renderers->render_terrain_skirt(_vboSkirt, tu);
 
-	if (_depth != nullptr)
+	if (_renderEdges && _edgeDepth != nullptr)
 	{
 		glDisable(GL_DEPTH_TEST);
 		glDepthMask(false);
 
+		bind_framebuffer binding(*_edgeColorFramebuffer, _edgeFramebuffer->id);
+
 		vertexbuffer<texture_vertex> shape;
 		shape._mode = GL_TRIANGLE_STRIP;
 		shape._vertices.push_back(texture_vertex(glm::vec2(-1, 1), glm::vec2(0, 1)));
@@ -165,7 +318,8 @@ void SmoothTerrainSurface::Render(const glm::mat4x4& transform, const glm::vec3&
 
 		sobel_uniforms su;
 		su._transform = glm::mat4x4();
-		su._depth = _depth;
+		su._depth = _edgeDepth;
+		su._texel_size = 1.0f / glm::vec2(_edgeDepthSize);
 		_renderers->render_sobel_filter(shape, su);
 
 		glDepthMask(true);
@@ -176,91 +330,86 @@ void SmoothTerrainSurface::Render(const glm::mat4x4& transform, const glm::vec3&
 
 void SmoothTerrainSurface::Extract(glm::vec2 position, image* brush)
 {
-	glm::ivec2 size = brush->size();
-	glm::ivec2 origin = MapWorldToImage(position) - size / 2;
+	if (_groundmap == nullptr)
+		return;
+
+	pixel_view<rgba8> dst = brush->view();
+	glm::ivec2 origin = MapWorldToImage(position) - dst.size() / 2;
 
-	for (int x = 0; x < size.x; ++x)
-		for (int y = 0; y < size.y; ++y)
-			brush->set_pixel(x, y, _groundmap->get_pixel(origin.x + x, origin.y + y));
+	glm::ivec2 offset;
+	pixel_view<const rgba8> src = _groundmap->view().clip(origin.x, origin.y, dst.width(), dst.height(), offset);
+
+	if (src.width() != dst.width() || src.height() != dst.height())
+		fill_pixels(dst, rgba8());
+
+	if (!src.empty())
+		copy_pixels(dst.subview(offset.x, offset.y, src.width(), src.height()), src);
 }
 
 
 bounds2f SmoothTerrainSurface::Paint(TerrainFeature feature, glm::vec2 position, image* brush, float pressure)
 {
+	if (_groundmap == nullptr)
+		return bounds2f();
+
 	glm::vec2 scale = _bounds.size() / glm::vec2(_groundmap->size());
 	glm::ivec2 size = brush->size();
 	glm::ivec2 center = MapWorldToImage(position);
 	glm::ivec2 origin = center - size / 2;
 	float radius = size.x / 2.0f;
 
-	for (int x = 0; x < size.x; ++x)
-		for (int y = 0; y < size.y; ++y)
+	glm::ivec2 offset;
+	pixel_view<rgba8> dst = _groundmap->view().clip(origin.x, origin.y, size.x, size.y, offset);
+	if (dst.empty())
+		return bounds2_from_center(position, radius + 1);
+
+	pixel_view<const rgba8> src = brush->view().subview(offset.x, offset.y, dst.width(), dst.height());
+
+	std::vector<float> weights(dst.width() * dst.height());
+	for (int y = 0; y < dst.height(); ++y)
+		for (int x = 0; x < dst.width(); ++x)
 		{
-			glm::ivec2 p = origin + glm::ivec2(x, y);
+			glm::ivec2 p = origin + offset + glm::ivec2(x, y);
 			float d = glm::distance(position, scale * glm::vec2(p)) / radius;
 			float k = 1.0f - d * d;
-			if (k > 0)
-			{
-				glm::vec4 b = brush->get_pixel(x, y);
-				glm::vec4 c = _groundmap->get_pixel(p.x, p.y);
-				switch (feature)
-				{
-					case TerrainFeature::Hills:
-						c.a = glm::mix(c.a, b.a, k * pressure);
-						break;
-					case TerrainFeature::Trees:
-						c.g = glm::mix(c.g, b.g, k * pressure);
-						break;
-					case TerrainFeature::Water:
-						c.b = glm::mix(c.b, b.b, k * pressure);
-						break;
-					case TerrainFeature::Fords:
-						c.r = glm::mix(c.r, b.r, k * pressure);
-						break;
-				}
-				_groundmap->set_pixel(p.x, p.y, c);
-			}
+			weights[x + y * dst.width()] = k > 0 ? k * pressure : 0;
 		}
 
+	blend_channel(dst, src, feature_channel(feature), pixel_view<const float>(weights.data(), dst.width(), dst.height(), dst.width()));
+
 	return bounds2_from_center(position, radius + 1);
 }
 
 
 bounds2f SmoothTerrainSurface::Paint(TerrainFeature feature, glm::vec2 position, float radius, float pressure)
 {
+	if (_groundmap == nullptr)
+		return bounds2f();
+
 	glm::vec2 scale = _bounds.size() / glm::vec2(_groundmap->size());
 	float abs_pressure = glm::abs(pressure);
 
 	glm::ivec2 center = MapWorldToImage(position);
+	pixel_view<rgba8> ground = _groundmap->view();
+	int channel = feature_channel(feature);
 
-	float value = pressure > 0 ? 1 : 0;
-	float delta = pressure > 0 ? 0.015f : -0.015f;
+	float value = pressure > 0 ? 255 : 0;
+	float delta = pressure > 0 ? 0.015f * 255 : -0.015f * 255;
 
-	for (int x = -10; x <= 10; ++x)
-		for (int y = -10; y <= 10; ++y)
+	for (int y = -10; y <= 10; ++y)
+		for (int x = -10; x <= 10; ++x)
 		{
 			glm::ivec2 p = center + glm::ivec2(x, y);
+			if (!ground.contains(p.x, p.y))
+				continue;
+
 			float d = glm::distance(position, scale * glm::vec2(p)) / radius;
 			float k = 1.0f - d * d;
 			if (k > 0)
 			{
-				glm::vec4 c = _groundmap->get_pixel(p.x, p.y);
-				switch (feature)
-				{
-					case TerrainFeature::Hills:
-						c.a = glm::mix(c.a, c.a + delta, k * abs_pressure);
-						break;
-					case TerrainFeature::Trees:
-						c.g = glm::mix(c.g, value, k * abs_pressure);
-						break;
-					case TerrainFeature::Water:
-						c.b = glm::mix(c.b, value, k * abs_pressure);
-						break;
-					case TerrainFeature::Fords:
-						c.r = glm::mix(c.r, value, k * abs_pressure);
-						break;
-				}
-				_groundmap->set_pixel(p.x, p.y, c);
+				unsigned char& c = ground.at(p.x, p.y)[channel];
+				float target = feature == TerrainFeature::Hills ? c + delta : value;
+				c = round_clamp_255(glm::mix((float)c, target, k * abs_pressure));
 			}
 		}
 
@@ -271,151 +420,300 @@ bounds2f SmoothTerrainSurface::Paint(TerrainFeature feature, glm::vec2 position,
 glm::ivec2 SmoothTerrainSurface::MapWorldToImage(glm::vec2 position) const
 {
 	glm::vec2 p = (position - _bounds.min) / _bounds.size();
-	glm::ivec2 s = _groundmap->size();
+	glm::ivec2 s = _groundmapSize;
 	return glm::ivec2((int)(p.x * s.x), (int)(p.y * s.y));
 }
 
 
 
-#ifdef OPENWAR_USE_NSBUNDLE_RESOURCES // detect objective-c
-static NSString* FramebufferStatusString(GLenum status)
+void SmoothTerrainSurface::EnableRenderEdges()
+{
+	_renderEdges = true;
+}
+
+
+void SmoothTerrainSurface::SetEdgeDepth(framebuffer* target, framebuffer* colorTarget, texture* depth, glm::ivec2 size)
+{
+	_edgeFramebuffer = target;
+	_edgeColorFramebuffer = colorTarget;
+	_edgeDepth = depth;
+	_edgeDepthSize = size;
+}
+
+
+rgba8 SmoothTerrainSurface::GetGroundPixel(int x, int y) const
+{
+	if (_groundmap != nullptr)
+		return _groundmap->view().get(x, y);
+	return _pagedGroundmap->get(x, y);
+}
+
+
+float SmoothTerrainSurface::CalculateHeight(int x, int y) const
 {
-	switch (status)
+	rgba8 color;
+	int neighbours;
+	if (_groundmap != nullptr && 0 < x && x + 1 < _groundmapSize.x && 0 < y && y + 1 < _groundmapSize.y)
 	{
-		case GL_FRAMEBUFFER_COMPLETE:
-			return @"GL_FRAMEBUFFER_COMPLETE";
-		case GL_FRAMEBUFFER_INCOMPLETE_ATTACHMENT:
-			return @"GL_FRAMEBUFFER_INCOMPLETE_ATTACHMENT";
-		case GL_FRAMEBUFFER_INCOMPLETE_MISSING_ATTACHMENT:
-			return @"GL_FRAMEBUFFER_INCOMPLETE_MISSING_ATTACHMENT";
-#ifdef GL_FRAMEBUFFER_INCOMPLETE_DIMENSIONS
-		case GL_FRAMEBUFFER_INCOMPLETE_DIMENSIONS: return @"GL_FRAMEBUFFER_INCOMPLETE_DIMENSIONS";
-#endif
-		case GL_FRAMEBUFFER_UNSUPPORTED:
-			return @"GL_FRAMEBUFFER_UNSUPPORTED";
-		default:
-			return [NSString stringWithFormat:@"0x%04x", (unsigned int)status];
+		pixel_view<const rgba8> ground = _groundmap->view();
+		const rgba8* row = ground.row(y);
+		color = row[x];
+		neighbours = row[x - 1].a + row[x + 1].a + ground.row(y - 1)[x].a + ground.row(y + 1)[x].a;
+	}
+	else
+	{
+		color = GetGroundPixel(x, y);
+		neighbours = GetGroundPixel(x - 1, y).a + GetGroundPixel(x + 1, y).a + GetGroundPixel(x, y - 1).a + GetGroundPixel(x, y + 1).a;
 	}
+
+	float alpha = (0.5f * color.a + 0.125f * neighbours) / 255.0f;
+
+	float height = 0.5f + 124.5f * alpha;
+
+	float water = color.b / 255.0f;
+	height = glm::mix(height, -2.5f, water);
+
+	float fords = color.r / 255.0f;
+	height = glm::mix(height, -0.5f, fords);
+
+	return height;
 }
-#endif
 
 
+terrain_tile::terrain_tile() :
+_lastUsed(0)
+{
+}
+
 
-void SmoothTerrainSurface::EnableRenderEdges()
+void SmoothTerrainSurface::InitializeTiles()
 {
-	_depth = new texture();
-	glBindTexture(GL_TEXTURE_2D, _depth->id);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	int n = _size - 1;
+	while (n % _chunkSize != 0)
+		_chunkSize /= 2;
 
-	UpdateDepthTextureSize();
+	_chunkCount = n / _chunkSize;
 
-	_framebuffer = new framebuffer();
+	int count = _chunkCount * _chunkCount;
+	_tiles = new std::atomic<terrain_tile*>[count];
+	for (int i = 0; i < count; ++i)
+		_tiles[i].store(nullptr);
 
-#if !TARGET_OS_IPHONE
-	_colorbuffer = new renderbuffer(GL_RGBA, _framebuffer_width, _framebuffer_height);
-	_framebuffer->attach_color(_colorbuffer);
-#endif
+	_epoch.store(0);
+	_readers[0].store(0);
+	_readers[1].store(0);
 
-	_framebuffer->attach_depth(_depth);
-	{
-		bind_framebuffer binding(*_framebuffer);
-		GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-		if (status != GL_FRAMEBUFFER_COMPLETE)
-		{
-#ifdef OPENWAR_USE_NSBUNDLE_RESOURCES
-			NSLog(@"CheckGLFramebuffer %@", FramebufferStatusString(status));
-#endif
-		}
-	}
+	_tileCapacity = _pagedGroundmap != nullptr ? glm::min(count, 512) : count;
+	_chunkCapacity = _pagedGroundmap != nullptr ? glm::min(count, 1024) : count;
 }
 
 
-void SmoothTerrainSurface::UpdateHeights()
+// Heights are calculated from the groundmap at every other grid point and
+// interpolated in between. The tile computes its heights with a margin of
+// one grid point, so that the normals along its edges need no neighbours.
+
+void SmoothTerrainSurface::LoadTile(int tx, int ty, terrain_tile& tile) const
 {
 	int n = _size - 1;
+	int k = _chunkSize + 1;
 
-	for (int x = 0; x <= n; x += 2)
-		for (int y = 0; y <= n; y += 2)
-		{
-			int i = x + y * _size;
-			_heights[i] = CalculateHeight(x, y);
-		}
+	if (_map != nullptr)
+	{
+		const float* heights = _map->GetTileHeights(tx, ty);
+		const glm::vec3* normals = _map->GetTileNormals(tx, ty);
+		tile._heights.assign(heights, heights + k * k);
+		tile._normals.assign(normals, normals + k * k);
+		return;
+	}
+
+	glm::ivec2 origin = glm::ivec2(tx, ty) * _chunkSize;
+	glm::ivec2 min = glm::max(origin - 1, glm::ivec2(0));
+	glm::ivec2 max = glm::min(origin + _chunkSize + 1, glm::ivec2(n));
+
+	// calculated points need one more point of margin for the interpolation
+	glm::ivec2 min2 = glm::max(min - 1, glm::ivec2(0));
+	glm::ivec2 max2 = glm::min(max + 1, glm::ivec2(n));
+	int width = max2.x - min2.x + 1;
 
-	for (int x = 1; x < n; x += 2)
-		for (int y = 1; y < n; y += 2)
+	std::vector<float> heights(width * (max2.y - min2.y + 1));
+	for (int y = min2.y; y <= max2.y; ++y)
+		for (int x = min2.x + ((min2.x ^ y) & 1); x <= max2.x; x += 2)
+			heights[(x - min2.x) + (y - min2.y) * width] = CalculateHeight(x, y);
+
+	for (int y = min.y; y <= max.y; ++y)
+		for (int x = min.x + ((min.x ^ y ^ 1) & 1); x <= max.x; x += 2)
 		{
-			int i = x + y * _size;
-			_heights[i] = CalculateHeight(x, y);
+			int i = (x - min2.x) + (y - min2.y) * width;
+			if ((y & 1) == 0)
+				heights[i] = 0.5f * (heights[i - 1] + heights[i + 1]);
+			else
+				heights[i] = 0.5f * (heights[i - width] + heights[i + width]);
 		}
 
-	for (int y = 0; y <= n; y += 2)
-		for (int x = 1; x < n; x += 2)
+	glm::vec2 delta = 2.0f * _bounds.size() / (float)n;
+
+	tile._heights.resize(k * k);
+	tile._normals.resize(k * k);
+
+	for (int y = 0; y < k; ++y)
+		for (int x = 0; x < k; ++x)
 		{
-			int i = x + y * _size;
-			_heights[i] = 0.5f * (_heights[i - 1] + _heights[i + 1]);
+			int gx = origin.x + x;
+			int gy = origin.y + y;
+			int index = (gx - min2.x) + (gy - min2.y) * width;
+
+			int index_xn = gx != 0 ? index - 1 : index;
+			int index_xp = gx != n ? index + 1 : index;
+			int index_yn = gy != 0 ? index - width : index;
+			int index_yp = gy != n ? index + width : index;
+
+			float delta_hx = heights[index_xp] - heights[index_xn];
+			float delta_hy = heights[index_yp] - heights[index_yn];
+
+			glm::vec3 v1 = glm::vec3(delta.x, 0, delta_hx);
+			glm::vec3 v2 = glm::vec3(0, delta.y, delta_hy);
+
+			tile._heights[x + y * k] = heights[index];
+			tile._normals[x + y * k] = glm::normalize(glm::cross(v1, v2));
 		}
+}
 
-	for (int y = 1; y < n; y += 2)
-		for (int x = 0; x <= n; x += 2)
+
+// Recalculates the resident tiles that cover grid points [min, max].
+
+void SmoothTerrainSurface::ReloadTiles(glm::ivec2 min, glm::ivec2 max)
+{
+	glm::ivec2 t0 = glm::ivec2(GetTileCoord(glm::max(min.x, 0)), GetTileCoord(glm::max(min.y, 0)));
+	glm::ivec2 t1 = glm::ivec2(GetTileCoord(glm::min(max.x, _size - 1)), GetTileCoord(glm::min(max.y, _size - 1)));
+	int columns = t1.x - t0.x + 1;
+
+	thread_pool::shared().parallel_for(0, columns * (t1.y - t0.y + 1), 1, [this, t0, columns](int first, int last) {
+		for (int i = first; i < last; ++i)
 		{
-			int i = x + y * _size;
-			_heights[i] = 0.5f * (_heights[i - _size] + _heights[i + _size]);
+			int tx = t0.x + i % columns;
+			int ty = t0.y + i / columns;
+			terrain_tile* tile = _tiles[tx + ty * _chunkCount].load();
+			if (tile != nullptr)
+				LoadTile(tx, ty, *tile);
 		}
+	});
 }
 
 
-float SmoothTerrainSurface::CalculateHeight(int x, int y) const
-{
-	glm::vec4 color = _groundmap->get_pixel(x, y);
-	glm::vec4 color_xn = _groundmap->get_pixel(x - 1, y);
-	glm::vec4 color_xp = _groundmap->get_pixel(x + 1, y);
-	glm::vec4 color_yn = _groundmap->get_pixel(x, y - 1);
-	glm::vec4 color_yp = _groundmap->get_pixel(x, y + 1);
+// Evicts the least recently used tiles that were not read during the
+// current frame, until no more than _tileCapacity tiles are resident.
 
-	float alpha = 0.5 * color.a + 0.125 * (color_xn.a + color_xp.a + color_yn.a + color_yp.a);
+void SmoothTerrainSurface::TrimTiles()
+{
+	ReclaimTiles();
 
-	float height = 0.5f + 124.5f * alpha;
+	int excess = _residentTiles.load() - _tileCapacity;
+	if (excess <= 0)
+		return;
 
-	float water = color.b;
-	height = glm::mix(height, -2.5f, water);
+	std::vector<std::pair<unsigned, int>> candidates;
+	for (int i = 0; i < _chunkCount * _chunkCount; ++i)
+	{
+		terrain_tile* tile = _tiles[i].load();
+		if (tile != nullptr && tile->_lastUsed.load(std::memory_order_relaxed) != _frame)
+			candidates.push_back(std::make_pair(tile->_lastUsed.load(std::memory_order_relaxed), i));
+	}
 
-	float fords = color.r;
-	height = glm::mix(height, -0.5f, fords);
+	std::sort(candidates.begin(), candidates.end());
 
-	return height;
+	for (int i = 0; i < excess && i < (int)candidates.size(); ++i)
+	{
+		_retiredTiles[_epoch.load() & 1].push_back(_tiles[candidates[i].second].exchange(nullptr));
+		--_residentTiles;
+	}
 }
 
 
-void SmoothTerrainSurface::UpdateNormals()
+// The epoch advances when no reader is left from the epoch before it.
+// Tiles evicted then were unlinked before any reader of the current epoch
+// started, and are deleted.
+
+void SmoothTerrainSurface::ReclaimTiles()
 {
-	glm::vec2 size = _bounds.size();
+	unsigned epoch = _epoch.load();
+	if (_readers[(epoch + 1) & 1].load() != 0)
+		return;
 
-	int n = _size - 1;
-	float k = n;
-	glm::vec2 delta = 2.0f * size / k;
-	int index = 0;
-	for (int y = 0; y <= n; ++y)
+	_epoch.store(epoch + 1);
+
+	std::vector<terrain_tile*>& retired = _retiredTiles[(epoch + 1) & 1];
+	for (terrain_tile* tile : retired)
+		delete tile;
+	retired.clear();
+}
+
+
+// A reader that loaded the epoch just before it advanced counts itself in
+// the old epoch, and is not let in, since its count may already have been
+// checked.
+
+SmoothTerrainSurface::pin_tiles::pin_tiles(const SmoothTerrainSurface& surface) :
+_surface(surface),
+_epoch(0)
+{
+	for (;;)
 	{
-		for (int x = 0; x <= n; ++x)
-		{
-			int index_xn = x != 0 ? index - 1 : index;
-			int index_xp = x != n ? index + 1 : index;
-			int index_yn = y != 0 ? index - _size : index;
-			int index_yp = y != n ? index + _size : index;
+		_epoch = _surface._epoch.load();
+		++_surface._readers[_epoch & 1];
+		if (_surface._epoch.load() == _epoch)
+			break;
+		--_surface._readers[_epoch & 1];
+	}
+}
 
-			float delta_hx = _heights[index_xp] - _heights[index_xn];
-			float delta_hy = _heights[index_yp] - _heights[index_yn];
 
-			glm::vec3 v1 = glm::vec3(delta.x, 0, delta_hx);
-			glm::vec3 v2 = glm::vec3(0, delta.y, delta_hy);
+SmoothTerrainSurface::pin_tiles::~pin_tiles()
+{
+	--_surface._readers[_epoch & 1];
+}
+
+
+// Loads missing tiles without locking. When two threads load the same
+// tile, one of them publishes its copy and the other discards its own.
 
-			_normals[index++] = glm::normalize(glm::cross(v1, v2));
+terrain_tile* SmoothTerrainSurface::GetTile(int tx, int ty) const
+{
+	std::atomic<terrain_tile*>& slot = _tiles[tx + ty * _chunkCount];
+
+	terrain_tile* tile = slot.load();
+	if (tile == nullptr)
+	{
+		terrain_tile* loaded = new terrain_tile();
+		LoadTile(tx, ty, *loaded);
+		if (slot.compare_exchange_strong(tile, loaded))
+		{
+			tile = loaded;
+			++_residentTiles;
+		}
+		else
+		{
+			delete loaded;
 		}
 	}
+
+	tile->_lastUsed.store(_frame.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	return tile;
+}
+
+
+float SmoothTerrainSurface::GetHeight(int x, int y) const
+{
+	int tx = GetTileCoord(x);
+	int ty = GetTileCoord(y);
+	return GetTile(tx, ty)->_heights[(x - tx * _chunkSize) + (y - ty * _chunkSize) * (_chunkSize + 1)];
+}
+
+
+glm::vec3 SmoothTerrainSurface::GetNormal(int x, int y) const
+{
+	int tx = GetTileCoord(x);
+	int ty = GetTileCoord(y);
+	return GetTile(tx, ty)->_normals[(x - tx * _chunkSize) + (y - ty * _chunkSize) * (_chunkSize + 1)];
 }
 
 
@@ -484,19 +782,17 @@ static bool almost_zero(float value)
 }
 
 
-const float* SmoothTerrainSurface::InternalIntersect(ray r)
+intersection SmoothTerrainSurface::InternalIntersect(ray r) const
 {
-	static float result;
-
 	bounds1f height = bounds1f(-2.5f, 250);
 	bounds2f bounds(0, 0, _size - 1, _size - 1);
 	bounds2f quad(-0.01f, -0.01f, 1.01f, 1.01f);
 
-	const float* d = ::intersect(r, bounds3f(bounds, height));
-	if (d == nullptr)
-		return nullptr;
+	intersection i = ::intersect(r, bounds3f(bounds, height));
+	if (!i.hit)
+		return intersection();
 
-	glm::vec3 p = r.point(*d);
+	glm::vec3 p = i.point;
 
 	bounds2f bounds_2(0, 0, _size - 2, _size - 2);
 
@@ -516,50 +812,38 @@ const float* SmoothTerrainSurface::InternalIntersect(ray r)
 
 		if ((x & 1) == (y & 1))
 		{
-			d = ::intersect(r, plane(p00, p10, p11));
-			if (d != nullptr)
+			i = ::intersect(r, plane(p00, p10, p11));
+			if (i.hit)
 			{
-				glm::vec2 rel = (r.point(*d) - p00).xy();
+				glm::vec2 rel = (i.point - p00).xy();
 				if (quad.contains(rel) && rel.x >= rel.y)
-				{
-					result = *d;
-					return &result;
-				}
+					return i;
 			}
 
-			d = ::intersect(r, plane(p00, p11, p01));
-			if (d != nullptr)
+			i = ::intersect(r, plane(p00, p11, p01));
+			if (i.hit)
 			{
-				glm::vec2 rel = (r.point(*d) - p00).xy();
+				glm::vec2 rel = (i.point - p00).xy();
 				if (quad.contains(rel) && rel.x <= rel.y)
-				{
-					result = *d;
-					return &result;
-				}
+					return i;
 			}
 		}
 		else
 		{
-			d = ::intersect(r, plane(p11, p01, p10));
-			if (d != nullptr)
+			i = ::intersect(r, plane(p11, p01, p10));
+			if (i.hit)
 			{
-				glm::vec2 rel = (r.point(*d) - p00).xy();
+				glm::vec2 rel = (i.point - p00).xy();
 				if (quad.contains(rel) && rel.x >= 1 - rel.y)
-				{
-					result = *d;
-					return &result;
-				}
+					return i;
 			}
 
-			d = ::intersect(r, plane(p00, p10, p01));
-			if (d != nullptr)
+			i = ::intersect(r, plane(p00, p10, p01));
+			if (i.hit)
 			{
-				glm::vec2 rel = (r.point(*d) - p00).xy();
+				glm::vec2 rel = (i.point - p00).xy();
 				if (quad.contains(rel) && rel.x <= 1 - rel.y)
-				{
-					result = *d;
-					return &result;
-				}
+					return i;
 			}
 		}
 
@@ -578,34 +862,11 @@ const float* SmoothTerrainSurface::InternalIntersect(ray r)
 		}
 	}
 
-	return nullptr;
+	return intersection();
 }
 
 
 
-void SmoothTerrainSurface::UpdateDepthTextureSize()
-{
-	if (_depth != nullptr)
-	{
-		GLint viewport[4];
-		glGetIntegerv(GL_VIEWPORT, viewport);
-
-		if (viewport[2] != _framebuffer_width || viewport[3] != _framebuffer_height)
-		{
-			_framebuffer_width = viewport[2];
-			_framebuffer_height = viewport[3];
-
-			glBindTexture(GL_TEXTURE_2D, _depth->id);
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, _framebuffer_width, _framebuffer_height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_SHORT, NULL);
-			glBindTexture(GL_TEXTURE_2D, 0);
-
-			if (_colorbuffer != nullptr)
-				_colorbuffer->resize(GL_RGBA, _framebuffer_width, _framebuffer_height);
-		}
-	}
-}
-
-
 void SmoothTerrainSurface::InitializeShadow()
 {
 	glm::vec2 center = _bounds.center();
@@ -633,8 +894,6 @@ void SmoothTerrainSurface::InitializeShadow()
 		_vboShadow._vertices.push_back(plain_vertex(p4));
 		_vboShadow._vertices.push_back(plain_vertex(p1));
 	}
-
-	_vboShadow.update(GL_STATIC_DRAW);
 }
 
 
@@ -643,70 +902,101 @@ void SmoothTerrainSurface::InitializeSkirt()
 	glm::vec2 center = _bounds.center();
 	float radius = _bounds.width() / 2;
 
-	_vboSkirt._mode = GL_TRIANGLE_STRIP;
-	_vboSkirt._vertices.clear();
-
 	int n = 1024;
 	float d = 2 * (float)M_PI / n;
-	for (int i = 0; i < n; ++i)
-	{
-		float a = d * i;
-		glm::vec2 p = center + radius * vector2_from_angle(a);
-		float h = fmaxf(0, InterpolateHeight(p));
 
-		_vboSkirt._vertices.push_back(skirt_vertex(glm::vec3(p, h + 0.5), h));
-		_vboSkirt._vertices.push_back(skirt_vertex(glm::vec3(p, -2.5), h));
-	}
+	_vboSkirt._mode = GL_TRIANGLE_STRIP;
+	_vboSkirt._vertices.resize(2 * n + 2);
+
+	skirt_vertex* vertices = _vboSkirt._vertices.data();
+	thread_pool::shared().parallel_for(0, n, 64, [this, center, radius, d, vertices](int first, int last) {
+		for (int i = first; i < last; ++i)
+		{
+			float a = d * i;
+			glm::vec2 p = center + radius * vector2_from_angle(a);
+			float h = fmaxf(0, InterpolateHeight(p));
 
-	_vboSkirt._vertices.push_back(_vboSkirt._vertices[0]);
-	_vboSkirt._vertices.push_back(_vboSkirt._vertices[1]);
+			vertices[2 * i] = skirt_vertex(glm::vec3(p, h + 0.5), h);
+			vertices[2 * i + 1] = skirt_vertex(glm::vec3(p, -2.5), h);
+		}
+	});
 
-	_vboSkirt.update(GL_STATIC_DRAW);
+	vertices[2 * n] = vertices[0];
+	vertices[2 * n + 1] = vertices[1];
 }
 
 
 void SmoothTerrainSurface::UpdateSplatmap()
 {
-	glm::ivec2 size = _groundmap->size();
+	std::vector<GLubyte> data;
+	BuildSplatmap(glm::ivec2(), _groundmapSize, data);
+	UploadSplatmap(glm::ivec2(), _groundmapSize, data.data());
+}
 
-	GLubyte* data = new GLubyte[4 * size.x * size.y];
-	if (data != nullptr)
-	{
-		GLubyte* p = data;
-		for (int y = 0; y < size.y; ++y)
+
+void SmoothTerrainSurface::BuildSplatmap(glm::ivec2 origin, glm::ivec2 size, std::vector<GLubyte>& data) const
+{
+	data.resize(4 * size.x * size.y);
+
+	GLubyte* pixels = data.data();
+	thread_pool::shared().parallel_for(0, size.y, 16, [this, origin, size, pixels](int first, int last) {
+		for (int y = first; y < last; ++y)
+		{
+			GLubyte* p = pixels + 4 * size.x * y;
 			for (int x = 0; x < size.x; ++x)
 			{
-				float forest = GetForestValue(x, y);
-				float block = GetImpassableValue(x, y);
+				glm::ivec2 q = origin + glm::ivec2(x, y);
+				rgba8 c = GetGroundPixel(q.x, q.y);
+				GLubyte forest = c.g;
+				float block = GetImpassableValue(c, q.x, q.y);
 				*p++ = (GLubyte)(255.0f * block);
-				*p++ = (GLubyte)(255.0f * forest);
-				*p++ = (GLubyte)(255.0f * forest);
-				*p++ = (GLubyte)(255.0f * forest);
+				*p++ = forest;
+				*p++ = forest;
+				*p++ = forest;
 			}
+		}
+	});
+}
 
-		glBindTexture(GL_TEXTURE_2D, _splatmap->id);
-		CHECK_ERROR_GL();
+
+// Uploading the whole splatmap (re)allocates the texture, and null 'data'
+// leaves its contents undefined. Uploading a part of it leaves the mipmaps
+// for the caller to regenerate.
+
+void SmoothTerrainSurface::UploadSplatmap(glm::ivec2 origin, glm::ivec2 size, const GLubyte* data)
+{
+	glstate::shared().bind_texture(_splatmap->id);
+
+	if (origin == glm::ivec2() && size == _groundmapSize)
+	{
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, size.x, size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
 		CHECK_ERROR_GL();
 		glGenerateMipmap(GL_TEXTURE_2D);
 		CHECK_ERROR_GL();
-
-		delete[] data;
+	}
+	else
+	{
+		glTexSubImage2D(GL_TEXTURE_2D, 0, origin.x, origin.y, size.x, size.y, GL_RGBA, GL_UNSIGNED_BYTE, data);
+		CHECK_ERROR_GL();
 	}
 }
 
 
 float SmoothTerrainSurface::GetForestValue(int x, int y) const
 {
-	glm::vec4 c = _groundmap->get_pixel(x, y);
-	return c.g;
+	return GetGroundPixel(x, y).g / 255.0f;
 }
 
 
 float SmoothTerrainSurface::GetImpassableValue(int x, int y) const
 {
-	glm::vec4 c = _groundmap->get_pixel(x, y);
-	if (c.b >= 0.5f && c.r < 0.5f)
+	return GetImpassableValue(GetGroundPixel(x, y), x, y);
+}
+
+
+float SmoothTerrainSurface::GetImpassableValue(rgba8 c, int x, int y) const
+{
+	if (c.b >= 128 && c.r < 128)
 		return 1.0f;
 
 	glm::vec3 n = GetNormal(x, y);
@@ -717,35 +1007,37 @@ float SmoothTerrainSurface::GetImpassableValue(int x, int y) const
 
 void SmoothTerrainSurface::UpdateChanges(bounds2f bounds)
 {
-	UpdateHeights();
-	UpdateNormals();
+	// heights depend on the groundmap two points away, and normals
+	// on the heights one point away
+	float n = _size - 1;
+	glm::ivec2 min = glm::ivec2(glm::floor(n * (bounds.min - _bounds.min) / _bounds.size())) - 4;
+	glm::ivec2 max = glm::ivec2(glm::ceil(n * (bounds.max - _bounds.min) / _bounds.size())) + 4;
 
-	InitializeSkirt();
-	UpdateSplatmap();
+	ReloadTiles(min, max);
 
-// inside
-	for (terrain_vertex& vertex : _vboInside._vertices)
+// splatmap
+	glm::ivec2 origin = glm::max(min, glm::ivec2(0));
+	glm::ivec2 size = glm::min(max + 1, _groundmapSize) - origin;
+	if (size.x > 0 && size.y > 0)
 	{
-		glm::vec2 p = vertex._position.xy();
-		if (bounds.contains(p))
-		{
-			vertex._position.z = GetHeight(vertex._x, vertex._y);
-			vertex._normal = GetNormal(vertex._x, vertex._y);
-		}
+		std::vector<GLubyte> splatmap;
+		BuildSplatmap(origin, size, splatmap);
+		UploadSplatmap(origin, size, splatmap.data());
+		glGenerateMipmap(GL_TEXTURE_2D);
+		CHECK_ERROR_GL();
 	}
-	_vboInside.update(GL_STATIC_DRAW);
 
-// border
-	for (terrain_vertex& vertex : _vboBorder._vertices)
+// chunks
+	for (terrain_chunk* chunk : _chunks)
 	{
-		glm::vec2 p = vertex._position.xy();
-		if (bounds.contains(p))
+		glm::ivec2 p0 = chunk->_origin;
+		glm::ivec2 p1 = chunk->_origin + _chunkSize;
+		if (chunk->_resident && p0.x <= max.x && min.x <= p1.x && p0.y <= max.y && min.y <= p1.y)
 		{
-			vertex._position.z = GetHeight(vertex._x, vertex._y);
-			vertex._normal = GetNormal(vertex._x, vertex._y);
+			UpdateChunkVertices(*chunk);
+			chunk->_vbo.update(GL_STATIC_DRAW);
 		}
 	}
-	_vboBorder.update(GL_STATIC_DRAW);
 
 // lines
 	for (color_vertex3& vertex : _vboLines._vertices)
@@ -756,7 +1048,8 @@ void SmoothTerrainSurface::UpdateChanges(bounds2f bounds)
 			vertex._position.z = InterpolateHeight(p);
 		}
 	}
-	_vboLines.update(GL_STATIC_DRAW);
+	if (!_vboLines._vertices.empty())
+		_vboLines.update(GL_STATIC_DRAW);
 
 // skirt
 	for (size_t i = 0; i < _vboSkirt._vertices.size(); i += 2)
@@ -780,148 +1073,477 @@ void SmoothTerrainSurface::InitializeLines()
 
 	glm::vec4 black(0, 0, 0, 0.06f);
 
-	_vboLines._mode = GL_LINES;
-	_vboLines._vertices.clear();
 	int n = _size - 1;
 	float k = n;
-	for (int x = 0; x <= n; x += 2)
-		for (int y = 0; y <= n; y += 2)
-		{
-			float x0 = corner.x + size.x * (x / k);
-			float y0 = corner.y + size.y * (y / k);
-			float h00 = GetHeight(x, y);
 
-			float x2, h20;
-			if (x != n)
-			{
-				x2 = corner.x + size.x * ((x + 2) / k);
-				h20 = GetHeight(x + 2, y);
-				_vboLines._vertices.push_back(color_vertex3(glm::vec3(x0, y0, h00), black));
-				_vboLines._vertices.push_back(color_vertex3(glm::vec3(x2, y0, h20), black));
-			}
-			float y2, h02;
-			if (y != n)
-			{
-				y2 = corner.y + size.y * ((y + 2) / k);
-				h02 = GetHeight(x, y + 2);
-				_vboLines._vertices.push_back(color_vertex3(glm::vec3(x0, y0, h00), black));
-				_vboLines._vertices.push_back(color_vertex3(glm::vec3(x0, y2, h02), black));
-			}
+	// one vertex list per even row, joined in row order afterwards
+	std::vector<std::vector<color_vertex3>> rows(n / 2 + 1);
 
-			if (x != n && y != n)
+	thread_pool::shared().parallel_for(0, (int)rows.size(), 8, [this, corner, size, black, n, k, &rows](int first, int last) {
+		for (int row = first; row < last; ++row)
+		{
+			std::vector<color_vertex3>& vertices = rows[row];
+			int y = 2 * row;
+			for (int x = 0; x <= n; x += 2)
 			{
-				float x1 = corner.x + size.x * ((x + 1) / k);
-				float y1 = corner.y + size.y * ((y + 1) / k);
-				float h11 = GetHeight(x + 1, y + 1);
-				float h22 = GetHeight(x + 2, y + 2);
+				float x0 = corner.x + size.x * (x / k);
+				float y0 = corner.y + size.y * (y / k);
+				float h00 = GetHeight(x, y);
 
-				_vboLines._vertices.push_back(color_vertex3(glm::vec3(x0, y0, h00), black));
-				_vboLines._vertices.push_back(color_vertex3(glm::vec3(x1, y1, h11), black));
+				float x2, h20;
+				if (x != n)
+				{
+					x2 = corner.x + size.x * ((x + 2) / k);
+					h20 = GetHeight(x + 2, y);
+					vertices.push_back(color_vertex3(glm::vec3(x0, y0, h00), black));
+					vertices.push_back(color_vertex3(glm::vec3(x2, y0, h20), black));
+				}
+				float y2, h02;
+				if (y != n)
+				{
+					y2 = corner.y + size.y * ((y + 2) / k);
+					h02 = GetHeight(x, y + 2);
+					vertices.push_back(color_vertex3(glm::vec3(x0, y0, h00), black));
+					vertices.push_back(color_vertex3(glm::vec3(x0, y2, h02), black));
+				}
 
-				_vboLines._vertices.push_back(color_vertex3(glm::vec3(x2, y0, h20), black));
-				_vboLines._vertices.push_back(color_vertex3(glm::vec3(x1, y1, h11), black));
+				if (x != n && y != n)
+				{
+					float x1 = corner.x + size.x * ((x + 1) / k);
+					float y1 = corner.y + size.y * ((y + 1) / k);
+					float h11 = GetHeight(x + 1, y + 1);
+					float h22 = GetHeight(x + 2, y + 2);
+
+					vertices.push_back(color_vertex3(glm::vec3(x0, y0, h00), black));
+					vertices.push_back(color_vertex3(glm::vec3(x1, y1, h11), black));
+
+					vertices.push_back(color_vertex3(glm::vec3(x2, y0, h20), black));
+					vertices.push_back(color_vertex3(glm::vec3(x1, y1, h11), black));
 
-				_vboLines._vertices.push_back(color_vertex3(glm::vec3(x0, y2, h02), black));
-				_vboLines._vertices.push_back(color_vertex3(glm::vec3(x1, y1, h11), black));
+					vertices.push_back(color_vertex3(glm::vec3(x0, y2, h02), black));
+					vertices.push_back(color_vertex3(glm::vec3(x1, y1, h11), black));
 
-				_vboLines._vertices.push_back(color_vertex3(glm::vec3(x2, y2, h22), black));
-				_vboLines._vertices.push_back(color_vertex3(glm::vec3(x1, y1, h11), black));
+					vertices.push_back(color_vertex3(glm::vec3(x2, y2, h22), black));
+					vertices.push_back(color_vertex3(glm::vec3(x1, y1, h11), black));
+				}
 			}
 		}
-	_vboLines.update(GL_STATIC_DRAW);
+	});
+
+	_vboLines._mode = GL_LINES;
+	_vboLines._vertices.clear();
+	for (const std::vector<color_vertex3>& vertices : rows)
+		_vboLines._vertices.insert(_vboLines._vertices.end(), vertices.begin(), vertices.end());
 }
 
 
-static int inside_circle(bounds2f bounds, glm::vec2 p)
+terrain_chunk::terrain_chunk(glm::ivec2 origin) :
+_origin(origin),
+_inside(0),
+_visible(false),
+_lod(0),
+_stitch(0),
+_indexKey(-1),
+_resident(false),
+_lastVisible(0)
 {
-	return glm::length(p - bounds.center()) <= bounds.width() / 2 ? 1 : 0;
 }
 
 
-static int inside_circle(bounds2f bounds, terrain_vertex v1, terrain_vertex v2, terrain_vertex v3)
+void SmoothTerrainSurface::InitializeChunks()
 {
-	return inside_circle(bounds, v1._position.xy())
-		+ inside_circle(bounds, v2._position.xy())
-		+ inside_circle(bounds, v3._position.xy());
+	for (terrain_chunk* chunk : _chunks)
+		delete chunk;
+	_chunks.clear();
+
+	glm::vec2 center = _bounds.center();
+	float radius = _bounds.width() / 2;
+
+	for (int y = 0; y < _chunkCount; ++y)
+		for (int x = 0; x < _chunkCount; ++x)
+		{
+			terrain_chunk* chunk = new terrain_chunk(glm::ivec2(x, y) * _chunkSize);
 
+			glm::vec2 p0 = GetGridPosition(chunk->_origin.x, chunk->_origin.y);
+			glm::vec2 p1 = GetGridPosition(chunk->_origin.x + _chunkSize, chunk->_origin.y + _chunkSize);
+
+			// 2 = inside the map circle, 1 = crossing its border, 0 = outside
+			float nearest = glm::distance(center, glm::clamp(center, p0, p1));
+			float furthest = glm::distance(center, glm::max(glm::abs(p0 - center), glm::abs(p1 - center)) + center);
+			chunk->_inside = furthest <= radius ? 2 : nearest <= radius ? 1 : 0;
+
+			// conservative until the vertices are loaded
+			chunk->_bounds = bounds3f(glm::vec3(p0, _heightBounds.min), glm::vec3(p1, _heightBounds.max));
+			chunk->_vbo._mode = GL_TRIANGLES;
+
+			_chunks.push_back(chunk);
+		}
+
+	_residentChunks = 0;
+
+	if (_pagedGroundmap == nullptr)
+	{
+		std::vector<terrain_chunk*> chunks;
+		for (terrain_chunk* chunk : _chunks)
+			if (chunk->_inside != 0)
+				chunks.push_back(chunk);
+		LoadChunks(chunks);
+	}
 }
 
 
-void SmoothTerrainSurface::BuildTriangles()
+// Builds the vertices of the chunks on the thread pool, and uploads them
+// together with their part of the splatmap when the groundmap is paged.
+
+void SmoothTerrainSurface::LoadChunks(const std::vector<terrain_chunk*>& chunks)
 {
-	glm::vec2 corner = _bounds.p11();
-	glm::vec2 size = _bounds.size();
+	if (chunks.empty())
+		return;
+
+	// compiled maps upload the whole splatmap up front
+	bool paged = _pagedGroundmap != nullptr && _map == nullptr;
+	std::vector<std::vector<GLubyte>> splatmaps(paged ? chunks.size() : 0);
+	std::vector<glm::ivec2> origins(chunks.size());
+	std::vector<glm::ivec2> sizes(chunks.size());
+
+	for (size_t i = 0; i < chunks.size(); ++i)
+	{
+		// the last row and column of chunks also cover the
+		// last row and column of an odd sized groundmap
+		glm::ivec2 origin = chunks[i]->_origin;
+		glm::ivec2 end = origin + _chunkSize;
+		if (end.x == _size - 1)
+			end.x = _groundmapSize.x;
+		if (end.y == _size - 1)
+			end.y = _groundmapSize.y;
+
+		origins[i] = origin;
+		sizes[i] = glm::min(end, _groundmapSize) - origin;
+	}
 
-	_vboInside._mode = GL_TRIANGLES;
-	_vboInside._vertices.clear();
+	thread_pool::shared().parallel_for(0, (int)chunks.size(), 1, [this, paged, &chunks, &splatmaps, &origins, &sizes](int first, int last) {
+		for (int i = first; i < last; ++i)
+		{
+			if (_map != nullptr)
+				CopyChunkVertices(*chunks[i]);
+			else
+				UpdateChunkVertices(*chunks[i]);
+			if (paged)
+				BuildSplatmap(origins[i], sizes[i], splatmaps[i]);
+		}
+	});
 
-	_vboBorder._mode = GL_TRIANGLES;
-	_vboBorder._vertices.clear();
+	for (size_t i = 0; i < chunks.size(); ++i)
+	{
+		terrain_chunk* chunk = chunks[i];
+		chunk->_vbo._indices.clear();
+		chunk->_vbo.update(GL_STATIC_DRAW);
+		chunk->_indexKey = -1;
+		chunk->_resident = true;
+		++_residentChunks;
+
+		if (paged)
+			UploadSplatmap(origins[i], sizes[i], splatmaps[i].data());
+	}
 
-	int n = _size - 1;
-	float k = n;
+	if (paged)
+	{
+		glstate::shared().bind_texture(_splatmap->id);
+		glGenerateMipmap(GL_TEXTURE_2D);
+		CHECK_ERROR_GL();
+	}
 
-	for (int x = 0; x < n; x += 2)
-		for (int y = 0; y < n; y += 2)
+	profiler::shared().add_count("terrain.chunks.loaded", (int)chunks.size());
+}
+
+
+// Releases the vertices of the least recently visible chunks until no
+// more than _chunkCapacity chunks are resident.
+
+void SmoothTerrainSurface::TrimChunks()
+{
+	int excess = _residentChunks - _chunkCapacity;
+	if (excess <= 0)
+		return;
+
+	std::vector<std::pair<unsigned, int>> candidates;
+	for (int i = 0; i < (int)_chunks.size(); ++i)
+		if (_chunks[i]->_resident && !_chunks[i]->_visible)
+			candidates.push_back(std::make_pair(_chunks[i]->_lastVisible, i));
+
+	std::sort(candidates.begin(), candidates.end());
+
+	for (int i = 0; i < excess && i < (int)candidates.size(); ++i)
+	{
+		terrain_chunk* chunk = _chunks[candidates[i].second];
+		std::vector<terrain_vertex>().swap(chunk->_vbo._vertices);
+		std::vector<GLushort>().swap(chunk->_vbo._indices);
+		chunk->_vbo.update(GL_STATIC_DRAW);
+		chunk->_indexKey = -1;
+		chunk->_resident = false;
+		--_residentChunks;
+	}
+}
+
+
+void SmoothTerrainSurface::UpdateChunkVertices(terrain_chunk& chunk) const
+{
+	int k = _chunkSize + 1;
+	bounds1f height(std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
+
+	chunk._vbo._vertices.resize(k * k);
+	terrain_vertex* vertices = chunk._vbo._vertices.data();
+
+	for (int y = 0; y < k; ++y)
+		for (int x = 0; x < k; ++x)
+		{
+			int gx = chunk._origin.x + x;
+			int gy = chunk._origin.y + y;
+			float h = GetHeight(gx, gy);
+			height.min = glm::min(height.min, h);
+			height.max = glm::max(height.max, h);
+			*vertices++ = MakeTerrainVertex(gx, gy);
+		}
+
+	glm::vec2 p0 = GetGridPosition(chunk._origin.x, chunk._origin.y);
+	glm::vec2 p1 = GetGridPosition(chunk._origin.x + _chunkSize, chunk._origin.y + _chunkSize);
+	chunk._bounds = bounds3f(glm::vec3(p0, height.min), glm::vec3(p1, height.max));
+}
+
+
+void SmoothTerrainSurface::CopyChunkVertices(terrain_chunk& chunk) const
+{
+	int k = _chunkSize + 1;
+	int cx = chunk._origin.x / _chunkSize;
+	int cy = chunk._origin.y / _chunkSize;
+
+	const terrain_vertex* vertices = _map->GetChunkVertices(cx, cy);
+	chunk._vbo._vertices.assign(vertices, vertices + k * k);
+
+	bounds1f height = _map->GetChunkHeightBounds(cx, cy);
+	glm::vec2 p0 = GetGridPosition(chunk._origin.x, chunk._origin.y);
+	glm::vec2 p1 = GetGridPosition(chunk._origin.x + _chunkSize, chunk._origin.y + _chunkSize);
+	chunk._bounds = bounds3f(glm::vec3(p0, height.min), glm::vec3(p1, height.max));
+}
+
+
+terrain_chunk* SmoothTerrainSurface::GetChunk(int x, int y) const
+{
+	if (x < 0 || x >= _chunkCount || y < 0 || y >= _chunkCount)
+		return nullptr;
+	return _chunks[x + y * _chunkCount];
+}
+
+
+// Picks the level of detail of each chunk from its distance to the eye,
+// keeps neighbouring levels at most one apart, and marks the edges that
+// must be stitched to a coarser neighbour.
+
+void SmoothTerrainSurface::SelectChunks(const glm::mat4x4& transform)
+{
+	frustum view(transform);
+	glm::vec3 eye = eye_position(transform);
+	float step = _bounds.width() / (_size - 1);
+	int max_lod = GetMaxLod();
+
+	std::vector<terrain_chunk*> missing;
+	for (terrain_chunk* chunk : _chunks)
+	{
+		chunk->_visible = chunk->_inside != 0 && view.intersects(chunk->_bounds);
+		if (chunk->_visible)
+		{
+			chunk->_lastVisible = _frame;
+			if (!chunk->_resident)
+				missing.push_back(chunk);
+		}
+	}
+
+	LoadChunks(missing);
+
+	for (terrain_chunk* chunk : _chunks)
+	{
+		float d = glm::distance(eye, glm::clamp(eye, chunk->_bounds.min, chunk->_bounds.max));
+		float k = d / (_lodDistance * step);
+		chunk->_lod = k < 1 ? 0 : glm::min((int)glm::log2(k), max_lod);
+	}
+
+	bool changed = true;
+	while (changed)
+	{
+		changed = false;
+		for (int y = 0; y < _chunkCount; ++y)
+			for (int x = 0; x < _chunkCount; ++x)
+			{
+				terrain_chunk* chunk = GetChunk(x, y);
+				terrain_chunk* neighbours[4] = { GetChunk(x, y - 1), GetChunk(x + 1, y), GetChunk(x, y + 1), GetChunk(x - 1, y) };
+				for (terrain_chunk* neighbour : neighbours)
+					if (neighbour != nullptr && chunk->_lod > neighbour->_lod + 1)
+					{
+						chunk->_lod = neighbour->_lod + 1;
+						changed = true;
+					}
+			}
+	}
+
+	for (int y = 0; y < _chunkCount; ++y)
+		for (int x = 0; x < _chunkCount; ++x)
 		{
-			float x0 = corner.x + size.x * (x / k);
-			float x1 = corner.x + size.x * ((x + 1) / k);
-			float x2 = corner.x + size.x * ((x + 2) / k);
-			float y0 = corner.y + size.y * (y / k);
-			float y1 = corner.y + size.y * ((y + 1) / k);
-			float y2 = corner.y + size.y * ((y + 2) / k);
-
-			float h00 = GetHeight(x, y);
-			float h02 = GetHeight(x, y + 2);
-			float h20 = GetHeight(x + 2, y);
-			float h11 = GetHeight(x + 1, y + 1);
-			float h22 = GetHeight(x + 2, y + 2);
-
-			glm::vec3 n00 = GetNormal(x, y);
-			glm::vec3 n02 = GetNormal(x, y + 2);
-			glm::vec3 n20 = GetNormal(x + 2, y);
-			glm::vec3 n11 = GetNormal(x + 1, y + 1);
-			glm::vec3 n22 = GetNormal(x + 2, y + 2);
-
-			terrain_vertex v00 = terrain_vertex(x + 0, y + 0, glm::vec3(x0, y0, h00), n00);
-			terrain_vertex v02 = terrain_vertex(x + 0, y + 2, glm::vec3(x0, y2, h02), n02);
-			terrain_vertex v20 = terrain_vertex(x + 2, y + 0, glm::vec3(x2, y0, h20), n20);
-			terrain_vertex v11 = terrain_vertex(x + 1, y + 1, glm::vec3(x1, y1, h11), n11);
-			terrain_vertex v22 = terrain_vertex(x + 2, y + 2, glm::vec3(x2, y2, h22), n22);
-
-			PushTriangle(v00, v20, v11);
-			PushTriangle(v20, v22, v11);
-			PushTriangle(v22, v02, v11);
-			PushTriangle(v02, v00, v11);
+			terrain_chunk* chunk = GetChunk(x, y);
+			terrain_chunk* neighbours[4] = { GetChunk(x, y - 1), GetChunk(x + 1, y), GetChunk(x, y + 1), GetChunk(x - 1, y) };
+
+			chunk->_stitch = 0;
+			for (int edge = 0; edge < 4; ++edge)
+				if (neighbours[edge] != nullptr && neighbours[edge]->_lod > chunk->_lod)
+					chunk->_stitch |= 1 << edge;
+
+			int key = chunk->_lod * 16 + chunk->_stitch;
+			if (chunk->_visible && chunk->_indexKey != key)
+			{
+				chunk->_vbo._indices = GetChunkIndices(chunk->_lod, chunk->_stitch);
+				chunk->_vbo.update_indices(GL_STATIC_DRAW);
+				chunk->_indexKey = key;
+			}
 		}
+}
+
 
-	_vboInside.update(GL_STATIC_DRAW);
-	_vboBorder.update(GL_STATIC_DRAW);
+int SmoothTerrainSurface::GetMaxLod() const
+{
+	int result = 0;
+	while ((4 << result) <= _chunkSize)
+		++result;
+	return result;
 }
 
 
-void SmoothTerrainSurface::PushTriangle(const terrain_vertex& v0, const terrain_vertex& v1, const terrain_vertex& v2)
+const std::vector<GLushort>& SmoothTerrainSurface::GetChunkIndices(int lod, int stitch)
 {
-	vertexbuffer<terrain_vertex>* s = SelectTerrainVbo(inside_circle(_bounds, v0, v1, v2));
-	if (s != nullptr)
+	int key = lod * 16 + stitch;
+	std::vector<GLushort>& result = _chunkIndices[key];
+	if (result.empty())
 	{
-		s->_vertices.push_back(v0);
-		s->_vertices.push_back(v1);
-		s->_vertices.push_back(v2);
+		int count = 0;
+		const GLushort* indices = _map != nullptr ? _map->GetChunkIndices(key, count) : nullptr;
+		if (indices != nullptr && count != 0)
+			result.assign(indices, indices + count);
+		else
+			BuildChunkIndices(lod, stitch, result);
 	}
+	return result;
 }
 
 
-vertexbuffer<terrain_vertex>* SmoothTerrainSurface::SelectTerrainVbo(int inside)
+// Cell number i along an edge, counted in the direction from corner 'edge'
+// to corner 'edge + 1' of the chunk, with corners in counter-clockwise order.
+
+static glm::ivec2 edge_cell(int edge, int i, int m)
 {
-	switch (inside)
+	switch (edge)
 	{
+		case 0:
+			return glm::ivec2(i, 0);
 		case 1:
+			return glm::ivec2(m - 1, i);
 		case 2:
-			return &_vboBorder;
-		case 3:
-			return &_vboInside;
+			return glm::ivec2(m - 1 - i, m - 1);
 		default:
-			return nullptr;
+			return glm::ivec2(0, m - 1 - i);
 	}
 }
+
+
+static GLushort grid_index(glm::ivec2 p, int width)
+{
+	return (GLushort)(p.x + p.y * width);
+}
+
+
+// Cells at level of detail 'lod' are c = 2^(lod + 1) grid steps wide and
+// split into four triangles around the cell center, one per side. Along an
+// edge that borders a coarser chunk, pairs of cells replace their edge
+// triangles and the two triangles between them with three triangles whose
+// outer edge matches the coarser cell, so that no T-junctions remain.
+
+void SmoothTerrainSurface::BuildChunkIndices(int lod, int stitch, std::vector<GLushort>& indices) const
+{
+	int k = _chunkSize + 1;
+	int c = 2 << lod;
+	int m = _chunkSize / c;
+
+	std::vector<bool> skip(4 * m * m, false);
+
+	glm::ivec2 corners[4] = { glm::ivec2(0, 0), glm::ivec2(c, 0), glm::ivec2(c, c), glm::ivec2(0, c) };
+
+	indices.clear();
+
+	for (int edge = 0; edge < 4; ++edge)
+	{
+		if ((stitch & (1 << edge)) == 0)
+			continue;
+
+		for (int i = 0; i + 1 < m; i += 2)
+		{
+			glm::ivec2 cell0 = edge_cell(edge, i, m);
+			glm::ivec2 cell1 = edge_cell(edge, i + 1, m);
+			glm::ivec2 p0 = cell0 * c;
+			glm::ivec2 p1 = cell1 * c;
+
+			skip[4 * (cell0.x + cell0.y * m) + edge] = true;
+			skip[4 * (cell0.x + cell0.y * m) + (edge + 1) % 4] = true;
+			skip[4 * (cell1.x + cell1.y * m) + edge] = true;
+			skip[4 * (cell1.x + cell1.y * m) + (edge + 3) % 4] = true;
+
+			GLushort a = grid_index(p0 + corners[edge], k);
+			GLushort b = grid_index(p1 + corners[(edge + 1) % 4], k);
+			GLushort m0 = grid_index(p0 + c / 2, k);
+			GLushort m1 = grid_index(p1 + c / 2, k);
+			GLushort top = grid_index(p0 + corners[(edge + 2) % 4], k);
+
+			GLushort triangles[9] = { a, b, m0, m0, b, m1, m0, m1, top };
+			indices.insert(indices.end(), triangles, triangles + 9);
+		}
+	}
+
+	for (int y = 0; y < m; ++y)
+		for (int x = 0; x < m; ++x)
+		{
+			glm::ivec2 p = glm::ivec2(x, y) * c;
+			for (int side = 0; side < 4; ++side)
+			{
+				if (skip[4 * (x + y * m) + side])
+					continue;
+
+				indices.push_back(grid_index(p + corners[side], k));
+				indices.push_back(grid_index(p + corners[(side + 1) % 4], k));
+				indices.push_back(grid_index(p + c / 2, k));
+			}
+		}
+}
+
+
+terrain_vertex SmoothTerrainSurface::MakeTerrainVertex(int x, int y) const
+{
+	float h = _heightBounds.clamp(GetHeight(x, y));
+	float k = (h - _heightBounds.min) / _heightBounds.size();
+	GLushort height = (GLushort)glm::round(65535.0f * k);
+
+	return terrain_vertex(glm::u16vec2(x, y), height, EncodeNormal(GetNormal(x, y)));
+}
+
+
+glm::i8vec2 SmoothTerrainSurface::EncodeNormal(glm::vec3 n)
+{
+	n /= glm::abs(n.x) + glm::abs(n.y) + glm::abs(n.z);
+
+	glm::vec2 e = n.xy();
+	if (n.z < 0)
+		e = (1.0f - glm::abs(glm::vec2(e.y, e.x))) * glm::vec2(e.x >= 0 ? 1 : -1, e.y >= 0 ? 1 : -1);
+
+	return glm::i8vec2((signed char)glm::round(127.0f * e.x), (signed char)glm::round(127.0f * e.y));
+}
+
+
+glm::vec2 SmoothTerrainSurface::GetGridPosition(int x, int y) const
+{
+	return _bounds.min + _bounds.size() * glm::vec2(x, y) / (float)(_size - 1);
+}
@@ -5,39 +5,108 @@
 #ifndef SmoothTerrainSurface_H
 #define SmoothTerrainSurface_H
 
+#include <atomic>
+#include <map>
 #include "../../Library/Algebra/bounds.h"
+#include "../../Library/Algebra/pixel_view.h"
 #include "../TerrainModel/TerrainSurface.h"
 #include "SmoothTerrainSurfaceRenderer.h"
 
 class image;
+class paged_image;
+class SmoothTerrainMap;
+
+
+// Heights and normals of the grid points covered by one chunk, including
+// the points shared with the neighbouring chunks. Tiles are derived from
+// the groundmap when first read.
+
+struct terrain_tile
+{
+	std::vector<float> _heights;
+	std::vector<glm::vec3> _normals;
+	std::atomic<unsigned> _lastUsed;
+
+	terrain_tile();
+};
+
+
+// Square patch of the terrain grid, drawn with one indexed vertex buffer.
+// The vertices are kept at full resolution; the level of detail and the
+// edges stitched to coarser neighbours select the index pattern.
+
+struct terrain_chunk
+{
+	glm::ivec2 _origin;
+	bounds3f _bounds;
+	int _inside;
+	bool _visible;
+	int _lod;
+	int _stitch;
+	int _indexKey;
+	bool _resident;
+	unsigned _lastVisible;
+	vertexbuffer<terrain_vertex> _vbo;
+
+	terrain_chunk(glm::ivec2 origin);
+};
 
 
 class SmoothTerrainSurface : public TerrainSurface
 {
 	bounds2f _bounds;
 	image* _groundmap;
-
-	int _framebuffer_width;
-	int _framebuffer_height;
-	framebuffer* _framebuffer;
-	renderbuffer* _colorbuffer;
-	texture* _depth;
+	paged_image* _pagedGroundmap;
+	SmoothTerrainMap* _map;
+	glm::ivec2 _groundmapSize;
+
+	bool _renderEdges;
+	framebuffer* _edgeFramebuffer;
+	framebuffer* _edgeColorFramebuffer;
+	texture* _edgeDepth;
+	glm::ivec2 _edgeDepthSize;
 	texture* _colormap;
 	texture* _splatmap;
 
 	terrain_renderers* _renderers;
 	vertexbuffer<plain_vertex> _vboShadow;
-	vertexbuffer<terrain_vertex> _vboInside;
-	vertexbuffer<terrain_vertex> _vboBorder;
 	vertexbuffer<skirt_vertex> _vboSkirt;
 	vertexbuffer<color_vertex3> _vboLines;
 
 	int _size;
-	float* _heights;
-	glm::vec3* _normals;
+	bounds1f _heightBounds;
+
+	int _chunkSize;
+	int _chunkCount;
+	float _lodDistance;
+	std::vector<terrain_chunk*> _chunks;
+	std::map<int, std::vector<GLushort>> _chunkIndices;
+
+	// tiles are only evicted from Render, and heights may be read from any
+	// thread; readers pin the current epoch once per query, and an evicted
+	// tile is deleted when no reader is left from the epoch it was evicted
+	// in, so that reading a height is a plain load
+	std::atomic<terrain_tile*>* _tiles;
+	std::vector<terrain_tile*> _retiredTiles[2]; // by epoch parity
+	std::atomic<unsigned> _epoch;
+	mutable std::atomic<int> _readers[2]; // by epoch parity
+	mutable std::atomic<int> _residentTiles;
+	int _tileCapacity;
+	int _residentChunks;
+	int _chunkCapacity;
+	std::atomic<unsigned> _frame;
 
 public:
 	SmoothTerrainSurface(bounds2f bounds, image* groundmap);
+
+	// Paged groundmaps are read-only, and their tiles and chunks are
+	// loaded when first needed and evicted when least recently used.
+	SmoothTerrainSurface(bounds2f bounds, paged_image* groundmap);
+
+	// Precompiled maps are paged as well, and use the compiled data
+	// instead of deriving it from the groundmap.
+	SmoothTerrainSurface(bounds2f bounds, SmoothTerrainMap* map);
+
 	virtual ~SmoothTerrainSurface();
 
 	//
@@ -46,7 +115,7 @@ public:
 
 	virtual bounds2f GetBounds() const { return _bounds; }
 	virtual float GetHeight(glm::vec2 position) const;
-	virtual const float* Intersect(ray r);
+	virtual intersection Intersect(ray r) const;
 
 	virtual bool IsForest(glm::vec2 position) const;
 	virtual bool IsImpassable(glm::vec2 position) const;
@@ -61,38 +130,89 @@ public:
 
 	image* GetGroundMap() const { return _groundmap; }
 
+	// Compiled and paged groundmaps are read-only, and cannot be painted.
+	bool IsEditable() const { return _groundmap != nullptr; }
+
+	int GetGridSize() const { return _size; }
+	int GetChunkSize() const { return _chunkSize; }
+	int GetChunkCount() const { return _chunkCount; }
+	int GetMaxLod() const;
+	bounds1f GetHeightBounds() const { return _heightBounds; }
+	const std::vector<skirt_vertex>& GetSkirtVertices() const { return _vboSkirt._vertices; }
+
 	void Extract(glm::vec2 position, image* brush);
 	bounds2f Paint(TerrainFeature feature, glm::vec2 position, image* brush, float pressure);
 	bounds2f Paint(TerrainFeature feature, glm::vec2 position, float radius, float pressure);
 
+	// Edges are drawn where the depth of the terrain changes abruptly. The
+	// depth is read from the framebuffer that the terrain is drawn to, which
+	// must have a depth texture attached; without one, no edges are drawn.
+	// The edges are drawn to a framebuffer with the same color buffer and
+	// no depth, so that the depth texture is not sampled while attached.
 	void EnableRenderEdges();
+	bool GetRenderEdges() const { return _renderEdges; }
+	void SetEdgeDepth(framebuffer* target, framebuffer* colorTarget, texture* depth, glm::ivec2 size);
 
-	void UpdateHeights();
+	rgba8 GetGroundPixel(int x, int y) const;
 	float CalculateHeight(int x, int y) const;
-	void UpdateNormals();
 
-	float GetHeight(int x, int y) const { return _heights[x + y * _size]; }
-	glm::vec3 GetNormal(int x, int y) const { return _normals[x + y * _size]; }
+	void InitializeTiles();
+	void LoadTile(int tx, int ty, terrain_tile& tile) const;
+	void ReloadTiles(glm::ivec2 min, glm::ivec2 max);
+	void TrimTiles();
+	void ReclaimTiles();
+
+	// Keeps the tiles read while in scope from being deleted. Reads from
+	// Render, and from the thread pool while Render waits for it, need no
+	// pin, since tiles are only evicted there.
+	class pin_tiles
+	{
+		const SmoothTerrainSurface& _surface;
+		unsigned _epoch;
+
+	public:
+		explicit pin_tiles(const SmoothTerrainSurface& surface);
+		~pin_tiles();
+	};
+
+	int GetTileCoord(int x) const { int t = x / _chunkSize; return t < _chunkCount ? t : _chunkCount - 1; }
+	terrain_tile* GetTile(int tx, int ty) const;
+
+	float GetHeight(int x, int y) const;
+	glm::vec3 GetNormal(int x, int y) const;
 
 	float InterpolateHeight(glm::vec2 position) const;
 
-	const float* InternalIntersect(ray r);
+	intersection InternalIntersect(ray r) const;
 
 	void UpdateChanges(bounds2f bounds);
-	void UpdateDepthTextureSize();
 	void UpdateSplatmap();
+	void BuildSplatmap(glm::ivec2 origin, glm::ivec2 size, std::vector<GLubyte>& data) const;
+	void UploadSplatmap(glm::ivec2 origin, glm::ivec2 size, const GLubyte* data);
 
 	float GetForestValue(int x, int y) const;
 	float GetImpassableValue(int x, int y) const;
+	float GetImpassableValue(rgba8 c, int x, int y) const;
 
 	void InitializeShadow();
 	void InitializeSkirt();
 	void InitializeLines();
 
-	vertexbuffer<terrain_vertex>* SelectTerrainVbo(int inside);
-
-	void BuildTriangles();
-	void PushTriangle(const terrain_vertex& v0, const terrain_vertex& v1, const terrain_vertex& v2);
+	void Initialize();
+	void InitializeChunks();
+	void UpdateChunkVertices(terrain_chunk& chunk) const;
+	void CopyChunkVertices(terrain_chunk& chunk) const;
+	void LoadChunks(const std::vector<terrain_chunk*>& chunks);
+	void TrimChunks();
+	terrain_chunk* GetChunk(int x, int y) const;
+	void SelectChunks(const glm::mat4x4& transform);
+	const std::vector<GLushort>& GetChunkIndices(int lod, int stitch);
+	void BuildChunkIndices(int lod, int stitch, std::vector<GLushort>& indices) const;
+
+	terrain_vertex MakeTerrainVertex(int x, int y) const;
+	static glm::i8vec2 EncodeNormal(glm::vec3 n);
+
+	glm::vec2 GetGridPosition(int x, int y) const;
 
 	glm::ivec2 MapWorldToImage(glm::vec2 position) const;
 };
@@ -11,9 +11,6 @@ terrain_renderers::terrain_renderers() :
 _terrain_inside(nullptr),
 _terrain_border(nullptr),
 _terrain_skirt(nullptr),
-_depth_inside(nullptr),
-_depth_border(nullptr),
-_depth_skirt(nullptr),
 _sobel_filter(nullptr),
 _ground_shadow(nullptr)
 {
@@ -25,23 +22,37 @@ terrain_renderers::~terrain_renderers()
 	delete _terrain_inside;
 	delete _terrain_border;
 	delete _terrain_skirt;
-	delete _depth_inside;
-	delete _depth_border;
-	delete _depth_skirt;
 	delete _sobel_filter;
 	delete _ground_shadow;
 }
 
 
-void terrain_renderers::render_terrain_inside(vertexbuffer<terrain_vertex>& shape, const terrain_uniforms& uniforms)
+void terrain_renderers::compile_programs()
+{
+	create_terrain_inside();
+	create_terrain_border();
+	create_terrain_skirt();
+	create_ground_shadow();
+
+	_terrain_inside->compile();
+	_terrain_border->compile();
+	_terrain_skirt->compile();
+	_ground_shadow->compile();
+}
+
+
+void terrain_renderers::create_terrain_inside()
 {
 	if (_terrain_inside == nullptr)
 	{
 		_terrain_inside = new renderer<terrain_vertex, terrain_uniforms>((
-			VERTEX_ATTRIBUTE(terrain_vertex, _position),
-			VERTEX_ATTRIBUTE(terrain_vertex, _normal),
+			VERTEX_ATTRIBUTE(terrain_vertex, _grid),
+			NORMALIZED_VERTEX_ATTRIBUTE(terrain_vertex, _height),
+			NORMALIZED_VERTEX_ATTRIBUTE(terrain_vertex, _normal),
 			SHADER_UNIFORM(terrain_uniforms, _transform),
 			SHADER_UNIFORM(terrain_uniforms, _map_bounds),
+			SHADER_UNIFORM(terrain_uniforms, _height_bounds),
+			SHADER_UNIFORM(terrain_uniforms, _grid_scale),
 			SHADER_UNIFORM(terrain_uniforms, _light_normal),
 			SHADER_UNIFORM(terrain_uniforms, _colormap),
 			SHADER_UNIFORM(terrain_uniforms, _splatmap),
@@ -49,25 +60,38 @@ void terrain_renderers::render_terrain_inside(vertexbuffer<terrain_vertex>& shap
 			({
 				uniform mat4 transform;
 				uniform vec4 map_bounds;
+				uniform vec2 height_bounds;
+				uniform float grid_scale;
 				uniform vec3 light_normal;
 
-				attribute vec3 position;
-				attribute vec3 normal;
+				attribute vec2 grid;
+				attribute float height;
+				attribute vec2 normal;
 
 				varying vec3 _position;
 				varying vec2 _colorcoord;
 				varying vec2 _splatcoord;
 				varying float _brightness;
 
+				vec3 decode_normal(vec2 e)
+				{
+					vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+					if (n.z < 0.0)
+						n.xy = (1.0 - abs(n.yx)) * (2.0 * step(0.0, n.xy) - 1.0);
+					return normalize(n);
+				}
+
 				void main()
 				{
+					vec2 terraincoord = grid * grid_scale;
+					vec3 position = vec3(map_bounds.xy + map_bounds.zw * terraincoord, height_bounds.x + height_bounds.y * height);
 					vec4 p = transform * vec4(position, 1);
 
-					float brightness = -dot(light_normal, normal);
+					float brightness = -dot(light_normal, decode_normal(normal));
 
 					_position = position;
 					_colorcoord = vec2(brightness, 1.0 - (2.5 + position.z) / 128.0);
-					_splatcoord = (position.xy - map_bounds.xy) / map_bounds.zw;
+					_splatcoord = terraincoord;
 					_brightness = brightness;
 
 
@@ -102,46 +126,68 @@ void terrain_renderers::render_terrain_inside(vertexbuffer<terrain_vertex>& shap
 		_terrain_inside->_blend_sfactor = GL_ONE;
 		_terrain_inside->_blend_dfactor = GL_ZERO;
 	}
+}
+
+
+void terrain_renderers::render_terrain_inside(vertexbuffer<terrain_vertex>& shape, const terrain_uniforms& uniforms)
+{
+	create_terrain_inside();
 	_terrain_inside->render(shape, uniforms);
 }
 
 
 
-void terrain_renderers::render_terrain_border(vertexbuffer<terrain_vertex>& shape, const terrain_uniforms& uniforms)
+void terrain_renderers::create_terrain_border()
 {
 	if (_terrain_border == nullptr)
 	{
 		_terrain_border = new renderer<terrain_vertex, terrain_uniforms>((
-			VERTEX_ATTRIBUTE(terrain_vertex, _position),
-			VERTEX_ATTRIBUTE(terrain_vertex, _normal),
+			VERTEX_ATTRIBUTE(terrain_vertex, _grid),
+			NORMALIZED_VERTEX_ATTRIBUTE(terrain_vertex, _height),
+			NORMALIZED_VERTEX_ATTRIBUTE(terrain_vertex, _normal),
 			SHADER_UNIFORM(terrain_uniforms, _transform),
 			SHADER_UNIFORM(terrain_uniforms, _light_normal),
 			SHADER_UNIFORM(terrain_uniforms, _map_bounds),
+			SHADER_UNIFORM(terrain_uniforms, _height_bounds),
+			SHADER_UNIFORM(terrain_uniforms, _grid_scale),
 			SHADER_UNIFORM(terrain_uniforms, _colormap),
 			SHADER_UNIFORM(terrain_uniforms, _splatmap),
 			VERTEX_SHADER
 			({
 				uniform mat4 transform;
 				uniform vec4 map_bounds;
+				uniform vec2 height_bounds;
+				uniform float grid_scale;
 				uniform vec3 light_normal;
 
-				attribute vec3 position;
-				attribute vec3 normal;
+				attribute vec2 grid;
+				attribute float height;
+				attribute vec2 normal;
 
 				varying vec3 _position;
 				varying vec2 _colorcoord;
 				varying vec2 _splatcoord;
 				varying float _brightness;
 
+				vec3 decode_normal(vec2 e)
+				{
+					vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+					if (n.z < 0.0)
+						n.xy = (1.0 - abs(n.yx)) * (2.0 * step(0.0, n.xy) - 1.0);
+					return normalize(n);
+				}
+
 				void main()
 				{
+					vec2 terraincoord = grid * grid_scale;
+					vec3 position = vec3(map_bounds.xy + map_bounds.zw * terraincoord, height_bounds.x + height_bounds.y * height);
 					vec4 p = transform * vec4(position, 1);
 
-					float brightness = -dot(light_normal, normal);
+					float brightness = -dot(light_normal, decode_normal(normal));
 
 					_position = position;
 					_colorcoord = vec2(brightness, 1.0 - (2.5 + position.z) / 128.0);
-					_splatcoord = (position.xy - map_bounds.xy) / map_bounds.zw;
+					_splatcoord = terraincoord;
 					_brightness = brightness;
 
 				    gl_Position = p;
@@ -166,10 +212,10 @@ void terrain_renderers::render_terrain_border(vertexbuffer<terrain_vertex>& shap
 					vec3 color = texture2D(colormap, _colorcoord).rgb;
 					vec3 splat = texture2D(splatmap, _splatcoord).rgb;
 
+					color = mix(color, vec3(0.45), 0.4 * step(0.5, splat.r));
 					float f = step(0.0, _position.z) * smoothstep(0.475, 0.525, splat.g);
-					color = mix(color, vec3(0.2196, 0.3608, 0.1922), 0.3 * f);
+					color = mix(color, vec3(0.2196, 0.3608, 0.1922), 0.25 * f);
 					color = mix(color, vec3(0), 0.03 * step(0.5, 1.0 - _brightness));
-					color = mix(color, vec3(0.4), 0.3333 * step(0.5, splat.r));
 
 				    gl_FragColor = vec4(color, 1.0);
 				}
@@ -178,12 +224,18 @@ void terrain_renderers::render_terrain_border(vertexbuffer<terrain_vertex>& shap
 		_terrain_border->_blend_sfactor = GL_ONE;
 		_terrain_border->_blend_dfactor = GL_ZERO;
 	}
+}
+
+
+void terrain_renderers::render_terrain_border(vertexbuffer<terrain_vertex>& shape, const terrain_uniforms& uniforms)
+{
+	create_terrain_border();
 	_terrain_border->render(shape, uniforms);
 }
 
 
 
-void terrain_renderers::render_terrain_skirt(vertexbuffer<skirt_vertex>& shape, const texture_uniforms& uniforms)
+void terrain_renderers::create_terrain_skirt()
 {
 	if (_terrain_skirt == nullptr)
 	{
@@ -228,128 +280,17 @@ void terrain_renderers::render_terrain_skirt(vertexbuffer<skirt_vertex>& shape,
 		_terrain_skirt->_blend_sfactor = GL_ONE;
 		_terrain_skirt->_blend_dfactor = GL_ZERO;
 	}
-	_terrain_skirt->render(shape, uniforms);
-}
-
-
-
-void terrain_renderers::render_depth_inside(vertexbuffer<terrain_vertex>& shape, const terrain_uniforms& uniforms)
-{
-	if (_depth_inside == nullptr)
-	{
-		_depth_inside = new renderer<terrain_vertex, terrain_uniforms>((
-			VERTEX_ATTRIBUTE(terrain_vertex, _position),
-			VERTEX_ATTRIBUTE(terrain_vertex, _normal),
-			SHADER_UNIFORM(terrain_uniforms, _transform),
-			VERTEX_SHADER
-			({
-				uniform mat4 transform;
-				attribute vec3 position;
-				attribute vec3 normal;
-
-				void main()
-				{
-					vec4 p = transform * vec4(position, 1);
-				    gl_Position = p;
-				}
-			}),
-			FRAGMENT_SHADER
-			({
-				void main()
-				{
-				    gl_FragColor = vec4(1, 1, 1, 1);
-				}
-			})
-		));
-		_depth_inside->_blend_sfactor = GL_ONE;
-		_depth_inside->_blend_dfactor = GL_ZERO;
-	}
-	_depth_inside->render(shape, uniforms);
 }
 
 
-
-void terrain_renderers::render_depth_border(vertexbuffer<terrain_vertex>& shape, const terrain_uniforms& uniforms)
+void terrain_renderers::render_terrain_skirt(vertexbuffer<skirt_vertex>& shape, const texture_uniforms& uniforms)
 {
-	if (_depth_border == nullptr)
-	{
-		_depth_border = new renderer<terrain_vertex, terrain_uniforms>((
-			VERTEX_ATTRIBUTE(terrain_vertex, _position),
-			VERTEX_ATTRIBUTE(terrain_vertex, _normal),
-			SHADER_UNIFORM(terrain_uniforms, _transform),
-			SHADER_UNIFORM(terrain_uniforms, _map_bounds),
-			VERTEX_SHADER
-			({
-				uniform mat4 transform;
-				uniform vec4 map_bounds;
-				attribute vec3 position;
-				attribute vec3 normal;
-				varying vec2 _terraincoord;
-
-				void main()
-				{
-					_terraincoord = (position.xy - map_bounds.xy) / map_bounds.zw;
-					vec4 p = transform * vec4(position, 1);
-				    gl_Position = p;
-				}
-			}),
-			FRAGMENT_SHADER
-			({
-				varying vec2 _terraincoord;
-
-				void main()
-				{
-					if (distance(_terraincoord, vec2(0.5, 0.5)) > 0.5)
-						discard;
-
-				    gl_FragColor = vec4(1);
-				}
-			})
-		));
-		_depth_border->_blend_sfactor = GL_ONE;
-		_depth_border->_blend_dfactor = GL_ZERO;
-	}
-	_depth_border->render(shape, uniforms);
+	create_terrain_skirt();
+	_terrain_skirt->render(shape, uniforms);
 }
 
 
 
-void terrain_renderers::render_depth_skirt(vertexbuffer<skirt_vertex>& shape, const plain_uniforms& uniforms)
-{
-	if (_depth_skirt == nullptr)
-	{
-		_depth_skirt = new renderer<skirt_vertex, plain_uniforms>((
-			VERTEX_ATTRIBUTE(skirt_vertex, _position),
-			VERTEX_ATTRIBUTE(skirt_vertex, _height),
-			SHADER_UNIFORM(plain_uniforms, _transform),
-			VERTEX_SHADER
-			({
-				uniform mat4 transform;
-				attribute vec3 position;
-				attribute float height;
-
-				void main()
-				{
-					vec4 p = transform * vec4(position, 1);
-
-				    gl_Position = p;
-				}
-			}),
-			FRAGMENT_SHADER
-			({
-				void main()
-				{
-				    gl_FragColor = vec4(1);
-				}
-			}))
-		);
-		_depth_skirt->_blend_sfactor = GL_ONE;
-		_depth_skirt->_blend_dfactor = GL_ZERO;
-	}
-	_depth_skirt->render(shape, uniforms);
-}
-
-
 void terrain_renderers::render_sobel_filter(vertexbuffer<texture_vertex>& shape, const sobel_uniforms& uniforms)
 {
 	if (_sobel_filter == nullptr)
@@ -359,73 +300,42 @@ void terrain_renderers::render_sobel_filter(vertexbuffer<texture_vertex>& shape,
 			VERTEX_ATTRIBUTE(texture_vertex, _texcoord),
 			SHADER_UNIFORM(sobel_uniforms, _transform),
 			SHADER_UNIFORM(sobel_uniforms, _depth),
+			SHADER_UNIFORM(sobel_uniforms, _texel_size),
 			VERTEX_SHADER
 			({
 				uniform mat4 transform;
 				attribute vec2 position;
 				attribute vec2 texcoord;
 
-				varying vec2 coord11;
-				//varying vec2 coord12;
-				varying vec2 coord13;
-				//varying vec2 coord21;
-				//varying vec2 coord23;
-				varying vec2 coord31;
-				//varying vec2 coord32;
-				varying vec2 coord33;
-
 				void main()
 				{
-					const float dx = 1.0 / 2.0 / 1024.0;
-					const float dy = 1.0 / 2.0 / 768.0;
-
 					vec4 p = transform * vec4(position, 0, 1);
 
 				    gl_Position = p;
-
-					coord11 = texcoord + vec2(-dx,  dy);
-					//coord12 = texcoord + vec2(0.0,  dy);
-					coord13 = texcoord + vec2( dx,  dy);
-					//coord21 = texcoord + vec2(-dx, 0.0);
-					//coord23 = texcoord + vec2( dx, 0.0);
-					coord31 = texcoord + vec2(-dx, -dy);
-					//coord32 = texcoord + vec2(0.0, -dy);
-					coord33 = texcoord + vec2( dx, -dy);
 				}
 			}),
 			FRAGMENT_SHADER
 			({
 				uniform sampler2D depth;
-
-				varying vec2 coord11;
-				//varying vec2 coord12;
-				varying vec2 coord13;
-				//varying vec2 coord21;
-				//varying vec2 coord23;
-				varying vec2 coord31;
-				//varying vec2 coord32;
-				varying vec2 coord33;
+				uniform vec2 texel_size;
 
 				void main()
 				{
+					vec2 coord31 = gl_FragCoord.xy * texel_size;
+					vec2 coord33 = coord31 + vec2(texel_size.x, 0.0);
+					vec2 coord11 = coord31 + vec2(0.0, texel_size.y);
+					vec2 coord13 = coord31 + texel_size;
+
 					float value11 = texture2D(depth, coord11).r;
-					//float value12 = texture2D(depth, coord12).r;
 					float value13 = texture2D(depth, coord13).r;
-					//float value21 = texture2D(depth, coord21).r;
-					//float value23 = texture2D(depth, coord23).r;
 					float value31 = texture2D(depth, coord31).r;
-					//float value32 = texture2D(depth, coord32).r;
 					float value33 = texture2D(depth, coord33).r;
 
 					float h = value11 - value33;
 					float v = value31 - value13;
 
-					//float h = -value11 - 2.0 * value12 - value13 + value31 + 2.0 * value32 + value33;
-					//float v = -value31 - 2.0 * value21 - value11 + value33 + 2.0 * value23 + value13;
-
 					float k = clamp(5.0 * length(vec2(h, v)), 0.0, 0.6);
 
-					//gl_FragColor = vec4(0.145, 0.302, 0.255, k);
 					gl_FragColor = vec4(0.0725, 0.151, 0.1275, k);
 				}
 			})
@@ -437,7 +347,7 @@ void terrain_renderers::render_sobel_filter(vertexbuffer<texture_vertex>& shape,
 }
 
 
-void terrain_renderers::render_ground_shadow(vertexbuffer<plain_vertex>& shape, const terrain_uniforms& uniforms)
+void terrain_renderers::create_ground_shadow()
 {
 	if (_ground_shadow == nullptr)
 	{
@@ -478,7 +388,12 @@ void terrain_renderers::render_ground_shadow(vertexbuffer<plain_vertex>& shape,
 		_ground_shadow->_blend_sfactor = GL_SRC_ALPHA;
 		_ground_shadow->_blend_dfactor = GL_ONE_MINUS_SRC_ALPHA;
 	}
+}
 
+
+void terrain_renderers::render_ground_shadow(vertexbuffer<plain_vertex>& shape, const terrain_uniforms& uniforms)
+{
+	create_ground_shadow();
 	_ground_shadow->render(shape, uniforms);
 }
 
@@ -598,7 +513,7 @@ texture* terrain_renderers::create_colormap()
 
 	texture* result = new texture(img);
 
-	glBindTexture(GL_TEXTURE_2D, result->id);
+	glstate::shared().bind_texture(result->id);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
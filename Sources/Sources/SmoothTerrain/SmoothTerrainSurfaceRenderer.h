@@ -13,13 +13,18 @@
 
 struct terrain_renderers;
 
+// Grid coordinates, height quantized to 16 bits within the height bounds
+// and an octahedral encoded normal. World positions are reconstructed in
+// the vertex shader from the map bounds.
+
 struct terrain_vertex
 {
-	GLushort _x, _y;
-	glm::vec3 _position;
-	glm::vec3 _normal;
+	glm::u16vec2 _grid;
+	GLushort _height;
+	glm::i8vec2 _normal;
 
-	terrain_vertex(GLushort x, GLushort y, glm::vec3 p, glm::vec3 n) : _x(x), _y(y), _position(p), _normal(n) {}
+	terrain_vertex() {}
+	terrain_vertex(glm::u16vec2 g, GLushort h, glm::i8vec2 n) : _grid(g), _height(h), _normal(n) {}
 };
 
 
@@ -38,15 +43,20 @@ struct terrain_uniforms
 	glm::mat4x4 _transform;
 	glm::vec3 _light_normal;
 	glm::vec4 _map_bounds;
+	glm::vec2 _height_bounds;
+	float _grid_scale;
 	const texture* _colormap;
 	const texture* _splatmap;
 };
 
 
+// The depth texture is sampled at the fragment's own pixel, so texel_size
+// is one over the size of the framebuffer it was attached to.
 struct sobel_uniforms
 {
 	glm::mat4x4 _transform;
 	const texture* _depth;
+	glm::vec2 _texel_size;
 };
 
 
@@ -56,28 +66,32 @@ struct terrain_renderers
 	renderer<terrain_vertex, terrain_uniforms>* _terrain_inside;
 	renderer<terrain_vertex, terrain_uniforms>* _terrain_border;
 	renderer<skirt_vertex, texture_uniforms>* _terrain_skirt;
-	renderer<terrain_vertex, terrain_uniforms>* _depth_inside;
-	renderer<terrain_vertex, terrain_uniforms>* _depth_border;
-	renderer<skirt_vertex, plain_uniforms>* _depth_skirt;
 	renderer<texture_vertex, sobel_uniforms>* _sobel_filter;
 	renderer<plain_vertex, terrain_uniforms>* _ground_shadow;
 
 	terrain_renderers();
 	~terrain_renderers();
 
+	// Compiles the programs that every frame of a battle draws with, so
+	// that the first frame does not wait for them. The edge filter is
+	// still compiled when first drawn.
+	void compile_programs();
+
 	void render_terrain_inside(vertexbuffer<terrain_vertex>& shape, const terrain_uniforms& uniforms);
 	void render_terrain_border(vertexbuffer<terrain_vertex>& shape, const terrain_uniforms& uniforms);
 	void render_terrain_skirt(vertexbuffer<skirt_vertex>& shape, const texture_uniforms& uniforms);
 
-	void render_depth_inside(vertexbuffer<terrain_vertex>& shape, const terrain_uniforms& uniforms);
-	void render_depth_border(vertexbuffer<terrain_vertex>& shape, const terrain_uniforms& uniforms);
-	void render_depth_skirt(vertexbuffer<skirt_vertex>& shape, const plain_uniforms& uniforms);
-
 	void render_sobel_filter(vertexbuffer<texture_vertex>& shape, const sobel_uniforms& uniforms);
 
 	void render_ground_shadow(vertexbuffer<plain_vertex>& shape, const terrain_uniforms& uniforms);
 
 	static texture* create_colormap();
+
+private:
+	void create_terrain_inside();
+	void create_terrain_border();
+	void create_terrain_skirt();
+	void create_ground_shadow();
 };
 
 
@@ -2,12 +2,34 @@
 //
 // This file is part of the openwar platform (GPL v3 or later), see LICENSE.txt
 
+#include "SmoothTerrainMap.h"
 #include "SmoothTerrainWater.h"
 
 
 SmoothTerrainWater::SmoothTerrainWater(bounds2f bounds, image* groundmap) :
 _groundmap(groundmap),
+_map(nullptr),
 _bounds(bounds)
+{
+	Initialize();
+}
+
+
+SmoothTerrainWater::SmoothTerrainWater(bounds2f bounds, const SmoothTerrainMap* map) :
+_groundmap(nullptr),
+_map(map),
+_bounds(bounds)
+{
+	Initialize();
+}
+
+
+SmoothTerrainWater::~SmoothTerrainWater()
+{
+}
+
+
+void SmoothTerrainWater::Initialize()
 {
 	_water_inside_renderer = new renderer<plain_vertex, ground_texture_uniforms>((
 		VERTEX_ATTRIBUTE(plain_vertex, _position),
@@ -79,21 +101,21 @@ _bounds(bounds)
 	_water_border_renderer->_blend_sfactor = GL_ONE;
 	_water_border_renderer->_blend_dfactor = GL_ONE_MINUS_SRC_ALPHA;
 
-	Update();
-}
+	_water_inside_renderer->compile();
+	_water_border_renderer->compile();
 
-
-SmoothTerrainWater::~SmoothTerrainWater()
-{
+	Update();
 }
 
 
 bool SmoothTerrainWater::IsWater(glm::vec2 position) const
 {
-	glm::ivec2 mapsize = _groundmap->size();
+	glm::ivec2 mapsize = GetGroundMapSize();
 	glm::vec2 p = (position - _bounds.min) / _bounds.size();
 	int x = (int)(mapsize.x * glm::floor(p.x));
 	int y = (int)(mapsize.y * glm::floor(p.y));
+	if (_map != nullptr)
+		return (_map->GetFlags(x, y) & SmoothTerrainFlagWater) != 0;
 	glm::vec4 c = _groundmap->get_pixel(x, y);
 	return c.b >= 0.5;
 }
@@ -102,7 +124,7 @@ bool SmoothTerrainWater::IsWater(glm::vec2 position) const
 
 bool SmoothTerrainWater::ContainsWater(bounds2f bounds) const
 {
-	glm::ivec2 mapsize = _groundmap->size();
+	glm::ivec2 mapsize = GetGroundMapSize();
 	glm::vec2 min = glm::vec2(mapsize.x - 1, mapsize.y - 1) * (bounds.min - _bounds.min) / _bounds.size();
 	glm::vec2 max = glm::vec2(mapsize.x - 1, mapsize.y - 1) * (bounds.max - _bounds.min) / _bounds.size();
 	int xmin = (int)floorf(min.x);
@@ -113,6 +135,13 @@ bool SmoothTerrainWater::ContainsWater(bounds2f bounds) const
 	for (int x = xmin; x <= xmax; ++x)
 		for (int y = ymin; y <= ymax; ++y)
 		{
+			if (_map != nullptr)
+			{
+				if ((_map->GetFlags(x, y) & (SmoothTerrainFlagWater | SmoothTerrainFlagFords)) != 0)
+					return true;
+				continue;
+			}
+
 			glm::vec4 c = _groundmap->get_pixel(x, y);
 			if (c.b >= 0.5 || c.r >= 0.5)
 				return true;
@@ -123,6 +152,13 @@ bool SmoothTerrainWater::ContainsWater(bounds2f bounds) const
 
 
 
+glm::ivec2 SmoothTerrainWater::GetGroundMapSize() const
+{
+	return _map != nullptr ? _map->GetGroundMapSize() : _groundmap->size();
+}
+
+
+
 static int inside_circle(bounds2f bounds, glm::vec2 p)
 {
 	return glm::distance(p, bounds.center()) <= bounds.width() / 2 ? 1 : 0;
@@ -9,6 +9,8 @@
 #include "../../Library/Graphics/renderer.h"
 #include "../../Library/Algebra/image.h"
 
+class SmoothTerrainMap;
+
 
 class SmoothTerrainWater : public TerrainWater
 {
@@ -26,10 +28,12 @@ class SmoothTerrainWater : public TerrainWater
 	vertexbuffer<plain_vertex> _shape_water_border;
 
 	image* _groundmap;
+	const SmoothTerrainMap* _map;
 	bounds2f _bounds;
 
 public:
 	SmoothTerrainWater(bounds2f bounds, image* groundmap);
+	SmoothTerrainWater(bounds2f bounds, const SmoothTerrainMap* map);
 	virtual ~SmoothTerrainWater();
 
 	virtual bool IsWater(glm::vec2 position) const;
@@ -37,6 +41,10 @@ public:
 
 	void Update();
 	void Render(const glm::mat4x4& transform);
+
+private:
+	void Initialize();
+	glm::ivec2 GetGroundMapSize() const;
 };
 
 
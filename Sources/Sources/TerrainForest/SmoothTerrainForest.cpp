@@ -0,0 +1,343 @@
+// Copyright (C) 2013 Felix Ungman
+//
+// This file is part of the openwar platform (GPL v3 or later), see LICENSE.txt
+
+#include <cstdlib>
+
+#include "SmoothTerrainForest.h"
+#include "../TerrainModel/TerrainSurface.h"
+#include "../../Library/Algebra/geometry.h"
+#include "../../Library/Algebra/image.h"
+#include "../../Library/Renderers/TextureRenderer.h"
+
+
+const int SmoothTerrainForest::patch_points;
+const int SmoothTerrainForest::canopy_size;
+const int SmoothTerrainForest::density_levels;
+
+
+// The same random values are used for every forest, so that the trees stay
+// in place when the battle is reset.
+
+static const std::vector<float>& tree_randoms()
+{
+	static std::vector<float>* _randoms = nullptr;
+	if (_randoms == nullptr)
+	{
+		_randoms = new std::vector<float>(997);
+		for (float& value : *_randoms)
+			value = (float)(rand() & 0x7fff) / 0x7fff;
+	}
+	return *_randoms;
+}
+
+
+
+SmoothTerrainForest::SmoothTerrainForest(TerrainSurface* terrainSurface, const int* treeShapes) :
+_terrainSurface(terrainSurface),
+_bounds(terrainSurface->GetBounds()),
+_spacing(0),
+_gridSize(),
+_patchCount(),
+_patches(),
+_farPatches(),
+_canopyImage(nullptr),
+_canopyTexture(nullptr),
+_canopyRenderer(nullptr),
+nearDistance(150),
+farDistance(500)
+{
+	for (int i = 0; i < 16; ++i)
+		_treeShapes[i] = treeShapes[i];
+
+	_spacing = 5 * _bounds.width() / 1024;
+	_gridSize = glm::ivec2(glm::ceil(_bounds.size() / _spacing));
+	_patchCount = (_gridSize + patch_points - 1) / patch_points;
+	_patches.resize(_patchCount.x * _patchCount.y);
+	for (int i = 0; i < (int)_patches.size(); ++i)
+		SampleHeights(i);
+
+	_canopyImage = new image(canopy_size, canopy_size);
+	_canopyTexture = new texture();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	CHECK_ERROR_GL();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	CHECK_ERROR_GL();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	CHECK_ERROR_GL();
+
+	_canopyRenderer = new TextureTriangleRenderer();
+
+	BakeCanopy(_bounds);
+}
+
+
+SmoothTerrainForest::~SmoothTerrainForest()
+{
+	delete _canopyImage;
+	delete _canopyTexture;
+	delete _canopyRenderer;
+}
+
+
+// Trees are placed again when next needed.
+
+void SmoothTerrainForest::Update(bounds2f bounds)
+{
+	for (int i = 0; i < (int)_patches.size(); ++i)
+		if (GetPatchBounds(i).intersects(bounds))
+		{
+			ReleaseTrees(i);
+			SampleHeights(i);
+		}
+
+	BakeCanopy(bounds);
+}
+
+
+// Patches are picked by the distance from the camera to their nearest
+// side. Mid patches keep the trees with the lowest ranks, down to a quarter
+// of them at the far distance, in steps of density levels. Far patches keep
+// their trees a bit longer, so that moving the camera back and forth does
+// not place them again. Trees are drawn whether their patch is in view or
+// not, since the billboards would otherwise change whenever the camera
+// turns; only the canopy is culled.
+
+int SmoothTerrainForest::UpdateTreeBillboards(glm::vec3 cameraPosition, const frustum& view, BillboardModel* billboardModel)
+{
+	int culled = 0;
+	bool changed = false;
+	_farPatches.clear();
+
+	for (int i = 0; i < (int)_patches.size(); ++i)
+	{
+		Patch& patch = _patches[i];
+		bounds2f bounds = GetPatchBounds(i);
+		glm::vec2 center = bounds.center();
+		float distance = glm::distance(cameraPosition, glm::vec3(center, _terrainSurface->GetHeight(center)));
+		distance = glm::max(0.0f, distance - 0.5f * glm::length(bounds.size()));
+
+		int level = 0;
+		if (distance >= farDistance)
+		{
+			if (patch.placed && distance > 1.25f * farDistance)
+				ReleaseTrees(i);
+			if (patch.canopy)
+			{
+				if (view.intersects(bounds3f(bounds, bounds1f(patch.heights.min - 2, patch.heights.max + 10))))
+					_farPatches.push_back(i);
+				else
+					++culled;
+			}
+		}
+		else
+		{
+			if (!patch.placed)
+				PlaceTrees(i);
+			float density = 1 - 0.75f * glm::clamp((distance - nearDistance) / (farDistance - nearDistance), 0.0f, 1.0f);
+			level = (int)glm::ceil(density * density_levels);
+		}
+
+		if (patch.level != level)
+		{
+			patch.level = level;
+			changed = true;
+		}
+	}
+
+	if (changed)
+	{
+		std::vector<Billboard>& billboards = billboardModel->staticBillboards;
+		billboards.clear();
+		for (const Patch& patch : _patches)
+		{
+			if (patch.level == density_levels)
+			{
+				billboards.insert(billboards.end(), patch.trees.begin(), patch.trees.end());
+			}
+			else if (patch.level != 0)
+			{
+				float density = (float)patch.level / density_levels;
+				for (size_t j = 0; j < patch.trees.size(); ++j)
+					if (patch.ranks[j] < density)
+						billboards.push_back(patch.trees[j]);
+			}
+		}
+		++billboardModel->staticVersion;
+	}
+
+	return culled;
+}
+
+
+// The canopy is drawn a few meters above the ground, on a coarse grid that
+// follows the terrain.
+
+void SmoothTerrainForest::RenderCanopy(const glm::mat4x4& transform)
+{
+	const int cells = 4;
+	const float elevation = 2.5f;
+
+	_canopyRenderer->Reset();
+	for (int i : _farPatches)
+	{
+		bounds2f bounds = GetPatchBounds(i);
+		glm::vec2 step = bounds.size() / (float)cells;
+
+		glm::vec3 positions[cells + 1][cells + 1];
+		glm::vec2 texcoords[cells + 1][cells + 1];
+		for (int y = 0; y <= cells; ++y)
+			for (int x = 0; x <= cells; ++x)
+			{
+				glm::vec2 p = bounds.min + step * glm::vec2(x, y);
+				positions[x][y] = _terrainSurface->GetPosition(p, elevation);
+				texcoords[x][y] = (p - _bounds.min) / _bounds.size();
+			}
+
+		for (int y = 0; y < cells; ++y)
+			for (int x = 0; x < cells; ++x)
+			{
+				_canopyRenderer->AddVertex(positions[x][y], texcoords[x][y]);
+				_canopyRenderer->AddVertex(positions[x + 1][y], texcoords[x + 1][y]);
+				_canopyRenderer->AddVertex(positions[x + 1][y + 1], texcoords[x + 1][y + 1]);
+
+				_canopyRenderer->AddVertex(positions[x + 1][y + 1], texcoords[x + 1][y + 1]);
+				_canopyRenderer->AddVertex(positions[x][y + 1], texcoords[x][y + 1]);
+				_canopyRenderer->AddVertex(positions[x][y], texcoords[x][y]);
+			}
+	}
+	_canopyRenderer->Draw(transform, _canopyTexture);
+}
+
+
+bool SmoothTerrainForest::IsTreePosition(glm::vec2 position) const
+{
+	return glm::distance(position, _bounds.center()) < _bounds.width() / 2
+		&& _terrainSurface->GetHeight(position) > 0
+		&& _terrainSurface->IsForest(position);
+}
+
+
+// Patches tile the map, each grid point with the area a tree may be
+// offset within.
+
+bounds2f SmoothTerrainForest::GetPatchBounds(int index) const
+{
+	glm::ivec2 patch(index % _patchCount.x, index / _patchCount.x);
+	glm::vec2 min = _bounds.min + _spacing * (glm::vec2(patch * patch_points) - 0.5f);
+	glm::vec2 max = min + _spacing * (float)patch_points;
+
+	return bounds2f(glm::max(min, _bounds.min), glm::min(max, _bounds.max));
+}
+
+
+// Each grid point takes three random values in turn, for the offset and
+// the shape, whether it has a tree or not. The rank is taken from the
+// shape value, beyond the part that picks the shape.
+
+void SmoothTerrainForest::PlaceTrees(int index)
+{
+	const std::vector<float>& randoms = tree_randoms();
+	const int count = (int)randoms.size();
+	const float adjust = 0.5 - 2.0 / 64.0; // place texture 2 texels below ground
+
+	Patch& patch = _patches[index];
+	patch.trees.clear();
+	patch.ranks.clear();
+
+	glm::ivec2 first = patch_points * glm::ivec2(index % _patchCount.x, index / _patchCount.x);
+	glm::ivec2 last = glm::min(first + patch_points, _gridSize);
+	for (int x = first.x; x < last.x; ++x)
+		for (int y = first.y; y < last.y; ++y)
+		{
+			int r = (3 * (x * _gridSize.y + y)) % count;
+			float dx = _spacing * (randoms[r] - 0.5f);
+			float dy = _spacing * (randoms[(r + 1) % count] - 0.5f);
+			float value = randoms[(r + 2) % count];
+			int shape = (int)(15 * value) & 15;
+
+			glm::vec2 position = _bounds.min + _spacing * glm::vec2(x, y) + glm::vec2(dx, dy);
+			if (IsTreePosition(position))
+			{
+				patch.trees.push_back(Billboard(_terrainSurface->GetPosition(position, adjust * 5), 0, 5, _treeShapes[shape]));
+				patch.ranks.push_back(glm::fract(15 * value));
+			}
+		}
+
+	patch.placed = true;
+}
+
+
+void SmoothTerrainForest::ReleaseTrees(int index)
+{
+	Patch& patch = _patches[index];
+	std::vector<Billboard>().swap(patch.trees);
+	std::vector<float>().swap(patch.ranks);
+	patch.placed = false;
+	patch.level = 0;
+}
+
+
+void SmoothTerrainForest::SampleHeights(int index)
+{
+	const int samples = 5;
+	bounds2f bounds = GetPatchBounds(index);
+	glm::vec2 step = bounds.size() / (float)(samples - 1);
+
+	bounds1f& heights = _patches[index].heights;
+	heights = bounds1f(_terrainSurface->GetHeight(bounds.min));
+	for (int y = 0; y < samples; ++y)
+		for (int x = 0; x < samples; ++x)
+		{
+			float h = _terrainSurface->GetHeight(bounds.min + step * glm::vec2(x, y));
+			heights.min = glm::min(heights.min, h);
+			heights.max = glm::max(heights.max, h);
+		}
+}
+
+
+// One texel per four meters on a 1024 meter map, dark green where there
+// is forest, with some variation in shade.
+
+void SmoothTerrainForest::BakeCanopy(bounds2f bounds)
+{
+	const std::vector<float>& randoms = tree_randoms();
+	const int count = (int)randoms.size();
+
+	glm::vec2 scale = (float)canopy_size / _bounds.size();
+	glm::vec2 p0 = glm::floor((bounds.min - _bounds.min) * scale);
+	glm::vec2 p1 = glm::ceil((bounds.max - _bounds.min) * scale);
+	int x0 = glm::max(0, (int)p0.x);
+	int y0 = glm::max(0, (int)p0.y);
+	int x1 = glm::min(canopy_size, (int)p1.x);
+	int y1 = glm::min(canopy_size, (int)p1.y);
+
+	for (int y = y0; y < y1; ++y)
+		for (int x = x0; x < x1; ++x)
+		{
+			glm::vec2 position = _bounds.min + (glm::vec2(x, y) + 0.5f) / scale;
+			float alpha = IsTreePosition(position) ? 0.9f : 0.0f;
+			float shade = 0.8f + 0.4f * randoms[(31 * x + 17 * y) % count];
+			glm::vec3 color = shade * glm::vec3(0.18f, 0.26f, 0.12f);
+			_canopyImage->set_pixel(x, y, glm::vec4(alpha * color, alpha));
+		}
+
+	_canopyTexture->load(*_canopyImage);
+
+	for (int i = 0; i < (int)_patches.size(); ++i)
+	{
+		bounds2f patchBounds = GetPatchBounds(i);
+		if (!patchBounds.intersects(bounds))
+			continue;
+
+		glm::ivec2 t0 = glm::max(glm::ivec2(glm::floor((patchBounds.min - _bounds.min) * scale)), glm::ivec2(0));
+		glm::ivec2 t1 = glm::min(glm::ivec2(glm::ceil((patchBounds.max - _bounds.min) * scale)), glm::ivec2(canopy_size));
+
+		bool canopy = false;
+		for (int y = t0.y; y < t1.y && !canopy; ++y)
+			for (int x = t0.x; x < t1.x && !canopy; ++x)
+				canopy = _canopyImage->get_pixel(x, y).a > 0;
+
+		_patches[i].canopy = canopy;
+	}
+}
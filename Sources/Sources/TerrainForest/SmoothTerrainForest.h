@@ -0,0 +1,87 @@
+// Copyright (C) 2013 Felix Ungman
+//
+// This file is part of the openwar platform (GPL v3 or later), see LICENSE.txt
+
+#ifndef SmoothTerrainForest_H
+#define SmoothTerrainForest_H
+
+#include <vector>
+
+#include "TerrainForest.h"
+#include "../../Library/Renderers/TextureBillboardRenderer.h"
+
+class image;
+struct frustum;
+class TerrainSurface;
+class TextureTriangleRenderer;
+
+
+// Trees stand on a grid over the map, each with a random offset and shape,
+// and are placed one patch of the grid at a time when first needed. Near
+// patches draw every tree, and mid patches a subset that thins out with
+// distance, always the same trees for the same density. Far patches draw a
+// canopy texture baked from the forest map instead, and release their trees.
+// The trees drawn are kept as the static billboards of the billboard model,
+// so that they stay presorted until a patch changes its density level.
+
+class SmoothTerrainForest : public TerrainForest
+{
+	static const int patch_points = 16; // grid points per patch side
+	static const int canopy_size = 256;
+	static const int density_levels = 8;
+
+	struct Patch
+	{
+		bool placed;
+		bool canopy;
+		int level; // density level drawn, 0 if not drawn
+		bounds1f heights; // sampled terrain heights, for culling
+		std::vector<Billboard> trees;
+		std::vector<float> ranks; // a tree is drawn at densities above its rank
+
+		Patch() : placed(false), canopy(false), level(0), heights(0, 0) {}
+	};
+
+	TerrainSurface* _terrainSurface;
+	int _treeShapes[16];
+	bounds2f _bounds;
+	float _spacing;
+	glm::ivec2 _gridSize;
+	glm::ivec2 _patchCount;
+	std::vector<Patch> _patches;
+	std::vector<int> _farPatches;
+
+	image* _canopyImage;
+	texture* _canopyTexture;
+	TextureTriangleRenderer* _canopyRenderer;
+
+public:
+	float nearDistance;
+	float farDistance;
+
+	SmoothTerrainForest(TerrainSurface* terrainSurface, const int* treeShapes);
+	virtual ~SmoothTerrainForest();
+
+	void Update(bounds2f bounds);
+
+	// Returns the number of canopy patches outside the view. Trees are not
+	// culled, see UpdateTreeBillboards.
+	int UpdateTreeBillboards(glm::vec3 cameraPosition, const frustum& view, BillboardModel* billboardModel);
+	int GetCanopyPatchCount() const { return (int)_farPatches.size(); } // in view
+
+	void RenderCanopy(const glm::mat4x4& transform);
+
+private:
+	bool IsTreePosition(glm::vec2 position) const;
+	bounds2f GetPatchBounds(int index) const;
+	void PlaceTrees(int index);
+	void ReleaseTrees(int index);
+	void SampleHeights(int index);
+	void BakeCanopy(bounds2f bounds);
+
+	SmoothTerrainForest(const SmoothTerrainForest&) {}
+	SmoothTerrainForest& operator=(const SmoothTerrainForest&) { return *this; }
+};
+
+
+#endif
@@ -13,3 +13,10 @@ TerrainSurface::TerrainSurface()
 TerrainSurface::~TerrainSurface()
 {
 }
+
+
+void TerrainSurface::IntersectMany(const ray* rays, int count, intersection* results) const
+{
+	for (int i = 0; i < count; ++i)
+		results[i] = Intersect(rays[i]);
+}
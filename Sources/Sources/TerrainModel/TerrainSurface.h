@@ -19,7 +19,8 @@ public:
 
 	virtual bounds2f GetBounds() const = 0;
 	virtual float GetHeight(glm::vec2 position) const = 0;
-	virtual const float* Intersect(ray r) = 0;
+	virtual intersection Intersect(ray r) const = 0;
+	virtual void IntersectMany(const ray* rays, int count, intersection* results) const;
 
 	virtual bool IsForest(glm::vec2 position) const = 0;
 	virtual bool IsImpassable(glm::vec2 position) const = 0;
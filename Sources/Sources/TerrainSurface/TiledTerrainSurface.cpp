@@ -10,7 +10,8 @@ _bounds(bounds),
 _size(size),
 _tiles(nullptr),
 _heightmap(nullptr),
-_nextTextureNumber(1)
+_nextTextureNumber(1),
+_version(0)
 {
 	_tiles = new Tile[size.x * size.y];
 	_heightmap = new heightmap(glm::ivec2(size.x + 1, size.y + 1));
@@ -21,6 +22,9 @@ TiledTerrainSurface::~TiledTerrainSurface()
 {
 	delete [] _tiles;
 	delete _heightmap;
+
+	for (std::pair<const int, image*>& i : _textures)
+		delete i.second;
 }
 
 
@@ -33,20 +37,19 @@ float TiledTerrainSurface::GetHeight(glm::vec2 position) const
 }
 
 
-float const* TiledTerrainSurface::Intersect(ray r)
+intersection TiledTerrainSurface::Intersect(ray r) const
 {
 	bounds2f bounds = GetBounds();
 	glm::vec3 offset = glm::vec3(bounds.min, 0);
 	glm::vec3 scale = glm::vec3(glm::vec2(_heightmap->size().x - 1, _heightmap->size().y - 1) / bounds.size(), 1);
 
 	ray r2 = ray(scale * (r.origin - offset), glm::normalize(scale * r.direction));
-	const float* d = _heightmap->intersect(r2);
-	if (d == nullptr)
-		return nullptr;
+	intersection i = _heightmap->intersect(r2);
+	if (!i.hit)
+		return intersection();
 
-	static float result;
-	result = glm::length((r2.point(*d) - r2.origin) / scale);
-	return &result;
+	float d = glm::length((i.point - r2.origin) / scale) / glm::length(r.direction);
+	return intersection(r, d, scale_normal(i.normal, 1.0f / scale));
 }
 
 
@@ -77,6 +80,7 @@ bool TiledTerrainSurface::ContainsWater(bounds2f bounds) const
 void TiledTerrainSurface::SetHeight(int x, int y, float h)
 {
 	_heightmap->set_height(x, y, h);
+	++_version;
 }
 
 
@@ -85,21 +89,19 @@ void TiledTerrainSurface::SetTile(int x, int y, const std::string& texture, int
 {
 	if (_textureNumber.find(texture) == _textureNumber.end())
 	{
-		::texture* t = new ::texture(image(resource(texture.c_str())));
-
-		glBindTexture(GL_TEXTURE_2D, t->id);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-		_textures[_nextTextureNumber] = t;
+		_textures[_nextTextureNumber] = new image(resource(texture.c_str()));
 		_textureNumber[texture] = _nextTextureNumber;
 		++_nextTextureNumber;
 	}
 
 	TiledTerrainSurface::Tile* tile = GetTile(x, y);
-	tile->_texture = _textures[_textureNumber[texture]];
+	if (tile == nullptr)
+		return;
+
+	tile->_texture = _textureNumber[texture];
 	tile->rotate = rotate;
 	tile->mirror = mirror;
+	++_version;
 }
 
 
@@ -110,3 +112,10 @@ TiledTerrainSurface::Tile* TiledTerrainSurface::GetTile(int x, int y)
 
 	return nullptr;
 }
+
+
+const image* TiledTerrainSurface::GetTextureImage(int number) const
+{
+	std::map<int, image*>::const_iterator i = _textures.find(number);
+	return i != _textures.end() ? i->second : nullptr;
+}
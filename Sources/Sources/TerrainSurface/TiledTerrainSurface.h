@@ -19,11 +19,11 @@ class TiledTerrainSurface : public TerrainSurface
 public:
 	struct Tile
 	{
-		texture* _texture;
+		int _texture; // 0 = none
 		int rotate; // counterclockwise
 		bool mirror;
 
-		Tile() : _texture(nullptr), rotate(0), mirror(false) { }
+		Tile() : _texture(0), rotate(0), mirror(false) { }
 	};
 
 private:
@@ -32,9 +32,10 @@ private:
 	Tile* _tiles;
 	heightmap* _heightmap;
 
-	std::map<int, texture*> _textures;
+	std::map<int, image*> _textures;
 	std::map<std::string, int> _textureNumber;
 	int _nextTextureNumber;
+	int _version;
 
 public:
 	TiledTerrainSurface(bounds2f bounds, glm::ivec2 size);
@@ -44,7 +45,7 @@ public:
 	glm::ivec2 GetSize() const { return _size; }
 
 	virtual float GetHeight(glm::vec2 position) const;
-	virtual const float* Intersect(ray r);
+	virtual intersection Intersect(ray r) const;
 
 	virtual bool IsWater(glm::vec2 position) const;
 	virtual bool IsForest(glm::vec2 position) const;
@@ -57,6 +58,13 @@ public:
 
 
 	Tile* GetTile(int x, int y);
+
+	// Textures are numbered from 1, in the order they were first used.
+	int GetTextureCount() const { return _nextTextureNumber - 1; }
+	const image* GetTextureImage(int number) const;
+
+	// Changes on every SetHeight and SetTile.
+	int GetVersion() const { return _version; }
 };
 
 
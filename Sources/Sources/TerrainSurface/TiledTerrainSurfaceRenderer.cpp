@@ -8,31 +8,209 @@
 #include "TiledTerrainSurface.h"
 
 
+// Atlas cells have a border of replicated edge pixels,
+// so that linear filtering never samples a neighbour.
+static const int atlas_gutter = 2;
+
+
+static void print_log(const char* operation, const char* message)
+{
+#ifdef OPENWAR_USE_NSBUNDLE_RESOURCES
+	NSLog(@"TiledTerrainSurfaceRenderer (%s):\n%s", operation, message);
+#endif
+}
+
+
+static int next_power_of_two(int value)
+{
+	int result = 1;
+	while (result < value)
+		result *= 2;
+	return result;
+}
+
+
+// Each dst pixel is the average of a factor x factor block of src,
+// clipped at the right and bottom edges.
+
+static void downsample_pixels(pixel_view<rgba8> dst, pixel_view<const rgba8> src, int factor)
+{
+	for (int y = 0; y < dst.height(); ++y)
+		for (int x = 0; x < dst.width(); ++x)
+		{
+			int x1 = glm::min((x + 1) * factor, src.width());
+			int y1 = glm::min((y + 1) * factor, src.height());
+			int sum[4] = { 0, 0, 0, 0 };
+			for (int j = y * factor; j < y1; ++j)
+				for (int i = x * factor; i < x1; ++i)
+					for (int c = 0; c < 4; ++c)
+						sum[c] += src.at(i, j)[c];
+
+			int n = (x1 - x * factor) * (y1 - y * factor);
+			rgba8& p = dst.at(x, y);
+			for (int c = 0; c < 4; ++c)
+				p[c] = (unsigned char)((sum[c] + n / 2) / n);
+		}
+}
+
+
+static void copy_with_gutter(pixel_view<rgba8> dst, pixel_view<const rgba8> src, int gutter)
+{
+	int w = src.width();
+	int h = src.height();
+
+	copy_pixels(dst.subview(gutter, gutter, w, h), src);
+
+	for (int i = 0; i < gutter; ++i)
+	{
+		copy_pixels(dst.subview(gutter, i, w, 1), src.subview(0, 0, w, 1));
+		copy_pixels(dst.subview(gutter, gutter + h + i, w, 1), src.subview(0, h - 1, w, 1));
+	}
+
+	for (int i = 0; i < gutter; ++i)
+	{
+		copy_pixels(dst.subview(i, 0, 1, h + 2 * gutter), dst.subview(gutter, 0, 1, h + 2 * gutter));
+		copy_pixels(dst.subview(gutter + w + i, 0, 1, h + 2 * gutter), dst.subview(gutter + w - 1, 0, 1, h + 2 * gutter));
+	}
+}
+
+
+
 TiledTerrainSurfaceRenderer::TiledTerrainSurfaceRenderer(TiledTerrainSurface* terrainSurfaceModel) :
-_terrainSurfaceModel(terrainSurfaceModel)
+_terrainSurfaceModel(terrainSurfaceModel),
+_atlas(nullptr),
+_atlasTextureCount(-1),
+_shapeVersion(-1)
 {
+	_shape._mode = GL_TRIANGLES;
 }
 
 
 TiledTerrainSurfaceRenderer::~TiledTerrainSurfaceRenderer()
 {
+	delete _atlas;
 }
 
 
 void TiledTerrainSurfaceRenderer::Render(const glm::mat4x4& transform, const glm::vec3& lightNormal)
+{
+	if (_atlasTextureCount != _terrainSurfaceModel->GetTextureCount())
+		UpdateAtlas();
+	if (_atlas == nullptr)
+		return;
+
+	if (_shapeVersion != _terrainSurfaceModel->GetVersion())
+		UpdateShape();
+
+	texture_uniforms uniforms;
+	uniforms._transform = transform;
+	uniforms._texture = _atlas;
+
+	renderers::singleton->_texture_renderer3->render(_shape, uniforms);
+}
+
+
+// Cell 0 is opaque black, for tiles without a texture. Tiles are scaled
+// down by a power of two when the atlas would exceed GL_MAX_TEXTURE_SIZE.
+
+void TiledTerrainSurfaceRenderer::UpdateAtlas()
+{
+	int count = _terrainSurfaceModel->GetTextureCount();
+
+	glm::ivec2 tileSize(1, 1);
+	for (int number = 1; number <= count; ++number)
+		tileSize = glm::max(tileSize, _terrainSurfaceModel->GetTextureImage(number)->size());
+
+	int columns = 1;
+	while (columns * columns < count + 1)
+		++columns;
+	int rows = (count + columns) / columns;
+
+	GLint maxSize = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+	CHECK_ERROR_GL();
+
+	int factor = 1;
+	glm::ivec2 cell, size;
+	for (;;)
+	{
+		cell = (tileSize + factor - 1) / factor + 2 * atlas_gutter;
+		size = glm::ivec2(next_power_of_two(columns * cell.x), next_power_of_two(rows * cell.y));
+		if (size.x <= maxSize && size.y <= maxSize)
+			break;
+
+		if (cell.x == 1 + 2 * atlas_gutter && cell.y == 1 + 2 * atlas_gutter)
+		{
+			print_log("UpdateAtlas", "too many textures for GL_MAX_TEXTURE_SIZE");
+			delete _atlas;
+			_atlas = nullptr;
+			_atlasBounds.assign(count + 1, bounds2f(0, 0, 0, 0));
+			_atlasTextureCount = count;
+			return;
+		}
+		factor *= 2;
+	}
+
+	image atlas(size.x, size.y);
+	pixel_view<rgba8> pixels = atlas.view();
+	fill_pixels(pixels, rgba8(0, 0, 0, 255));
+
+	_atlasBounds.resize(count + 1);
+	for (int number = 0; number <= count; ++number)
+	{
+		glm::ivec2 origin = cell * glm::ivec2(number % columns, number / columns);
+		glm::ivec2 extent = cell - 2 * atlas_gutter;
+
+		const image* tile = number != 0 ? _terrainSurfaceModel->GetTextureImage(number) : nullptr;
+		if (tile != nullptr && tile->size().x > 0 && tile->size().y > 0)
+		{
+			extent = (tile->size() + factor - 1) / factor;
+			pixel_view<rgba8> dst = pixels.subview(origin.x, origin.y, extent.x + 2 * atlas_gutter, extent.y + 2 * atlas_gutter);
+			if (factor == 1)
+			{
+				copy_with_gutter(dst, tile->view(), atlas_gutter);
+			}
+			else
+			{
+				image scaled(extent.x, extent.y);
+				downsample_pixels(scaled.view(), tile->view(), factor);
+				copy_with_gutter(dst, scaled.view(), atlas_gutter);
+			}
+		}
+
+		glm::vec2 p0 = glm::vec2(origin + atlas_gutter) / glm::vec2(size);
+		glm::vec2 p1 = glm::vec2(origin + atlas_gutter + extent) / glm::vec2(size);
+		_atlasBounds[number] = bounds2f(p0, p1);
+	}
+
+	delete _atlas;
+	_atlas = new texture(atlas);
+
+	glstate::shared().bind_texture(_atlas->id);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glstate::shared().bind_texture(0);
+
+	_atlasTextureCount = count;
+	_shapeVersion = -1;
+}
+
+
+void TiledTerrainSurfaceRenderer::UpdateShape()
 {
 	bounds2f bounds = _terrainSurfaceModel->GetBounds();
 	glm::ivec2 size = _terrainSurfaceModel->GetSize();
 
-	vertexbuffer<texture_vertex3> shape;
-	shape._mode = GL_TRIANGLES;
-
 	glm::vec2 delta = bounds.size() / glm::vec2(size);
 
+	_shape._vertices.clear();
+	_shape._vertices.reserve(6 * size.x * size.y);
+
 	for (int x = 0; x < size.x; ++x)
 		for (int y = 0; y < size.y; ++y)
 		{
 			TiledTerrainSurface::Tile* tile = _terrainSurfaceModel->GetTile(x, y);
+			bounds2f cell = _atlasBounds[tile->_texture];
 
 			glm::vec2 p0 = bounds.min + delta * glm::vec2(x, y);
 			glm::vec2 p1 = p0 + delta;
@@ -74,20 +252,19 @@ void TiledTerrainSurfaceRenderer::Render(const glm::mat4x4& transform, const glm
 				t10 = tmp;
 			}
 
-			shape._vertices.clear();
-			shape._vertices.push_back(texture_vertex3(glm::vec3(p0.x, p0.y, h00), t01));
-			shape._vertices.push_back(texture_vertex3(glm::vec3(p1.x, p0.y, h10), t11));
-			shape._vertices.push_back(texture_vertex3(glm::vec3(p1.x, p1.y, h11), t10));
-			shape._vertices.push_back(texture_vertex3(glm::vec3(p1.x, p1.y, h11), t10));
-			shape._vertices.push_back(texture_vertex3(glm::vec3(p0.x, p1.y, h01), t00));
-			shape._vertices.push_back(texture_vertex3(glm::vec3(p0.x, p0.y, h00), t01));
+			t00 = cell.min + t00 * cell.size();
+			t01 = cell.min + t01 * cell.size();
+			t10 = cell.min + t10 * cell.size();
+			t11 = cell.min + t11 * cell.size();
 
-			shape.update(GL_STATIC_DRAW);
-
-			texture_uniforms uniforms;
-			uniforms._transform = transform;
-			uniforms._texture = tile->_texture;
-
-			renderers::singleton->_texture_renderer3->render(shape, uniforms);
+			_shape._vertices.push_back(texture_vertex3(glm::vec3(p0.x, p0.y, h00), t01));
+			_shape._vertices.push_back(texture_vertex3(glm::vec3(p1.x, p0.y, h10), t11));
+			_shape._vertices.push_back(texture_vertex3(glm::vec3(p1.x, p1.y, h11), t10));
+			_shape._vertices.push_back(texture_vertex3(glm::vec3(p1.x, p1.y, h11), t10));
+			_shape._vertices.push_back(texture_vertex3(glm::vec3(p0.x, p1.y, h01), t00));
+			_shape._vertices.push_back(texture_vertex3(glm::vec3(p0.x, p0.y, h00), t01));
 		}
+
+	_shape.update(GL_STATIC_DRAW);
+	_shapeVersion = _terrainSurfaceModel->GetVersion();
 }
@@ -5,15 +5,28 @@
 #ifndef TiledTerrainSurfaceRenderer_H
 #define TiledTerrainSurfaceRenderer_H
 
+#include <vector>
 #include <glm/glm.hpp>
+#include "../../Library/Algebra/bounds.h"
 #include "../../Library/Graphics/texture.h"
+#include "../../Library/Graphics/vertexbuffer.h"
 
 class TiledTerrainSurface;
 
 
+// Draws the whole tiled surface with one call. The tile textures are
+// packed into an atlas, with rotation and mirroring baked into the texture
+// coordinates of a static vertex buffer, which is rebuilt only when the
+// surface changes.
+
 class TiledTerrainSurfaceRenderer
 {
 	TiledTerrainSurface* _terrainSurfaceModel;
+	texture* _atlas;
+	int _atlasTextureCount;
+	std::vector<bounds2f> _atlasBounds;
+	vertexbuffer<texture_vertex3> _shape;
+	int _shapeVersion;
 
 public:
 	TiledTerrainSurfaceRenderer(TiledTerrainSurface* terrainSurfaceModel);
@@ -22,6 +35,10 @@ public:
 	TiledTerrainSurface* GetTerrainSurfaceModel() const { return _terrainSurfaceModel; }
 
 	void Render(const glm::mat4x4& transform, const glm::vec3& lightNormal);
+
+private:
+	void UpdateAtlas();
+	void UpdateShape();
 };
 
 
@@ -22,6 +22,20 @@ void EditorGesture::Update(Surface* surface, double secondsSinceLastUpdate)
 }
 
 
+void EditorGesture::KeyDown(Surface* surface, char key)
+{
+	if (_battleView->GetSurface() != surface)
+		return;
+
+	switch (key)
+	{
+		case 'Z': _editorModel->Undo(); break;
+		case 'Y': _editorModel->Redo(); break;
+		default: break;
+	}
+}
+
+
 void EditorGesture::TouchBegan(Touch* touch)
 {
 	if (touch->GetSurface() != _battleView->GetSurface())
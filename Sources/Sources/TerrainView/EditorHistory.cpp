@@ -0,0 +1,171 @@
+// Copyright (C) 2013 Felix Ungman
+//
+// This file is part of the openwar platform (GPL v3 or later), see LICENSE.txt
+
+#include <algorithm>
+#include "EditorHistory.h"
+#include "../SmoothTerrain/SmoothTerrainSurface.h"
+
+
+
+EditorHistory::EditorHistory(SmoothTerrainSurface* smoothTerrainSurface, size_t budget) :
+_smoothTerrainSurface(smoothTerrainSurface),
+_tileSize(64),
+_budget(budget),
+_memory(0),
+_stroke(nullptr)
+{
+}
+
+
+EditorHistory::~EditorHistory()
+{
+	for (Step* step : _undo)
+		delete step;
+	for (Step* step : _redo)
+		delete step;
+	delete _stroke;
+}
+
+
+void EditorHistory::BeginStroke()
+{
+	EndStroke();
+
+	image* groundmap = _smoothTerrainSurface != nullptr ? _smoothTerrainSurface->GetGroundMap() : nullptr;
+	if (groundmap == nullptr)
+		return;
+
+	glm::ivec2 tiles = (groundmap->size() + _tileSize - 1) / _tileSize;
+	_saved.assign(tiles.x * tiles.y, false);
+	_stroke = new Step();
+}
+
+
+void EditorHistory::Save(bounds2f bounds)
+{
+	if (_stroke == nullptr)
+		return;
+
+	pixel_view<rgba8> ground = _smoothTerrainSurface->GetGroundMap()->view();
+	glm::ivec2 tiles = (ground.size() + _tileSize - 1) / _tileSize;
+
+	glm::ivec2 min = glm::max(_smoothTerrainSurface->MapWorldToImage(bounds.min) - 1, 0) / _tileSize;
+	glm::ivec2 max = glm::min(_smoothTerrainSurface->MapWorldToImage(bounds.max) + 1, ground.size() - 1) / _tileSize;
+
+	for (int ty = min.y; ty <= max.y; ++ty)
+		for (int tx = min.x; tx <= max.x; ++tx)
+		{
+			int index = tx + ty * tiles.x;
+			if (_saved[index])
+				continue;
+
+			Tile tile;
+			tile._origin = glm::ivec2(tx, ty) * _tileSize;
+			tile._size = glm::min(glm::ivec2(_tileSize), ground.size() - tile._origin);
+			tile._pixels.resize(tile._size.x * tile._size.y);
+
+			pixel_view<rgba8> copy(tile._pixels.data(), tile._size.x, tile._size.y, tile._size.x);
+			copy_pixels(copy, ground.subview(tile._origin.x, tile._origin.y, tile._size.x, tile._size.y));
+
+			_memory += tile._pixels.size() * sizeof(rgba8);
+			_stroke->_tiles.push_back(std::move(tile));
+			_saved[index] = true;
+		}
+}
+
+
+void EditorHistory::EndStroke()
+{
+	if (_stroke == nullptr)
+		return;
+
+	if (_stroke->_tiles.empty())
+	{
+		delete _stroke;
+	}
+	else
+	{
+		for (Step* step : _redo)
+			Delete(step);
+		_redo.clear();
+
+		_undo.push_back(_stroke);
+		Trim();
+	}
+
+	_stroke = nullptr;
+}
+
+
+bounds2f EditorHistory::Undo()
+{
+	EndStroke();
+
+	if (_undo.empty())
+		return bounds2f();
+
+	Step* step = _undo.back();
+	_undo.pop_back();
+	_redo.push_back(step);
+
+	return Swap(step);
+}
+
+
+bounds2f EditorHistory::Redo()
+{
+	EndStroke();
+
+	if (_redo.empty())
+		return bounds2f();
+
+	Step* step = _redo.back();
+	_redo.pop_back();
+	_undo.push_back(step);
+
+	return Swap(step);
+}
+
+
+bounds2f EditorHistory::Swap(Step* step)
+{
+	pixel_view<rgba8> ground = _smoothTerrainSurface->GetGroundMap()->view();
+
+	glm::ivec2 min = ground.size();
+	glm::ivec2 max = glm::ivec2();
+	for (Tile& tile : step->_tiles)
+	{
+		for (int y = 0; y < tile._size.y; ++y)
+		{
+			rgba8* row = ground.row(tile._origin.y + y) + tile._origin.x;
+			std::swap_ranges(row, row + tile._size.x, tile._pixels.data() + y * tile._size.x);
+		}
+
+		min = glm::min(min, tile._origin);
+		max = glm::max(max, tile._origin + tile._size);
+	}
+
+	// one pixel of margin, like the brush bounds
+	bounds2f bounds = _smoothTerrainSurface->GetBounds();
+	glm::vec2 scale = bounds.size() / glm::vec2(ground.size());
+	return bounds2f(bounds.min + scale * glm::vec2(min - 1), bounds.min + scale * glm::vec2(max + 1));
+}
+
+
+void EditorHistory::Trim()
+{
+	while (_memory > _budget && !_undo.empty())
+	{
+		Delete(_undo.front());
+		_undo.pop_front();
+	}
+}
+
+
+void EditorHistory::Delete(Step* step)
+{
+	for (const Tile& tile : step->_tiles)
+		_memory -= tile._pixels.size() * sizeof(rgba8);
+	delete step;
+}
@@ -0,0 +1,67 @@
+// Copyright (C) 2013 Felix Ungman
+//
+// This file is part of the openwar platform (GPL v3 or later), see LICENSE.txt
+
+#ifndef EDITORHISTORY_H
+#define EDITORHISTORY_H
+
+#include <deque>
+#include <vector>
+#include "../../Library/Algebra/bounds.h"
+#include "../../Library/Algebra/image.h"
+
+class SmoothTerrainSurface;
+
+
+// Undo history for the groundmap, kept at tile granularity. The first time
+// a stroke touches a tile, the tile is copied before it is modified. Undo
+// and redo swap the copies with the groundmap, so each step holds a single
+// copy of the tiles it edited. The oldest steps are dropped when the
+// copies exceed the memory budget.
+
+class EditorHistory
+{
+	struct Tile
+	{
+		glm::ivec2 _origin;
+		glm::ivec2 _size;
+		std::vector<rgba8> _pixels;
+	};
+
+	struct Step
+	{
+		std::vector<Tile> _tiles;
+	};
+
+	SmoothTerrainSurface* _smoothTerrainSurface;
+	int _tileSize;
+	size_t _budget;
+	size_t _memory;
+	std::deque<Step*> _undo;
+	std::vector<Step*> _redo;
+	Step* _stroke;
+	std::vector<bool> _saved;
+
+public:
+	EditorHistory(SmoothTerrainSurface* smoothTerrainSurface, size_t budget = 32 << 20);
+	~EditorHistory();
+
+	bool CanUndo() const { return !_undo.empty() || (_stroke != nullptr && !_stroke->_tiles.empty()); }
+	bool CanRedo() const { return !_redo.empty(); }
+
+	void BeginStroke();
+	void Save(bounds2f bounds);
+	void EndStroke();
+
+	// Return the changed bounds, or empty bounds if there was nothing to do.
+	bounds2f Undo();
+	bounds2f Redo();
+
+private:
+	bounds2f Swap(Step* step);
+	void Trim();
+	void Delete(Step* step);
+};
+
+
+#endif
@@ -14,7 +14,9 @@ _battleView(battleView),
 _smoothTerrainSurface(smoothTerrainSurface),
 _editorMode(EditorMode::Hand),
 _terrainFeature(TerrainFeature::Hills),
-_brush(nullptr)
+_brush(nullptr),
+_history(smoothTerrainSurface),
+_changes(0, 0, 0, 0)
 {
 	_brush = new image(48, 48);
 	_mixer = new image(48, 48);
@@ -23,6 +25,9 @@ _brush(nullptr)
 
 void EditorModel::ToolBegan(glm::vec2 position)
 {
+	if (_editorMode != EditorMode::Hand)
+		_history.BeginStroke();
+
 	switch (_editorMode)
 	{
 		case EditorMode::Smear:
@@ -84,17 +89,19 @@ void EditorModel::ToolEnded(glm::vec2 position)
 		default:
 			break;
 	}
+
+	_history.EndStroke();
 }
 
 
 void EditorModel::Paint(TerrainFeature feature, glm::vec2 position, bool value)
 {
 	float radius = feature == TerrainFeature::Hills ? 48 : 16;
+	_history.Save(bounds2_from_center(position, radius + 1));
+
 	bounds2f bounds = _smoothTerrainSurface->Paint(feature, position, radius, value ? 0.4f : -0.4f);
 
-	_smoothTerrainSurface->UpdateChanges(bounds);
-	_battleView->UpdateTerrainTrees(bounds);
-	_battleView->GetBattleModel()->terrainWater->Update();
+	AddChanges(bounds);
 }
 
 
@@ -113,23 +120,56 @@ void EditorModel::SmearPaint(TerrainFeature feature, glm::vec2 position)
 	while (_brushDistance > 2.0f)
 	{
 		_smoothTerrainSurface->Extract(position, _mixer);
-
-		glm::ivec2 size = _brush->size();
-		for (int x = 0; x < size.x; ++x)
-			for (int y = 0; y < size.y; ++y)
-			{
-				glm::vec4 c = _brush->get_pixel(x, y);
-				glm::vec4 m = _mixer->get_pixel(x, y);
-				c = glm::mix(c, m, 0.1f);
-				_brush->set_pixel(x, y, c);
-			}
+		blend_pixels(_brush->view(), _mixer->view(), 0.1f);
 
 		_brushDistance -= 2.0f;
 	}
 
+	_history.Save(bounds2_from_center(position, _brush->size().x / 2.0f + 1));
+
 	bounds2f bounds = _smoothTerrainSurface->Paint(feature, position, _brush, 0.5f);
 
-	_smoothTerrainSurface->UpdateChanges(bounds);
-	_battleView->UpdateTerrainTrees(bounds);
+	AddChanges(bounds);
+}
+
+
+void EditorModel::Undo()
+{
+	bounds2f bounds = _history.Undo();
+	if (!bounds.is_empty())
+		AddChanges(bounds);
+}
+
+
+void EditorModel::Redo()
+{
+	bounds2f bounds = _history.Redo();
+	if (!bounds.is_empty())
+		AddChanges(bounds);
+}
+
+
+void EditorModel::UpdateChanges()
+{
+	if (_changes.is_empty())
+		return;
+
+	_smoothTerrainSurface->UpdateChanges(_changes);
+	_battleView->UpdateTerrainTrees(_changes);
+	_battleView->UpdateTerrainHeights(_changes);
 	_battleView->GetBattleModel()->terrainWater->Update();
+
+	_changes = bounds2f(0, 0, 0, 0);
+}
+
+
+void EditorModel::AddChanges(bounds2f bounds)
+{
+	if (bounds.is_empty())
+		return;
+
+	if (_changes.is_empty())
+		_changes = bounds;
+	else
+		_changes = bounds2f(glm::min(_changes.min, bounds.min), glm::max(_changes.max, bounds.max));
 }
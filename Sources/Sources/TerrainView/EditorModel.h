@@ -6,6 +6,7 @@
 #define EDITORMODEL_H
 
 #include "../SmoothTerrain/SmoothTerrainSurface.h"
+#include "EditorHistory.h"
 
 class BattleView;
 
@@ -22,6 +23,8 @@ class EditorModel
 	image* _mixer;
 	glm::vec2 _brushPosition;
 	float _brushDistance;
+	EditorHistory _history;
+	bounds2f _changes;
 
 public:
 	EditorModel(BattleView* battleView, SmoothTerrainSurface* smoothTerrainSurface);
@@ -36,7 +39,18 @@ public:
 	void ToolMoved(glm::vec2 position);
 	void ToolEnded(glm::vec2 position);
 
+	bool CanUndo() const { return _history.CanUndo(); }
+	bool CanRedo() const { return _history.CanRedo(); }
+	void Undo();
+	void Redo();
+
+	// Brush dabs write the groundmap at once, but the derived terrain data
+	// is refreshed here, once per frame, over the union of their bounds.
+	void UpdateChanges();
+
 private:
+	void AddChanges(bounds2f bounds);
+
 	void Paint(TerrainFeature feature, glm::vec2 position, bool value);
 
 	void SmearReset(TerrainFeature feature, glm::vec2 position);
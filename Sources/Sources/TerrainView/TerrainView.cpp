@@ -205,8 +205,8 @@ ray TerrainView::GetCameraRay(glm::vec2 screenPosition) const
 glm::vec3 TerrainView::GetTerrainPosition2(glm::vec2 screenPosition) const
 {
 	ray r = GetCameraRay(screenPosition);
-	const float* d = intersect(r, plane(glm::vec3(0, 0, 1), 0));
-	return r.point(d != nullptr ? *d : 0);
+	intersection i = intersect(r, plane(glm::vec3(0, 0, 1), 0));
+	return i.hit ? i.point : r.origin;
 }
 
 
@@ -216,8 +216,8 @@ glm::vec3 TerrainView::GetTerrainPosition3(glm::vec2 screenPosition) const
 		return glm::vec3();
 
 	ray r = GetCameraRay(screenPosition);
-	const float* d = _terrainSurface->Intersect(r);
-	return r.point(d != nullptr ? *d : 0);
+	intersection i = _terrainSurface->Intersect(r);
+	return i.hit ? i.point : r.origin;
 }
 
 
@@ -227,10 +227,10 @@ void TerrainView::Move(glm::vec3 originalContentPosition, glm::vec2 currentScree
 	ray ray2 = ray(originalContentPosition, -ray1.direction);
 
 	plane cameraPlane(glm::vec3(0, 0, 1), _cameraPosition);
-	const float* d = intersect(ray2, cameraPlane);
-	if (d != nullptr)
+	intersection i = intersect(ray2, cameraPlane);
+	if (i.hit)
 	{
-		MoveCamera(ray2.point(*d));
+		MoveCamera(i.point);
 	}
 }
 
@@ -2,6 +2,8 @@
 //
 // This file is part of the openwar platform (GPL v3 or later), see LICENSE.txt
 
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 
 #if OPENWAR_USE_GLEW
@@ -17,9 +19,13 @@
 #endif
 
 #include "Sources/OpenWarSurface.h"
+#include "Library/Graphics/program_cache.h"
+#include "Library/profiler.h"
 #include "Library/ViewCore/Window.h"
 #include "Sources/BattleScript.h"
 #include "Sources/TerrainForest/BillboardTerrainForest.h"
+#include "Sources/SmoothTerrain/SmoothTerrainMap.h"
+#include "Sources/SmoothTerrain/SmoothTerrainSurface.h"
 
 
 
@@ -73,6 +79,24 @@ static BattleScript* CreateBattleScript()
 
 #endif
 
+
+// Offline map compiler: derives the smooth terrain from a groundmap in the
+// resources and writes it as a SmoothTerrainMap. Building the surface needs
+// a GL context, so this runs once the window has been created.
+
+static int CompileMap(const char* input, const char* output, float size)
+{
+	image* map = new image(resource(input));
+	SmoothTerrainSurface* terrain = new SmoothTerrainSurface(bounds2f(0, 0, size, size), map);
+
+	bool ok = SmoothTerrainMap::Write(output, *terrain);
+	std::cout << (ok ? "compiled " : "could not compile ") << input << " to " << output << std::endl;
+
+	delete terrain;
+	delete map;
+	return ok ? 0 : 1;
+}
+
  
 int main(int argc, char *argv[])
 {
@@ -84,6 +108,13 @@ int main(int argc, char *argv[])
 	SDL_Init(SDL_INIT_EVERYTHING);
 	IMG_Init(IMG_INIT_JPG | IMG_INIT_PNG);
 
+	char* prefPath = SDL_GetPrefPath("openwar", "openwar");
+	if (prefPath != nullptr)
+	{
+		program_cache::init(prefPath);
+		SDL_free(prefPath);
+	}
+
 	Window* window = new Window();
 
 #if OPENWAR_USE_GLEW
@@ -94,11 +125,22 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 #endif
+
+	// openwar --compile-map Maps/DefaultMap.tiff <output>.owmap [size]
+	if (argc >= 4 && std::strcmp(argv[1], "--compile-map") == 0)
+	{
+		int result = CompileMap(argv[2], argv[3], argc >= 5 ? (float)std::atof(argv[4]) : 1024);
+		SDL_Quit();
+		return result;
+	}
     
 	OpenWarSurface* surface = new OpenWarSurface(glm::vec2(640, 480), 1);
 	window->SetSurface(surface);
 
 	surface->Reset(CreateBattleScript());
+
+	// time spent building the terrain, in the "terrain." profile scopes
+	profiler::shared().log("terrain.");
     
 	while (!Window::IsDone())
 		Window::ProcessEvents();